@@ -147,8 +147,11 @@ static void igb_update_dca(struct igb_q_vector *);
 static void igb_setup_dca(struct igb_adapter *);
 #endif /* CONFIG_IGB_DCA */
 static int igb_poll(struct napi_struct *, int);
+#ifdef CONFIG_NET_RX_BUSY_POLL
+static int igb_busy_poll_recv(struct napi_struct *);
+#endif
 static bool igb_clean_tx_irq(struct igb_q_vector *);
-static bool igb_clean_rx_irq(struct igb_q_vector *, int);
+static int igb_clean_rx_irq(struct igb_q_vector *, int);
 static int igb_ioctl(struct net_device *, struct ifreq *, int cmd);
 static void igb_tx_timeout(struct net_device *);
 static void igb_reset_task(struct work_struct *);
@@ -1003,8 +1006,12 @@ static void igb_free_q_vectors(struct igb_adapter *adapter)
 		adapter->q_vector[v_idx] = NULL;
 		if (!q_vector)
 			continue;
+		napi_hash_del(&q_vector->napi);
 		netif_napi_del(&q_vector->napi);
-		kfree(q_vector);
+		/* a busy polling socket may still be looking at this
+		 * q_vector, wait a grace period before freeing it.
+		 */
+		kfree_rcu(q_vector, rcu);
 	}
 	adapter->num_q_vectors = 0;
 }
@@ -1141,6 +1148,7 @@ static int igb_alloc_q_vectors(struct igb_adapter *adapter)
 		q_vector->itr_register = hw->hw_addr + E1000_EITR(0);
 		q_vector->itr_val = IGB_START_ITR;
 		netif_napi_add(adapter->netdev, &q_vector->napi, igb_poll, 64);
+		napi_hash_add(&q_vector->napi);
 		adapter->q_vector[v_idx] = q_vector;
 	}
 	/* Restore the adapter's original node */
@@ -1533,8 +1541,10 @@ int igb_up(struct igb_adapter *adapter)
 
 	clear_bit(__IGB_DOWN, &adapter->state);
 
-	for (i = 0; i < adapter->num_q_vectors; i++)
+	for (i = 0; i < adapter->num_q_vectors; i++) {
+		igb_qv_init_lock(adapter->q_vector[i]);
 		napi_enable(&(adapter->q_vector[i]->napi));
+	}
 
 	if (adapter->msix_entries)
 		igb_configure_msix(adapter);
@@ -1587,8 +1597,11 @@ void igb_down(struct igb_adapter *adapter)
 	wrfl();
 	msleep(10);
 
-	for (i = 0; i < adapter->num_q_vectors; i++)
+	for (i = 0; i < adapter->num_q_vectors; i++) {
 		napi_disable(&(adapter->q_vector[i]->napi));
+		while (!igb_qv_disable(adapter->q_vector[i]))
+			usleep_range(1000, 20000);
+	}
 
 	igb_irq_disable(adapter);
 
@@ -1810,6 +1823,9 @@ static const struct net_device_ops igb_netdev_ops = {
 	.ndo_get_vf_config	= igb_ndo_get_vf_config,
 #ifdef CONFIG_NET_POLL_CONTROLLER
 	.ndo_poll_controller	= igb_netpoll,
+#endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	.ndo_busy_poll		= igb_busy_poll_recv,
 #endif
 	.ndo_fix_features	= igb_fix_features,
 	.ndo_set_features	= igb_set_features,
@@ -2056,6 +2072,7 @@ static int __devinit igb_probe(struct pci_dev *pdev,
 	}
 
 	netdev->priv_flags |= IFF_UNICAST_FLT;
+	netdev->priv_flags |= IFF_RX_FILTER;
 
 	adapter->en_mng_pt = igb_enable_mng_pass_thru(hw);
 
@@ -2575,8 +2592,10 @@ static int __igb_open(struct net_device *netdev, bool resuming)
 	/* From here on the code is the same as igb_up() */
 	clear_bit(__IGB_DOWN, &adapter->state);
 
-	for (i = 0; i < adapter->num_q_vectors; i++)
+	for (i = 0; i < adapter->num_q_vectors; i++) {
+		igb_qv_init_lock(adapter->q_vector[i]);
 		napi_enable(&(adapter->q_vector[i]->napi));
+	}
 
 	/* Clear any pending interrupts. */
 	rd32(E1000_ICR);
@@ -4270,6 +4289,39 @@ static void igb_tx_olinfo_status(struct igb_ring *tx_ring,
 #define IGB_MAX_TXD_PWR	15
 #define IGB_MAX_DATA_PER_TXD	(1<<IGB_MAX_TXD_PWR)
 
+static int __igb_maybe_stop_tx(struct igb_ring *tx_ring, const u16 size)
+{
+	struct net_device *netdev = tx_ring->netdev;
+
+	netif_stop_subqueue(netdev, tx_ring->queue_index);
+
+	/* Herbert's original patch had:
+	 *  smp_mb__after_netif_stop_queue();
+	 * but since that doesn't exist yet, just open code it. */
+	smp_mb();
+
+	/* We need to check again in a case another CPU has just
+	 * made room available. */
+	if (igb_desc_unused(tx_ring) < size)
+		return -EBUSY;
+
+	/* A reprieve! */
+	netif_wake_subqueue(netdev, tx_ring->queue_index);
+
+	u64_stats_update_begin(&tx_ring->tx_syncp2);
+	tx_ring->tx_stats.restart_queue2++;
+	u64_stats_update_end(&tx_ring->tx_syncp2);
+
+	return 0;
+}
+
+static inline int igb_maybe_stop_tx(struct igb_ring *tx_ring, const u16 size)
+{
+	if (igb_desc_unused(tx_ring) >= size)
+		return 0;
+	return __igb_maybe_stop_tx(tx_ring, size);
+}
+
 static void igb_tx_map(struct igb_ring *tx_ring,
 		       struct igb_tx_buffer *first,
 		       const u8 hdr_len)
@@ -4285,6 +4337,7 @@ static void igb_tx_map(struct igb_ring *tx_ring,
 	__le32 cmd_type;
 	u32 tx_flags = first->tx_flags;
 	u16 i = tx_ring->next_to_use;
+	bool xmit_more;
 
 	tx_desc = IGB_TX_DESC(tx_ring, i);
 
@@ -4379,16 +4432,23 @@ static void igb_tx_map(struct igb_ring *tx_ring,
 
 	tx_ring->next_to_use = i;
 
-	writel(i, tx_ring->tail);
+	/* Make sure there is space in the ring for the next send. */
+	igb_maybe_stop_tx(tx_ring, MAX_SKB_FRAGS + 4);
 
-	/* we need this if more than one processor can write to our tail
-	 * at a time, it syncronizes IO on IA64/Altix systems */
-	mmiowb();
+	/* notify HW of packet, once per burst unless the ring filled up */
+	if (!skb->xmit_more || netif_xmit_stopped(txring_txq(tx_ring))) {
+		writel(i, tx_ring->tail);
+
+		/* we need this if more than one processor can write to our
+		 * tail at a time, it syncronizes IO on IA64/Altix systems */
+		mmiowb();
+	}
 
 	return;
 
 dma_error:
 	dev_err(tx_ring->dev, "TX DMA map failed\n");
+	xmit_more = skb->xmit_more;
 
 	/* clear dma mappings for failed tx_buffer_info map */
 	for (;;) {
@@ -4402,39 +4462,12 @@ dma_error:
 	}
 
 	tx_ring->next_to_use = i;
-}
-
-static int __igb_maybe_stop_tx(struct igb_ring *tx_ring, const u16 size)
-{
-	struct net_device *netdev = tx_ring->netdev;
-
-	netif_stop_subqueue(netdev, tx_ring->queue_index);
-
-	/* Herbert's original patch had:
-	 *  smp_mb__after_netif_stop_queue();
-	 * but since that doesn't exist yet, just open code it. */
-	smp_mb();
 
-	/* We need to check again in a case another CPU has just
-	 * made room available. */
-	if (igb_desc_unused(tx_ring) < size)
-		return -EBUSY;
-
-	/* A reprieve! */
-	netif_wake_subqueue(netdev, tx_ring->queue_index);
-
-	u64_stats_update_begin(&tx_ring->tx_syncp2);
-	tx_ring->tx_stats.restart_queue2++;
-	u64_stats_update_end(&tx_ring->tx_syncp2);
-
-	return 0;
-}
-
-static inline int igb_maybe_stop_tx(struct igb_ring *tx_ring, const u16 size)
-{
-	if (igb_desc_unused(tx_ring) >= size)
-		return 0;
-	return __igb_maybe_stop_tx(tx_ring, size);
+	/* earlier packets of the burst may still wait for a tail write */
+	if (!xmit_more) {
+		writel(i, tx_ring->tail);
+		mmiowb();
+	}
 }
 
 netdev_tx_t igb_xmit_frame_ring(struct sk_buff *skb,
@@ -4484,12 +4517,12 @@ netdev_tx_t igb_xmit_frame_ring(struct sk_buff *skb,
 
 	igb_tx_map(tx_ring, first, hdr_len);
 
-	/* Make sure there is space in the ring for the next send. */
-	igb_maybe_stop_tx(tx_ring, MAX_SKB_FRAGS + 4);
-
 	return NETDEV_TX_OK;
 
 out_drop:
+	/* earlier packets of the burst may still wait for a tail write */
+	if (!skb->xmit_more)
+		writel(tx_ring->next_to_use, tx_ring->tail);
 	igb_unmap_and_free_tx_resource(tx_ring, first);
 
 	return NETDEV_TX_OK;
@@ -5729,8 +5762,14 @@ static int igb_poll(struct napi_struct *napi, int budget)
 	if (q_vector->tx.ring)
 		clean_complete = igb_clean_tx_irq(q_vector);
 
-	if (q_vector->rx.ring)
-		clean_complete &= igb_clean_rx_irq(q_vector, budget);
+	if (q_vector->rx.ring) {
+		/* a socket is busy polling this queue, let it finish */
+		if (!igb_qv_lock_napi(q_vector))
+			return budget;
+
+		clean_complete &= (igb_clean_rx_irq(q_vector, budget) < budget);
+		igb_qv_unlock_napi(q_vector);
+	}
 
 	/* If all work not completed, return budget and keep polling */
 	if (!clean_complete)
@@ -5743,6 +5782,32 @@ static int igb_poll(struct napi_struct *napi, int budget)
 	return 0;
 }
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/* must be called with local_bh_disable()d */
+static int igb_busy_poll_recv(struct napi_struct *napi)
+{
+	struct igb_q_vector *q_vector = container_of(napi,
+						     struct igb_q_vector,
+						     napi);
+	int found;
+
+	if (test_bit(__IGB_DOWN, &q_vector->adapter->state))
+		return LL_FLUSH_FAILED;
+
+	if (!q_vector->rx.ring)
+		return 0;
+
+	if (!igb_qv_lock_poll(q_vector))
+		return LL_FLUSH_BUSY;
+
+	found = igb_clean_rx_irq(q_vector, 4);
+
+	igb_qv_unlock_poll(q_vector);
+
+	return found;
+}
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 #ifdef CONFIG_IGB_PTP
 /**
  * igb_tx_hwtstamp - utility function which checks for TX time stamp
@@ -6064,7 +6129,7 @@ static inline u16 igb_get_hlen(union e1000_adv_rx_desc *rx_desc)
 	return hlen;
 }
 
-static bool igb_clean_rx_irq(struct igb_q_vector *q_vector, int budget)
+static int igb_clean_rx_irq(struct igb_q_vector *q_vector, int budget)
 {
 	struct igb_ring *rx_ring = q_vector->rx.ring;
 	union e1000_adv_rx_desc *rx_desc;
@@ -6157,7 +6222,19 @@ static bool igb_clean_rx_irq(struct igb_q_vector *q_vector, int budget)
 
 		skb->protocol = eth_type_trans(skb, rx_ring->netdev);
 
-		napi_gro_receive(&q_vector->napi, skb);
+		/* header buffers are allocated as skbs at refill time, so
+		 * the rx filter runs on the assembled frame
+		 */
+		if (dev_rx_filter_skb(rx_ring->netdev, skb)) {
+			budget--;
+			goto next_desc;
+		}
+
+		skb_mark_napi_id(skb, &q_vector->napi);
+		if (igb_qv_busy_polling(q_vector))
+			netif_receive_skb(skb);
+		else
+			napi_gro_receive(&q_vector->napi, skb);
 
 		budget--;
 next_desc:
@@ -6186,7 +6263,7 @@ next_desc:
 	if (cleaned_count)
 		igb_alloc_rx_buffers(rx_ring, cleaned_count);
 
-	return !!budget;
+	return total_packets;
 }
 
 static bool igb_alloc_mapped_skb(struct igb_ring *rx_ring,
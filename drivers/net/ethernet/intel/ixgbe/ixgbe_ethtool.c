@@ -2150,28 +2150,42 @@ static int ixgbe_set_coalesce(struct net_device *netdev,
 static int ixgbe_get_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
 					struct ethtool_rxnfc *cmd)
 {
-	union ixgbe_atr_input *mask = &adapter->fdir_mask;
 	struct ethtool_rx_flow_spec *fsp =
 		(struct ethtool_rx_flow_spec *)&cmd->fs;
 	struct hlist_node *node, *node2;
 	struct ixgbe_fdir_filter *rule = NULL;
+	union ixgbe_atr_input input, mask;
+	u16 action;
 
 	/* report total rule count */
 	cmd->data = (1024 << adapter->fdir_pballoc) - 2;
 
+	spin_lock_bh(&adapter->fdir_perfect_lock);
+
 	hlist_for_each_entry_safe(rule, node, node2,
 				  &adapter->fdir_filter_list, fdir_node) {
 		if (fsp->location <= rule->sw_idx)
 			break;
 	}
 
-	if (!rule || fsp->location != rule->sw_idx)
+	/* aRFS filters are not ethtool rules */
+	if (!rule || fsp->location != rule->sw_idx ||
+	    ixgbe_fdir_filter_is_rfs(rule)) {
+		spin_unlock_bh(&adapter->fdir_perfect_lock);
 		return -EINVAL;
+	}
+
+	/* aRFS may replace or expire the rule once the lock is dropped */
+	input = rule->filter;
+	mask = adapter->fdir_mask;
+	action = rule->action;
+
+	spin_unlock_bh(&adapter->fdir_perfect_lock);
 
 	/* fill out the flow spec entry */
 
 	/* set flow type field */
-	switch (rule->filter.formatted.flow_type) {
+	switch (input.formatted.flow_type) {
 	case IXGBE_ATR_FLOW_TYPE_TCPV4:
 		fsp->flow_type = TCP_V4_FLOW;
 		break;
@@ -2191,27 +2205,27 @@ static int ixgbe_get_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
 		return -EINVAL;
 	}
 
-	fsp->h_u.tcp_ip4_spec.psrc = rule->filter.formatted.src_port;
-	fsp->m_u.tcp_ip4_spec.psrc = mask->formatted.src_port;
-	fsp->h_u.tcp_ip4_spec.pdst = rule->filter.formatted.dst_port;
-	fsp->m_u.tcp_ip4_spec.pdst = mask->formatted.dst_port;
-	fsp->h_u.tcp_ip4_spec.ip4src = rule->filter.formatted.src_ip[0];
-	fsp->m_u.tcp_ip4_spec.ip4src = mask->formatted.src_ip[0];
-	fsp->h_u.tcp_ip4_spec.ip4dst = rule->filter.formatted.dst_ip[0];
-	fsp->m_u.tcp_ip4_spec.ip4dst = mask->formatted.dst_ip[0];
-	fsp->h_ext.vlan_tci = rule->filter.formatted.vlan_id;
-	fsp->m_ext.vlan_tci = mask->formatted.vlan_id;
-	fsp->h_ext.vlan_etype = rule->filter.formatted.flex_bytes;
-	fsp->m_ext.vlan_etype = mask->formatted.flex_bytes;
-	fsp->h_ext.data[1] = htonl(rule->filter.formatted.vm_pool);
-	fsp->m_ext.data[1] = htonl(mask->formatted.vm_pool);
+	fsp->h_u.tcp_ip4_spec.psrc = input.formatted.src_port;
+	fsp->m_u.tcp_ip4_spec.psrc = mask.formatted.src_port;
+	fsp->h_u.tcp_ip4_spec.pdst = input.formatted.dst_port;
+	fsp->m_u.tcp_ip4_spec.pdst = mask.formatted.dst_port;
+	fsp->h_u.tcp_ip4_spec.ip4src = input.formatted.src_ip[0];
+	fsp->m_u.tcp_ip4_spec.ip4src = mask.formatted.src_ip[0];
+	fsp->h_u.tcp_ip4_spec.ip4dst = input.formatted.dst_ip[0];
+	fsp->m_u.tcp_ip4_spec.ip4dst = mask.formatted.dst_ip[0];
+	fsp->h_ext.vlan_tci = input.formatted.vlan_id;
+	fsp->m_ext.vlan_tci = mask.formatted.vlan_id;
+	fsp->h_ext.vlan_etype = input.formatted.flex_bytes;
+	fsp->m_ext.vlan_etype = mask.formatted.flex_bytes;
+	fsp->h_ext.data[1] = htonl(input.formatted.vm_pool);
+	fsp->m_ext.data[1] = htonl(mask.formatted.vm_pool);
 	fsp->flow_type |= FLOW_EXT;
 
 	/* record action */
-	if (rule->action == IXGBE_FDIR_DROP_QUEUE)
+	if (action == IXGBE_FDIR_DROP_QUEUE)
 		fsp->ring_cookie = RX_CLS_FLOW_DISC;
 	else
-		fsp->ring_cookie = rule->action;
+		fsp->ring_cookie = action;
 
 	return 0;
 }
@@ -2227,14 +2241,22 @@ static int ixgbe_get_ethtool_fdir_all(struct ixgbe_adapter *adapter,
 	/* report total rule count */
 	cmd->data = (1024 << adapter->fdir_pballoc) - 2;
 
+	spin_lock_bh(&adapter->fdir_perfect_lock);
+
 	hlist_for_each_entry_safe(rule, node, node2,
 				  &adapter->fdir_filter_list, fdir_node) {
-		if (cnt == cmd->rule_cnt)
+		if (ixgbe_fdir_filter_is_rfs(rule))
+			continue;
+		if (cnt == cmd->rule_cnt) {
+			spin_unlock_bh(&adapter->fdir_perfect_lock);
 			return -EMSGSIZE;
+		}
 		rule_locs[cnt] = rule->sw_idx;
 		cnt++;
 	}
 
+	spin_unlock_bh(&adapter->fdir_perfect_lock);
+
 	cmd->rule_cnt = cnt;
 
 	return 0;
@@ -2290,7 +2312,9 @@ static int ixgbe_get_rxnfc(struct net_device *dev, struct ethtool_rxnfc *cmd,
 		ret = 0;
 		break;
 	case ETHTOOL_GRXCLSRLCNT:
+		spin_lock_bh(&adapter->fdir_perfect_lock);
 		cmd->rule_cnt = adapter->fdir_filter_count;
+		spin_unlock_bh(&adapter->fdir_perfect_lock);
 		ret = 0;
 		break;
 	case ETHTOOL_GRXCLSRULE:
@@ -2309,9 +2333,9 @@ static int ixgbe_get_rxnfc(struct net_device *dev, struct ethtool_rxnfc *cmd,
 	return ret;
 }
 
-static int ixgbe_update_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
-					   struct ixgbe_fdir_filter *input,
-					   u16 sw_idx)
+int ixgbe_update_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
+				    struct ixgbe_fdir_filter *input,
+				    u16 sw_idx)
 {
 	struct ixgbe_hw *hw = &adapter->hw;
 	struct hlist_node *node, *node2, *parent;
@@ -2338,9 +2362,10 @@ static int ixgbe_update_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
 								sw_idx);
 		}
 
+		if (!ixgbe_fdir_filter_is_rfs(rule))
+			adapter->fdir_filter_count--;
 		hlist_del(&rule->fdir_node);
 		kfree(rule);
-		adapter->fdir_filter_count--;
 	}
 
 	/*
@@ -2360,8 +2385,9 @@ static int ixgbe_update_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
 		hlist_add_head(&input->fdir_node,
 			       &adapter->fdir_filter_list);
 
-	/* update counts */
-	adapter->fdir_filter_count++;
+	/* update counts, aRFS filters are not counted as ethtool rules */
+	if (!ixgbe_fdir_filter_is_rfs(input))
+		adapter->fdir_filter_count++;
 
 	return 0;
 }
@@ -2483,7 +2509,7 @@ static int ixgbe_add_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
 	else
 		input->action = fsp->ring_cookie;
 
-	spin_lock(&adapter->fdir_perfect_lock);
+	spin_lock_bh(&adapter->fdir_perfect_lock);
 
 	if (hlist_empty(&adapter->fdir_filter_list)) {
 		/* save mask and program input mask into HW */
@@ -2512,11 +2538,11 @@ static int ixgbe_add_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
 
 	ixgbe_update_ethtool_fdir_entry(adapter, input, input->sw_idx);
 
-	spin_unlock(&adapter->fdir_perfect_lock);
+	spin_unlock_bh(&adapter->fdir_perfect_lock);
 
 	return err;
 err_out_w_lock:
-	spin_unlock(&adapter->fdir_perfect_lock);
+	spin_unlock_bh(&adapter->fdir_perfect_lock);
 err_out:
 	kfree(input);
 	return -EINVAL;
@@ -2529,9 +2555,9 @@ static int ixgbe_del_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
 		(struct ethtool_rx_flow_spec *)&cmd->fs;
 	int err;
 
-	spin_lock(&adapter->fdir_perfect_lock);
+	spin_lock_bh(&adapter->fdir_perfect_lock);
 	err = ixgbe_update_ethtool_fdir_entry(adapter, NULL, fsp->location);
-	spin_unlock(&adapter->fdir_perfect_lock);
+	spin_unlock_bh(&adapter->fdir_perfect_lock);
 
 	return err;
 }
@@ -45,6 +45,7 @@
 #include <linux/if.h>
 #include <linux/if_vlan.h>
 #include <linux/prefetch.h>
+#include <linux/cpu_rmap.h>
 #include <scsi/fc/fc_fcoe.h>
 
 #include "ixgbe.h"
@@ -1412,7 +1413,9 @@ static void ixgbe_rx_skb(struct ixgbe_q_vector *q_vector,
 {
 	struct ixgbe_adapter *adapter = q_vector->adapter;
 
-	if (!(adapter->flags & IXGBE_FLAG_IN_NETPOLL))
+	if (ixgbe_qv_busy_polling(q_vector))
+		netif_receive_skb(skb);
+	else if (!(adapter->flags & IXGBE_FLAG_IN_NETPOLL))
 		napi_gro_receive(&q_vector->napi, skb);
 	else
 		netif_rx(skb);
@@ -1611,6 +1614,82 @@ static void ixgbe_reuse_rx_page(struct ixgbe_ring *rx_ring,
 	get_page(new_buff->page);
 }
 
+/**
+ * ixgbe_recycle_rx_buffer - store a consumed buffer back on the ring
+ * @rx_ring: rx descriptor ring to store buffers on
+ * @old_buff: buffer whose frame the rx filter consumed
+ *
+ * Unlike ixgbe_reuse_rx_page no part of the page went to the stack, so
+ * the buffer is handed back unchanged.
+ **/
+static void ixgbe_recycle_rx_buffer(struct ixgbe_ring *rx_ring,
+				    struct ixgbe_rx_buffer *old_buff)
+{
+	struct ixgbe_rx_buffer *new_buff;
+	u16 nta = rx_ring->next_to_alloc;
+
+	new_buff = &rx_ring->rx_buffer_info[nta];
+
+	/* update, and store next to alloc */
+	nta++;
+	rx_ring->next_to_alloc = (nta < rx_ring->count) ? nta : 0;
+
+	/* transfer page, mapping and offset from old buffer to new buffer */
+	new_buff->page = old_buff->page;
+	new_buff->dma = old_buff->dma;
+	new_buff->page_offset = old_buff->page_offset;
+
+	/* sync the buffer for use by the device */
+	dma_sync_single_range_for_device(rx_ring->dev, new_buff->dma,
+					 new_buff->page_offset,
+					 ixgbe_rx_bufsz(rx_ring),
+					 DMA_FROM_DEVICE);
+}
+
+/**
+ * ixgbe_rx_filter - run the early rx filter over a single buffer frame
+ * @rx_ring: rx descriptor ring the frame was received on
+ * @rx_desc: descriptor of the frame
+ * @rx_buffer: buffer holding the frame
+ *
+ * Returns the frame length if the filter consumed the frame, in which case
+ * the buffer went back to the ring, next to clean moved on and no sk_buff
+ * is needed for it; 0 otherwise.
+ **/
+static unsigned int ixgbe_rx_filter(struct ixgbe_ring *rx_ring,
+				    union ixgbe_adv_rx_desc *rx_desc,
+				    struct ixgbe_rx_buffer *rx_buffer)
+{
+	unsigned int size = le16_to_cpu(rx_desc->wb.upper.length);
+	u32 ntc = rx_ring->next_to_clean + 1;
+
+	if (likely(!rcu_access_pointer(rx_ring->netdev->rx_filter)))
+		return 0;
+
+	dma_sync_single_range_for_cpu(rx_ring->dev,
+				      rx_buffer->dma,
+				      rx_buffer->page_offset,
+				      ixgbe_rx_bufsz(rx_ring),
+				      DMA_FROM_DEVICE);
+
+	if (!__dev_rx_filter(rx_ring->netdev,
+			     page_address(rx_buffer->page) +
+			     rx_buffer->page_offset, size))
+		return 0;
+
+	ixgbe_recycle_rx_buffer(rx_ring, rx_buffer);
+
+	/* clear contents of buffer_info */
+	rx_buffer->dma = 0;
+	rx_buffer->page = NULL;
+
+	/* fetch, update, and store next to clean */
+	ntc = (ntc < rx_ring->count) ? ntc : 0;
+	rx_ring->next_to_clean = ntc;
+
+	return size;
+}
+
 /**
  * ixgbe_add_rx_frag - Add contents of Rx buffer to sk_buff
  * @rx_ring: rx descriptor ring to transact packets on
@@ -1645,9 +1724,9 @@ static void ixgbe_add_rx_frag(struct ixgbe_ring *rx_ring,
  * expensive overhead for IOMMU access this provides a means of avoiding
  * it by maintaining the mapping of the page to the syste.
  *
- * Returns true if all work is completed without reaching budget
+ * Returns amount of work completed
  **/
-static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
+static int ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 			       struct ixgbe_ring *rx_ring,
 			       int budget)
 {
@@ -1661,6 +1740,7 @@ static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 	do {
 		struct ixgbe_rx_buffer *rx_buffer;
 		union ixgbe_adv_rx_desc *rx_desc;
+		bool rx_filtered = false;
 		struct sk_buff *skb;
 		struct page *page;
 		u16 ntc;
@@ -1700,6 +1780,30 @@ static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 			prefetch(page_addr + L1_CACHE_BYTES);
 #endif
 
+			/*
+			 * frames in a single buffer meet the rx filter here,
+			 * unless the hardware flagged an error or stripped a
+			 * VLAN tag the buffer no longer carries; those take
+			 * the sk_buff path below
+			 */
+			if (ixgbe_test_staterr(rx_desc, IXGBE_RXD_STAT_EOP) &&
+			    !ixgbe_test_staterr(rx_desc,
+					IXGBE_RXD_STAT_VP |
+					IXGBE_RXDADV_ERR_FRAME_ERR_MASK)) {
+				unsigned int size;
+
+				rx_filtered = true;
+				size = ixgbe_rx_filter(rx_ring, rx_desc,
+						       rx_buffer);
+				if (size) {
+					total_rx_bytes += size;
+					total_rx_packets++;
+					cleaned_count++;
+					budget--;
+					continue;
+				}
+			}
+
 			/* allocate a skb to store the frags */
 			skb = netdev_alloc_skb_ip_align(rx_ring->netdev,
 							IXGBE_RX_HDR_SIZE);
@@ -1772,6 +1876,18 @@ static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 		/* populate checksum, timestamp, VLAN, and protocol */
 		ixgbe_process_skb_fields(rx_ring, rx_desc, skb);
 
+		/*
+		 * the rest meet the rx filter here, with the VLAN tag in
+		 * vlan_tci; errored frames kept by NETIF_F_RXALL never do
+		 */
+		if (!rx_filtered &&
+		    !ixgbe_test_staterr(rx_desc,
+					IXGBE_RXDADV_ERR_FRAME_ERR_MASK) &&
+		    dev_rx_filter_skb(rx_ring->netdev, skb)) {
+			budget--;
+			continue;
+		}
+
 #ifdef IXGBE_FCOE
 		/* if ddp, not passing to ULD unless for FCP_RSP or error */
 		if (ixgbe_rx_is_fcoe(rx_ring, rx_desc)) {
@@ -1783,6 +1899,7 @@ static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 		}
 
 #endif /* IXGBE_FCOE */
+		skb_mark_napi_id(skb, &q_vector->napi);
 		ixgbe_rx_skb(q_vector, skb);
 
 		/* update budget accounting */
@@ -1814,7 +1931,7 @@ static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 	if (cleaned_count)
 		ixgbe_alloc_rx_buffers(rx_ring, cleaned_count);
 
-	return !!budget;
+	return total_rx_packets;
 }
 
 /**
@@ -2376,10 +2493,15 @@ int ixgbe_poll(struct napi_struct *napi, int budget)
 	else
 		per_ring_budget = budget;
 
+	/* Exit if we are called by netpoll or busy polling is active */
+	if (!ixgbe_qv_lock_napi(q_vector))
+		return budget;
+
 	ixgbe_for_each_ring(ring, q_vector->rx)
-		clean_complete &= ixgbe_clean_rx_irq(q_vector, ring,
-						     per_ring_budget);
+		clean_complete &= (ixgbe_clean_rx_irq(q_vector, ring,
+				   per_ring_budget) < per_ring_budget);
 
+	ixgbe_qv_unlock_napi(q_vector);
 	/* If all work not completed, return budget and keep polling */
 	if (!clean_complete)
 		return budget;
@@ -2394,6 +2516,34 @@ int ixgbe_poll(struct napi_struct *napi, int budget)
 	return 0;
 }
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/* must be called with local_bh_disable()d */
+static int ixgbe_busy_poll_recv(struct napi_struct *napi)
+{
+	struct ixgbe_q_vector *q_vector =
+			container_of(napi, struct ixgbe_q_vector, napi);
+	struct ixgbe_adapter *adapter = q_vector->adapter;
+	struct ixgbe_ring  *ring;
+	int found = 0;
+
+	if (test_bit(__IXGBE_DOWN, &adapter->state))
+		return LL_FLUSH_FAILED;
+
+	if (!ixgbe_qv_lock_poll(q_vector))
+		return LL_FLUSH_BUSY;
+
+	ixgbe_for_each_ring(ring, q_vector->rx) {
+		found = ixgbe_clean_rx_irq(q_vector, ring, 4);
+		if (found)
+			break;
+	}
+
+	ixgbe_qv_unlock_poll(q_vector);
+
+	return found;
+}
+#endif	/* CONFIG_NET_RX_BUSY_POLL */
+
 /**
  * ixgbe_request_msix_irqs - Initialize MSI-X interrupts
  * @adapter: board private structure
@@ -2407,6 +2557,21 @@ static int ixgbe_request_msix_irqs(struct ixgbe_adapter *adapter)
 	int vector, err;
 	int ri = 0, ti = 0;
 
+#ifdef CONFIG_RFS_ACCEL
+	/*
+	 * Accelerated RFS looks up the Rx queue serviced by a CPU through
+	 * the IRQ affinity of its vector.  That only works when Rx ring n
+	 * is the only Rx ring on q_vector n, which holds whenever there
+	 * are at least as many vectors as Rx queues.
+	 */
+	if (adapter->num_q_vectors >= adapter->num_rx_queues) {
+		netdev->rx_cpu_rmap = alloc_irq_cpu_rmap(adapter->num_rx_queues);
+		if (!netdev->rx_cpu_rmap)
+			e_warn(probe, "unable to allocate rx_cpu_rmap, "
+			       "accelerated RFS disabled\n");
+	}
+
+#endif
 	for (vector = 0; vector < adapter->num_q_vectors; vector++) {
 		struct ixgbe_q_vector *q_vector = adapter->q_vector[vector];
 		struct msix_entry *entry = &adapter->msix_entries[vector];
@@ -2438,6 +2603,19 @@ static int ixgbe_request_msix_irqs(struct ixgbe_adapter *adapter)
 			irq_set_affinity_hint(entry->vector,
 					      &q_vector->affinity_mask);
 		}
+#ifdef CONFIG_RFS_ACCEL
+		if (netdev->rx_cpu_rmap && q_vector->rx.ring) {
+			err = irq_cpu_rmap_add(netdev->rx_cpu_rmap,
+					       entry->vector);
+			if (err) {
+				e_err(probe, "irq_cpu_rmap_add failed: %d\n",
+				      err);
+				irq_set_affinity_hint(entry->vector, NULL);
+				free_irq(entry->vector, q_vector);
+				goto free_queue_irqs;
+			}
+		}
+#endif
 	}
 
 	err = request_irq(adapter->msix_entries[vector].vector,
@@ -2450,6 +2628,10 @@ static int ixgbe_request_msix_irqs(struct ixgbe_adapter *adapter)
 	return 0;
 
 free_queue_irqs:
+#ifdef CONFIG_RFS_ACCEL
+	free_irq_cpu_rmap(netdev->rx_cpu_rmap);
+	netdev->rx_cpu_rmap = NULL;
+#endif
 	while (vector) {
 		vector--;
 		irq_set_affinity_hint(adapter->msix_entries[vector].vector,
@@ -2569,6 +2751,12 @@ static void ixgbe_free_irq(struct ixgbe_adapter *adapter)
 		return;
 	}
 
+#ifdef CONFIG_RFS_ACCEL
+	/* drop the affinity notifiers before the irqs go away */
+	free_irq_cpu_rmap(adapter->netdev->rx_cpu_rmap);
+	adapter->netdev->rx_cpu_rmap = NULL;
+
+#endif
 	for (vector = 0; vector < adapter->num_q_vectors; vector++) {
 		struct ixgbe_q_vector *q_vector = adapter->q_vector[vector];
 		struct msix_entry *entry = &adapter->msix_entries[vector];
@@ -3572,16 +3760,22 @@ static void ixgbe_napi_enable_all(struct ixgbe_adapter *adapter)
 {
 	int q_idx;
 
-	for (q_idx = 0; q_idx < adapter->num_q_vectors; q_idx++)
+	for (q_idx = 0; q_idx < adapter->num_q_vectors; q_idx++) {
+		ixgbe_qv_init_lock(adapter->q_vector[q_idx]);
 		napi_enable(&adapter->q_vector[q_idx]->napi);
+	}
 }
 
 static void ixgbe_napi_disable_all(struct ixgbe_adapter *adapter)
 {
 	int q_idx;
 
-	for (q_idx = 0; q_idx < adapter->num_q_vectors; q_idx++)
+	for (q_idx = 0; q_idx < adapter->num_q_vectors; q_idx++) {
 		napi_disable(&adapter->q_vector[q_idx]->napi);
+		/* wait for a busy polling socket to let go of the vector */
+		while (!ixgbe_qv_disable(adapter->q_vector[q_idx]))
+			usleep_range(1000, 20000);
+	}
 }
 
 #ifdef CONFIG_IXGBE_DCB
@@ -3782,7 +3976,7 @@ static void ixgbe_fdir_filter_restore(struct ixgbe_adapter *adapter)
 	struct hlist_node *node, *node2;
 	struct ixgbe_fdir_filter *filter;
 
-	spin_lock(&adapter->fdir_perfect_lock);
+	spin_lock_bh(&adapter->fdir_perfect_lock);
 
 	if (!hlist_empty(&adapter->fdir_filter_list))
 		ixgbe_fdir_set_input_mask_82599(hw, &adapter->fdir_mask);
@@ -3797,7 +3991,7 @@ static void ixgbe_fdir_filter_restore(struct ixgbe_adapter *adapter)
 				adapter->rx_ring[filter->action]->reg_idx);
 	}
 
-	spin_unlock(&adapter->fdir_perfect_lock);
+	spin_unlock_bh(&adapter->fdir_perfect_lock);
 }
 
 static void ixgbe_configure(struct ixgbe_adapter *adapter)
@@ -4267,7 +4461,7 @@ static void ixgbe_fdir_filter_exit(struct ixgbe_adapter *adapter)
 	struct hlist_node *node, *node2;
 	struct ixgbe_fdir_filter *filter;
 
-	spin_lock(&adapter->fdir_perfect_lock);
+	spin_lock_bh(&adapter->fdir_perfect_lock);
 
 	hlist_for_each_entry_safe(filter, node, node2,
 				  &adapter->fdir_filter_list, fdir_node) {
@@ -4276,7 +4470,7 @@ static void ixgbe_fdir_filter_exit(struct ixgbe_adapter *adapter)
 	}
 	adapter->fdir_filter_count = 0;
 
-	spin_unlock(&adapter->fdir_perfect_lock);
+	spin_unlock_bh(&adapter->fdir_perfect_lock);
 }
 
 void ixgbe_down(struct ixgbe_adapter *adapter)
@@ -5312,6 +5506,51 @@ static void ixgbe_fdir_reinit_subtask(struct ixgbe_adapter *adapter)
 	}
 }
 
+#ifdef CONFIG_RFS_ACCEL
+/**
+ * ixgbe_rfs_expire_subtask - remove aRFS filters the stack no longer needs
+ * @adapter: pointer to the device adapter structure
+ *
+ * Filters installed by ixgbe_rx_flow_steer stay in the perfect filter
+ * table until rps_may_expire_flow reports that their flow went idle or
+ * was steered elsewhere.  If n-tuple filtering was turned off the
+ * hardware table is gone already and only the list entries are dropped.
+ **/
+static void ixgbe_rfs_expire_subtask(struct ixgbe_adapter *adapter)
+{
+	struct ixgbe_hw *hw = &adapter->hw;
+	struct hlist_node *node, *node2;
+	struct ixgbe_fdir_filter *filter;
+	bool perfect = !!(adapter->flags & IXGBE_FLAG_FDIR_PERFECT_CAPABLE);
+
+	/* if interface is down do nothing */
+	if (test_bit(__IXGBE_DOWN, &adapter->state))
+		return;
+
+	spin_lock_bh(&adapter->fdir_perfect_lock);
+
+	hlist_for_each_entry_safe(filter, node, node2,
+				  &adapter->fdir_filter_list, fdir_node) {
+		if (!filter->rfs)
+			continue;
+
+		if (perfect &&
+		    !rps_may_expire_flow(adapter->netdev, filter->action,
+					 filter->flow_id, filter->sw_idx))
+			continue;
+
+		if (perfect)
+			ixgbe_fdir_erase_perfect_filter_82599(hw,
+							      &filter->filter,
+							      filter->sw_idx);
+		hlist_del(&filter->fdir_node);
+		kfree(filter);
+	}
+
+	spin_unlock_bh(&adapter->fdir_perfect_lock);
+}
+
+#endif /* CONFIG_RFS_ACCEL */
 /**
  * ixgbe_check_hang_subtask - check for hung queues and dropped interrupts
  * @adapter: pointer to the device adapter structure
@@ -5792,6 +6031,9 @@ static void ixgbe_service_task(struct work_struct *work)
 	ixgbe_check_overtemp_subtask(adapter);
 	ixgbe_watchdog_subtask(adapter);
 	ixgbe_fdir_reinit_subtask(adapter);
+#ifdef CONFIG_RFS_ACCEL
+	ixgbe_rfs_expire_subtask(adapter);
+#endif
 	ixgbe_check_hang_subtask(adapter);
 #ifdef CONFIG_IXGBE_PTP
 	ixgbe_ptp_overflow_check(adapter);
@@ -6000,6 +6242,32 @@ static void ixgbe_tx_olinfo_status(union ixgbe_adv_tx_desc *tx_desc,
 #define IXGBE_TXD_CMD (IXGBE_TXD_CMD_EOP | \
 		       IXGBE_TXD_CMD_RS)
 
+static int __ixgbe_maybe_stop_tx(struct ixgbe_ring *tx_ring, u16 size)
+{
+	netif_stop_subqueue(tx_ring->netdev, tx_ring->queue_index);
+	/* Herbert's original patch had:
+	 *  smp_mb__after_netif_stop_queue();
+	 * but since that doesn't exist yet, just open code it. */
+	smp_mb();
+
+	/* We need to check again in a case another CPU has just
+	 * made room available. */
+	if (likely(ixgbe_desc_unused(tx_ring) < size))
+		return -EBUSY;
+
+	/* A reprieve! - use start_queue because it doesn't call schedule */
+	netif_start_subqueue(tx_ring->netdev, tx_ring->queue_index);
+	++tx_ring->tx_stats.restart_queue;
+	return 0;
+}
+
+static inline int ixgbe_maybe_stop_tx(struct ixgbe_ring *tx_ring, u16 size)
+{
+	if (likely(ixgbe_desc_unused(tx_ring) >= size))
+		return 0;
+	return __ixgbe_maybe_stop_tx(tx_ring, size);
+}
+
 static void ixgbe_tx_map(struct ixgbe_ring *tx_ring,
 			 struct ixgbe_tx_buffer *first,
 			 const u8 hdr_len)
@@ -6015,6 +6283,7 @@ static void ixgbe_tx_map(struct ixgbe_ring *tx_ring,
 	u32 tx_flags = first->tx_flags;
 	__le32 cmd_type;
 	u16 i = tx_ring->next_to_use;
+	bool xmit_more;
 
 	tx_desc = IXGBE_TX_DESC(tx_ring, i);
 
@@ -6125,12 +6394,17 @@ static void ixgbe_tx_map(struct ixgbe_ring *tx_ring,
 
 	tx_ring->next_to_use = i;
 
-	/* notify HW of packet */
-	writel(i, tx_ring->tail);
+	/* Make sure there is space in the ring for the next send. */
+	ixgbe_maybe_stop_tx(tx_ring, DESC_NEEDED);
+
+	/* notify HW of packet, once per burst unless the ring filled up */
+	if (!skb->xmit_more || netif_xmit_stopped(txring_txq(tx_ring)))
+		writel(i, tx_ring->tail);
 
 	return;
 dma_error:
 	dev_err(tx_ring->dev, "TX DMA map failed\n");
+	xmit_more = skb->xmit_more;
 
 	/* clear dma mappings for failed tx_buffer_info map */
 	for (;;) {
@@ -6144,6 +6418,10 @@ dma_error:
 	}
 
 	tx_ring->next_to_use = i;
+
+	/* earlier packets of the burst may still wait for a tail write */
+	if (!xmit_more)
+		writel(i, tx_ring->tail);
 }
 
 static void ixgbe_atr(struct ixgbe_ring *ring,
@@ -6234,32 +6512,6 @@ static void ixgbe_atr(struct ixgbe_ring *ring,
 					      input, common, ring->queue_index);
 }
 
-static int __ixgbe_maybe_stop_tx(struct ixgbe_ring *tx_ring, u16 size)
-{
-	netif_stop_subqueue(tx_ring->netdev, tx_ring->queue_index);
-	/* Herbert's original patch had:
-	 *  smp_mb__after_netif_stop_queue();
-	 * but since that doesn't exist yet, just open code it. */
-	smp_mb();
-
-	/* We need to check again in a case another CPU has just
-	 * made room available. */
-	if (likely(ixgbe_desc_unused(tx_ring) < size))
-		return -EBUSY;
-
-	/* A reprieve! - use start_queue because it doesn't call schedule */
-	netif_start_subqueue(tx_ring->netdev, tx_ring->queue_index);
-	++tx_ring->tx_stats.restart_queue;
-	return 0;
-}
-
-static inline int ixgbe_maybe_stop_tx(struct ixgbe_ring *tx_ring, u16 size)
-{
-	if (likely(ixgbe_desc_unused(tx_ring) >= size))
-		return 0;
-	return __ixgbe_maybe_stop_tx(tx_ring, size);
-}
-
 static u16 ixgbe_select_queue(struct net_device *dev, struct sk_buff *skb)
 {
 	struct ixgbe_adapter *adapter = netdev_priv(dev);
@@ -6416,11 +6668,12 @@ xmit_fcoe:
 #endif /* IXGBE_FCOE */
 	ixgbe_tx_map(tx_ring, first, hdr_len);
 
-	ixgbe_maybe_stop_tx(tx_ring, DESC_NEEDED);
-
 	return NETDEV_TX_OK;
 
 out_drop:
+	/* earlier packets of the burst may still wait for a tail write */
+	if (!skb->xmit_more)
+		writel(tx_ring->next_to_use, tx_ring->tail);
 	dev_kfree_skb_any(first->skb);
 	first->skb = NULL;
 
@@ -6930,6 +7183,138 @@ static int ixgbe_ndo_fdb_dump(struct sk_buff *skb,
 	return idx;
 }
 
+#ifdef CONFIG_RFS_ACCEL
+/**
+ * ixgbe_rx_flow_steer - steer a flow to the Rx queue of its consumer
+ * @netdev: network interface device structure
+ * @skb: packet of the flow to steer
+ * @rxq_index: Rx queue whose vector is affine to the consuming CPU
+ * @flow_id: RFS flow table index, passed to rps_may_expire_flow later
+ *
+ * Installs a Flow Director perfect filter on the TCP or UDP over IPv4
+ * 5-tuple of @skb.  aRFS filters are kept in the upper half of the
+ * perfect filter locations, one slot per flow_id hash, and share the
+ * single input mask of the port with ethtool n-tuple rules.  Returns the
+ * filter location on success.
+ **/
+static int ixgbe_rx_flow_steer(struct net_device *netdev,
+			       const struct sk_buff *skb,
+			       u16 rxq_index, u32 flow_id)
+{
+	struct ixgbe_adapter *adapter = netdev_priv(netdev);
+	struct ixgbe_hw *hw = &adapter->hw;
+	struct ixgbe_fdir_filter *input, *rule;
+	struct hlist_node *node;
+	union ixgbe_atr_input mask;
+	const struct iphdr *ip;
+	const __be16 *ports;
+	u16 first, slots;
+	int nhoff, err;
+
+	if (!(adapter->flags & IXGBE_FLAG_FDIR_PERFECT_CAPABLE))
+		return -EOPNOTSUPP;
+
+	if (rxq_index >= adapter->num_rx_queues)
+		return -EINVAL;
+
+	if (skb->protocol != htons(ETH_P_IP))
+		return -EPROTONOSUPPORT;
+
+	/* RFS validated the IP header and the ports before calling us */
+	nhoff = skb_network_offset(skb);
+	ip = (const struct iphdr *)(skb->data + nhoff);
+	if (ip_is_fragment(ip))
+		return -EPROTONOSUPPORT;
+	ports = (const __be16 *)(skb->data + nhoff + 4 * ip->ihl);
+
+	input = kzalloc(sizeof(*input), GFP_ATOMIC);
+	if (!input)
+		return -ENOMEM;
+
+	switch (ip->protocol) {
+	case IPPROTO_TCP:
+		input->filter.formatted.flow_type = IXGBE_ATR_FLOW_TYPE_TCPV4;
+		break;
+	case IPPROTO_UDP:
+		input->filter.formatted.flow_type = IXGBE_ATR_FLOW_TYPE_UDPV4;
+		break;
+	default:
+		kfree(input);
+		return -EPROTONOSUPPORT;
+	}
+
+	input->filter.formatted.src_ip[0] = ip->saddr;
+	input->filter.formatted.dst_ip[0] = ip->daddr;
+	input->filter.formatted.src_port = ports[0];
+	input->filter.formatted.dst_port = ports[1];
+	input->action = rxq_index;
+	input->flow_id = flow_id;
+	input->rfs = true;
+
+	/* match on the complete 5-tuple */
+	memset(&mask, 0, sizeof(mask));
+	mask.formatted.flow_type = IXGBE_ATR_L4TYPE_IPV6_MASK |
+				   IXGBE_ATR_L4TYPE_MASK;
+	mask.formatted.src_ip[0] = htonl(~0);
+	mask.formatted.dst_ip[0] = htonl(~0);
+	mask.formatted.src_port = htons(~0);
+	mask.formatted.dst_port = htons(~0);
+
+	slots = ((1024 << adapter->fdir_pballoc) - 2) / 2;
+	first = ((1024 << adapter->fdir_pballoc) - 2) - slots;
+	input->sw_idx = first + flow_id % slots;
+
+	spin_lock_bh(&adapter->fdir_perfect_lock);
+
+	if (hlist_empty(&adapter->fdir_filter_list)) {
+		memcpy(&adapter->fdir_mask, &mask, sizeof(mask));
+		err = ixgbe_fdir_set_input_mask_82599(hw, &mask);
+		if (err) {
+			err = -EIO;
+			goto err_out;
+		}
+	} else if (memcmp(&adapter->fdir_mask, &mask, sizeof(mask))) {
+		/* ethtool rules programmed a narrower mask */
+		err = -EBUSY;
+		goto err_out;
+	}
+
+	/* never evict a rule that was configured through ethtool */
+	hlist_for_each_entry(rule, node, &adapter->fdir_filter_list,
+			     fdir_node) {
+		if (rule->sw_idx < input->sw_idx)
+			continue;
+		if (rule->sw_idx == input->sw_idx && !rule->rfs) {
+			err = -EBUSY;
+			goto err_out;
+		}
+		break;
+	}
+
+	ixgbe_atr_compute_perfect_hash_82599(&input->filter, &mask);
+
+	err = ixgbe_fdir_write_perfect_filter_82599(hw, &input->filter,
+				input->sw_idx,
+				adapter->rx_ring[rxq_index]->reg_idx);
+	if (err) {
+		err = -EIO;
+		goto err_out;
+	}
+
+	/* replaces the aRFS filter of a colliding flow_id, if any */
+	err = input->sw_idx;
+	ixgbe_update_ethtool_fdir_entry(adapter, input, input->sw_idx);
+
+	spin_unlock_bh(&adapter->fdir_perfect_lock);
+
+	return err;
+err_out:
+	spin_unlock_bh(&adapter->fdir_perfect_lock);
+	kfree(input);
+	return err;
+}
+
+#endif /* CONFIG_RFS_ACCEL */
 static const struct net_device_ops ixgbe_netdev_ops = {
 	.ndo_open		= ixgbe_open,
 	.ndo_stop		= ixgbe_close,
@@ -6955,6 +7340,9 @@ static const struct net_device_ops ixgbe_netdev_ops = {
 #ifdef CONFIG_NET_POLL_CONTROLLER
 	.ndo_poll_controller	= ixgbe_netpoll,
 #endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	.ndo_busy_poll		= ixgbe_busy_poll_recv,
+#endif
 #ifdef IXGBE_FCOE
 	.ndo_fcoe_ddp_setup = ixgbe_fcoe_ddp_get,
 	.ndo_fcoe_ddp_target = ixgbe_fcoe_ddp_target,
@@ -6964,6 +7352,9 @@ static const struct net_device_ops ixgbe_netdev_ops = {
 	.ndo_fcoe_get_wwn = ixgbe_fcoe_get_wwn,
 	.ndo_fcoe_get_hbainfo = ixgbe_fcoe_get_hbainfo,
 #endif /* IXGBE_FCOE */
+#ifdef CONFIG_RFS_ACCEL
+	.ndo_rx_flow_steer	= ixgbe_rx_flow_steer,
+#endif
 	.ndo_set_features = ixgbe_set_features,
 	.ndo_fix_features = ixgbe_fix_features,
 	.ndo_fdb_add		= ixgbe_ndo_fdb_add,
@@ -7258,6 +7649,7 @@ static int __devinit ixgbe_probe(struct pci_dev *pdev,
 
 	netdev->priv_flags |= IFF_UNICAST_FLT;
 	netdev->priv_flags |= IFF_SUPP_NOFCS;
+	netdev->priv_flags |= IFF_RX_FILTER;
 
 #ifdef CONFIG_IXGBE_DCB
 	netdev->dcbnl_ops = &dcbnl_ops;
@@ -25,6 +25,8 @@
 #include <linux/slab.h>
 #include <linux/kthread.h>
 #include <linux/cgroup.h>
+#include <linux/moduleparam.h>
+#include <linux/sched.h>
 
 #include <linux/net.h>
 #include <linux/if_packet.h>
@@ -39,6 +41,50 @@ enum {
 
 static unsigned vhost_zcopy_mask __read_mostly;
 
+static unsigned int workers_per_node;
+module_param(workers_per_node, uint, 0644);
+MODULE_PARM_DESC(workers_per_node,
+		 "Shared vhost worker threads per NUMA node, 0 for a thread per device");
+
+static unsigned int pool_quota = 4;
+module_param(pool_quota, uint, 0644);
+MODULE_PARM_DESC(pool_quota,
+		 "Works a shared worker runs for one device before moving on to the next");
+
+static unsigned int pool_poll_usecs = 50;
+module_param(pool_poll_usecs, uint, 0644);
+MODULE_PARM_DESC(pool_poll_usecs,
+		 "Longest time an idle shared worker busy polls for work, 0 to sleep at once");
+
+/* First busy poll window of a shared worker once polling pays off */
+#define VHOST_POOL_POLL_START_NS	10000
+
+/*
+ * A shared worker runs the work of all devices attached to it.  Devices
+ * with work queued wait in dev_list and are served in turn, up to
+ * pool_quota works at a time.  A device is attached to one worker only,
+ * so its work is as serialized as with a worker thread of its own.
+ */
+struct vhost_pool_worker {
+	/* Protects dev_list and cur, nests inside vhost_dev.work_lock */
+	spinlock_t lock;
+	struct list_head dev_list;
+	/* Device whose work is being run */
+	struct vhost_dev *cur;
+	/* Woken when the worker is done with cur */
+	wait_queue_head_t idle;
+	struct task_struct *task;
+	/* Current busy poll window */
+	u64 poll_ns;
+	/* Protected by vhost_pool_mutex */
+	struct list_head node;
+	int nid;
+	int ndevs;
+};
+
+static DEFINE_MUTEX(vhost_pool_mutex);
+static LIST_HEAD(vhost_pool_workers);
+
 #define vhost_used_event(vq) ((u16 __user *)&vq->avail->ring[vq->num])
 #define vhost_avail_event(vq) ((u16 __user *)&vq->used->ring[vq->num])
 
@@ -145,7 +191,16 @@ void vhost_work_queue(struct vhost_dev *dev, struct vhost_work *work)
 	if (list_empty(&work->node)) {
 		list_add_tail(&work->node, &dev->work_list);
 		work->queue_seq++;
-		wake_up_process(dev->worker);
+		if (dev->pool) {
+			struct vhost_pool_worker *w = dev->pool;
+
+			spin_lock(&w->lock);
+			if (list_empty(&dev->pool_node))
+				list_add_tail(&dev->pool_node, &w->dev_list);
+			spin_unlock(&w->lock);
+			wake_up_process(w->task);
+		} else
+			wake_up_process(dev->worker);
 	}
 	spin_unlock_irqrestore(&dev->work_lock, flags);
 }
@@ -234,6 +289,232 @@ static int vhost_worker(void *data)
 	return 0;
 }
 
+/* Run the first work queued on a device, false if there was none */
+static bool vhost_run_work(struct vhost_dev *dev)
+{
+	struct vhost_work *work;
+	unsigned seq;
+
+	spin_lock_irq(&dev->work_lock);
+	if (list_empty(&dev->work_list)) {
+		spin_unlock_irq(&dev->work_lock);
+		return false;
+	}
+	work = list_first_entry(&dev->work_list, struct vhost_work, node);
+	list_del_init(&work->node);
+	seq = work->queue_seq;
+	spin_unlock_irq(&dev->work_lock);
+
+	work->fn(work);
+
+	spin_lock_irq(&dev->work_lock);
+	work->done_seq = seq;
+	if (work->flushing)
+		wake_up_all(&work->done);
+	spin_unlock_irq(&dev->work_lock);
+	return true;
+}
+
+static struct vhost_dev *vhost_pool_next(struct vhost_pool_worker *w)
+{
+	struct vhost_dev *dev = NULL;
+
+	spin_lock_irq(&w->lock);
+	if (!list_empty(&w->dev_list)) {
+		dev = list_first_entry(&w->dev_list, struct vhost_dev,
+				       pool_node);
+		list_del_init(&dev->pool_node);
+		w->cur = dev;
+	}
+	spin_unlock_irq(&w->lock);
+	return dev;
+}
+
+/* Done with a device for now, put it at the end of the line if it has
+ * more work queued. */
+static void vhost_pool_put(struct vhost_pool_worker *w, struct vhost_dev *dev)
+{
+	spin_lock_irq(&dev->work_lock);
+	spin_lock(&w->lock);
+	if (!list_empty(&dev->work_list) && list_empty(&dev->pool_node))
+		list_add_tail(&dev->pool_node, &w->dev_list);
+	w->cur = NULL;
+	spin_unlock(&w->lock);
+	spin_unlock_irq(&dev->work_lock);
+	wake_up(&w->idle);
+}
+
+/*
+ * Wait for work.  Spin for up to poll_ns first, a device kicked meanwhile
+ * is served without a wakeup.  The window grows while new work comes
+ * within pool_poll_usecs after the worker ran out of it, and shrinks
+ * when it comes later.
+ */
+static void vhost_pool_idle(struct vhost_pool_worker *w)
+{
+	u64 max_ns = (u64)ACCESS_ONCE(pool_poll_usecs) * NSEC_PER_USEC;
+	u64 start = local_clock(), idle;
+
+	w->poll_ns = min(w->poll_ns, max_ns);
+	while (local_clock() - start < w->poll_ns) {
+		if (!list_empty(&w->dev_list))
+			return;
+		if (need_resched())
+			break;
+		cpu_relax();
+	}
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	if (!list_empty(&w->dev_list) || kthread_should_stop()) {
+		__set_current_state(TASK_RUNNING);
+		return;
+	}
+	schedule();
+
+	idle = local_clock() - start;
+	if (idle <= max_ns)
+		w->poll_ns = min(max_ns, w->poll_ns ? w->poll_ns * 2 :
+				 VHOST_POOL_POLL_START_NS);
+	else
+		w->poll_ns /= 2;
+}
+
+static int vhost_pool_worker_fn(void *data)
+{
+	struct vhost_pool_worker *w = data;
+	struct vhost_dev *dev;
+	mm_segment_t oldfs = get_fs();
+	unsigned int n, quota;
+
+	set_fs(USER_DS);
+
+	while (!kthread_should_stop()) {
+		dev = vhost_pool_next(w);
+		if (!dev) {
+			vhost_pool_idle(w);
+			continue;
+		}
+
+		quota = max(ACCESS_ONCE(pool_quota), 1U);
+		use_mm(dev->mm);
+		for (n = 0; n < quota; n++)
+			if (!vhost_run_work(dev))
+				break;
+		unuse_mm(dev->mm);
+
+		vhost_pool_put(w, dev);
+		cond_resched();
+	}
+
+	set_fs(oldfs);
+	return 0;
+}
+
+/* Caller should have vhost_pool_mutex */
+static struct vhost_pool_worker *vhost_pool_worker_create(int nid, int id)
+{
+	const struct cpumask *mask = cpumask_of_node(nid);
+	struct vhost_pool_worker *w;
+	struct task_struct *task;
+
+	w = kzalloc_node(sizeof *w, GFP_KERNEL, nid);
+	if (!w)
+		return ERR_PTR(-ENOMEM);
+
+	spin_lock_init(&w->lock);
+	INIT_LIST_HEAD(&w->dev_list);
+	init_waitqueue_head(&w->idle);
+	w->nid = nid;
+
+	task = kthread_create_on_node(vhost_pool_worker_fn, w, nid,
+				      "vhost-n%d/%d", nid, id);
+	if (IS_ERR(task)) {
+		kfree(w);
+		return ERR_CAST(task);
+	}
+	if (cpumask_intersects(mask, cpu_online_mask))
+		set_cpus_allowed_ptr(task, mask);
+
+	w->task = task;
+	list_add_tail(&w->node, &vhost_pool_workers);
+	wake_up_process(task);
+	return w;
+}
+
+/* Attach a device to the least busy shared worker on the owner's node,
+ * starting a new one while the node has less than workers_per_node. */
+static int vhost_pool_attach(struct vhost_dev *dev, unsigned int max_workers)
+{
+	struct vhost_pool_worker *w, *best = NULL;
+	int nid = numa_node_id();
+	unsigned int nr = 0;
+
+	mutex_lock(&vhost_pool_mutex);
+	list_for_each_entry(w, &vhost_pool_workers, node) {
+		if (w->nid != nid)
+			continue;
+		nr++;
+		if (!best || w->ndevs < best->ndevs)
+			best = w;
+	}
+
+	if (!best || (best->ndevs && nr < max_workers)) {
+		w = vhost_pool_worker_create(nid, nr);
+		if (!IS_ERR(w))
+			best = w;
+		else if (!best) {
+			mutex_unlock(&vhost_pool_mutex);
+			return PTR_ERR(w);
+		}
+	}
+
+	best->ndevs++;
+	dev->pool = best;
+	mutex_unlock(&vhost_pool_mutex);
+	return 0;
+}
+
+static bool vhost_pool_running(struct vhost_pool_worker *w,
+			       struct vhost_dev *dev)
+{
+	bool running;
+
+	spin_lock_irq(&w->lock);
+	running = w->cur == dev;
+	spin_unlock_irq(&w->lock);
+	return running;
+}
+
+/* Detach a device with no work queued, the last one stops the worker. */
+static void vhost_pool_detach(struct vhost_dev *dev)
+{
+	struct vhost_pool_worker *w = dev->pool;
+
+	spin_lock_irq(&w->lock);
+	list_del_init(&dev->pool_node);
+	spin_unlock_irq(&w->lock);
+	wait_event(w->idle, !vhost_pool_running(w, dev));
+
+	mutex_lock(&vhost_pool_mutex);
+	if (!--w->ndevs) {
+		list_del(&w->node);
+		kthread_stop(w->task);
+		kfree(w);
+	}
+	mutex_unlock(&vhost_pool_mutex);
+	dev->pool = NULL;
+}
+
+static void vhost_dev_stop_worker(struct vhost_dev *dev)
+{
+	if (dev->pool)
+		vhost_pool_detach(dev);
+	if (dev->worker) {
+		kthread_stop(dev->worker);
+		dev->worker = NULL;
+	}
+}
+
 static void vhost_vq_free_iovecs(struct vhost_virtqueue *vq)
 {
 	kfree(vq->indirect);
@@ -305,6 +586,8 @@ long vhost_dev_init(struct vhost_dev *dev,
 	spin_lock_init(&dev->work_lock);
 	INIT_LIST_HEAD(&dev->work_list);
 	dev->worker = NULL;
+	dev->pool = NULL;
+	INIT_LIST_HEAD(&dev->pool_node);
 
 	for (i = 0; i < dev->nvqs; ++i) {
 		dev->vqs[i].log = NULL;
@@ -357,6 +640,7 @@ static int vhost_attach_cgroups(struct vhost_dev *dev)
 /* Caller should have device mutex */
 static long vhost_dev_set_owner(struct vhost_dev *dev)
 {
+	unsigned int max_workers = ACCESS_ONCE(workers_per_node);
 	struct task_struct *worker;
 	int err;
 
@@ -368,18 +652,28 @@ static long vhost_dev_set_owner(struct vhost_dev *dev)
 
 	/* No owner, become one */
 	dev->mm = get_task_mm(current);
-	worker = kthread_create(vhost_worker, dev, "vhost-%d", current->pid);
-	if (IS_ERR(worker)) {
-		err = PTR_ERR(worker);
-		goto err_worker;
-	}
 
-	dev->worker = worker;
-	wake_up_process(worker);	/* avoid contributing to loadavg */
+	if (max_workers) {
+		/* Shared workers serve many owners, they stay in the root
+		 * cgroups. */
+		err = vhost_pool_attach(dev, max_workers);
+		if (err)
+			goto err_worker;
+	} else {
+		worker = kthread_create(vhost_worker, dev, "vhost-%d",
+					current->pid);
+		if (IS_ERR(worker)) {
+			err = PTR_ERR(worker);
+			goto err_worker;
+		}
+
+		dev->worker = worker;
+		wake_up_process(worker);	/* avoid contributing to loadavg */
 
-	err = vhost_attach_cgroups(dev);
-	if (err)
-		goto err_cgroup;
+		err = vhost_attach_cgroups(dev);
+		if (err)
+			goto err_cgroup;
+	}
 
 	err = vhost_dev_alloc_iovecs(dev);
 	if (err)
@@ -387,8 +681,7 @@ static long vhost_dev_set_owner(struct vhost_dev *dev)
 
 	return 0;
 err_cgroup:
-	kthread_stop(worker);
-	dev->worker = NULL;
+	vhost_dev_stop_worker(dev);
 err_worker:
 	if (dev->mm)
 		mmput(dev->mm);
@@ -480,10 +773,7 @@ void vhost_dev_cleanup(struct vhost_dev *dev, bool locked)
 						lockdep_is_held(&dev->mutex)));
 	RCU_INIT_POINTER(dev->memory, NULL);
 	WARN_ON(!list_empty(&dev->work_list));
-	if (dev->worker) {
-		kthread_stop(dev->worker);
-		dev->worker = NULL;
-	}
+	vhost_dev_stop_worker(dev);
 	if (dev->mm)
 		mmput(dev->mm);
 	dev->mm = NULL;
@@ -1600,7 +1890,7 @@ void vhost_ubuf_put_and_wait(struct vhost_ubuf_ref *ubufs)
 	kfree(ubufs);
 }
 
-void vhost_zerocopy_callback(struct ubuf_info *ubuf)
+void vhost_zerocopy_callback(struct ubuf_info *ubuf, bool success)
 {
 	struct vhost_ubuf_ref *ubufs = ubuf->ctx;
 	struct vhost_virtqueue *vq = ubufs->vq;
@@ -132,6 +132,14 @@ struct sock_fprog {	/* Required for SO_ATTACH_FILTER. */
 #define SKF_NET_OFF   (-0x100000)
 #define SKF_LL_OFF    (-0x200000)
 
+/*
+ * Return values of a device receive filter (IFLA_RX_FILTER), which sees
+ * the frame from its Ethernet header on before the stack does.
+ */
+#define SKF_RX_DROP	0		/* drop the frame */
+#define SKF_RX_TX	0xfffffffe	/* send it back out, addresses swapped */
+					/* anything else passes the frame */
+
 #ifdef __KERNEL__
 
 #ifdef CONFIG_COMPAT
@@ -146,6 +154,7 @@ struct compat_sock_fprog {
 
 struct sk_buff;
 struct sock;
+struct bpf_prog;
 
 struct sk_filter
 {
@@ -153,6 +162,7 @@ struct sk_filter
 	unsigned int         	len;	/* Number of filter blocks */
 	unsigned int		(*bpf_func)(const struct sk_buff *skb,
 					    const struct sock_filter *filter);
+	struct bpf_prog		*prog;	/* eBPF program, or the converted insns */
 	struct rcu_head		rcu;
 	struct sock_filter     	insns[0];
 };
@@ -169,13 +179,15 @@ extern int sk_unattached_filter_create(struct sk_filter **pfp,
 				       struct sock_fprog *fprog);
 extern void sk_unattached_filter_destroy(struct sk_filter *fp);
 extern int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk);
+extern int sk_attach_bpf(u32 ufd, struct sock *sk);
 extern int sk_detach_filter(struct sock *sk);
 extern int sk_chk_filter(struct sock_filter *filter, unsigned int flen);
+extern void *bpf_internal_load_pointer_neg_helper(const struct sk_buff *skb,
+						  int k, unsigned int size);
 
 #ifdef CONFIG_BPF_JIT
 extern void bpf_jit_compile(struct sk_filter *fp);
 extern void bpf_jit_free(struct sk_filter *fp);
-#define SK_RUN_FILTER(FILTER, SKB) (*FILTER->bpf_func)(SKB, FILTER->insns)
 #else
 static inline void bpf_jit_compile(struct sk_filter *fp)
 {
@@ -183,8 +195,8 @@ static inline void bpf_jit_compile(struct sk_filter *fp)
 static inline void bpf_jit_free(struct sk_filter *fp)
 {
 }
-#define SK_RUN_FILTER(FILTER, SKB) sk_run_filter(SKB, FILTER->insns)
 #endif
+#define SK_RUN_FILTER(FILTER, SKB) (*FILTER->bpf_func)(SKB, FILTER->insns)
 
 enum {
 	BPF_S_RET_K = 1,
@@ -180,6 +180,7 @@ enum {
 	TRACE_EVENT_FL_CAP_ANY_BIT,
 	TRACE_EVENT_FL_NO_SET_FILTER_BIT,
 	TRACE_EVENT_FL_IGNORE_ENABLE_BIT,
+	TRACE_EVENT_FL_KPROBE_BIT,
 };
 
 enum {
@@ -189,8 +190,11 @@ enum {
 	TRACE_EVENT_FL_CAP_ANY		= (1 << TRACE_EVENT_FL_CAP_ANY_BIT),
 	TRACE_EVENT_FL_NO_SET_FILTER	= (1 << TRACE_EVENT_FL_NO_SET_FILTER_BIT),
 	TRACE_EVENT_FL_IGNORE_ENABLE	= (1 << TRACE_EVENT_FL_IGNORE_ENABLE_BIT),
+	TRACE_EVENT_FL_KPROBE		= (1 << TRACE_EVENT_FL_KPROBE_BIT),
 };
 
+struct bpf_prog;
+
 struct ftrace_event_call {
 	struct list_head	list;
 	struct ftrace_event_class *class;
@@ -210,6 +214,7 @@ struct ftrace_event_call {
 	 *   bit 4:		allow trace by non root (cap any)
 	 *   bit 5:		failed to apply filter
 	 *   bit 6:		ftrace internal event (do not enable)
+	 *   bit 7:		kprobe event, may run a BPF program
 	 *
 	 * Changes to flags must hold the event_mutex.
 	 *
@@ -225,6 +230,7 @@ struct ftrace_event_call {
 #ifdef CONFIG_PERF_EVENTS
 	int				perf_refcount;
 	struct hlist_head __percpu	*perf_events;
+	struct bpf_prog			*prog;
 #endif
 };
 
@@ -83,6 +83,7 @@
 #define IFF_SUPP_NOFCS	0x80000		/* device supports sending custom FCS */
 #define IFF_LIVE_ADDR_CHANGE 0x100000	/* device supports hardware address
 					 * change when it's running */
+#define IFF_RX_FILTER	0x200000	/* driver runs the early rx filter */
 
 
 #define IF_GET_IFACE	0x0001		/* for querying only */
@@ -58,6 +58,7 @@
 
 struct netpoll_info;
 struct device;
+struct sk_filter;
 struct phy_device;
 /* 802.11 specific */
 struct wireless_dev;
@@ -350,12 +351,17 @@ struct napi_struct {
 	struct list_head	dev_list;
 	struct sk_buff		*gro_list;
 	struct sk_buff		*skb;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	unsigned int		napi_id;
+	struct hlist_node	napi_hash_node;
+#endif
 };
 
 enum {
 	NAPI_STATE_SCHED,	/* Poll is scheduled */
 	NAPI_STATE_DISABLE,	/* Disable pending */
 	NAPI_STATE_NPSVC,	/* Netpoll - don't dequeue from poll_list */
+	NAPI_STATE_HASHED,	/* In NAPI hash (busy polling possible) */
 };
 
 enum gro_result {
@@ -471,6 +477,42 @@ static inline bool napi_reschedule(struct napi_struct *napi)
 extern void __napi_complete(struct napi_struct *n);
 extern void napi_complete(struct napi_struct *n);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/**
+ *	napi_by_id - lookup a NAPI by napi_id
+ *	@napi_id: hashed napi_id
+ *
+ * lookup @napi_id in napi_hash table
+ * must be called under rcu_read_lock()
+ */
+extern struct napi_struct *napi_by_id(unsigned int napi_id);
+
+/**
+ *	napi_hash_add - add a NAPI to global hashtable
+ *	@napi: napi context
+ *
+ * generate a new napi_id and store a @napi under it in napi_hash
+ */
+extern void napi_hash_add(struct napi_struct *napi);
+
+/**
+ *	napi_hash_del - remove a NAPI from global table
+ *	@napi: napi context
+ *
+ * Warning: caller must observe rcu grace period
+ * before freeing memory containing @napi
+ */
+extern void napi_hash_del(struct napi_struct *napi);
+#else
+static inline void napi_hash_add(struct napi_struct *napi)
+{
+}
+
+static inline void napi_hash_del(struct napi_struct *napi)
+{
+}
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 /**
  *	napi_disable - prevent NAPI from scheduling
  *	@n: napi context
@@ -755,6 +797,10 @@ struct netdev_fcoe_hbainfo {
  *	Must return NETDEV_TX_OK , NETDEV_TX_BUSY.
  *        (can also return NETDEV_TX_LOCKED iff NETIF_F_LLTX)
  *	Required can not be NULL.
+ *	If skb->xmit_more is set, another packet will follow right away
+ *	and the driver may delay telling the hardware about this one.  It
+ *	must not delay once the queue is stopped, nor when it drops the
+ *	packet that should have ended such a burst.
  *
  * u16 (*ndo_select_queue)(struct net_device *dev, struct sk_buff *skb);
  *	Called to decide which queue to when device supports multiple
@@ -820,6 +866,13 @@ struct netdev_fcoe_hbainfo {
  *
  * void (*ndo_poll_controller)(struct net_device *dev);
  *
+ * int (*ndo_busy_poll)(struct napi_struct *napi);
+ *	Called from a socket read path to poll the receive queue bound to
+ *	@napi for new packets without waiting for an interrupt.
+ *	Must be called with BH disabled.  Returns the number of packets
+ *	processed, LL_FLUSH_BUSY if NAPI currently owns the queue, or
+ *	LL_FLUSH_FAILED if the device is down.
+ *
  *	SR-IOV management functions.
  * int (*ndo_set_vf_mac)(struct net_device *dev, int vf, u8* mac);
  * int (*ndo_set_vf_vlan)(struct net_device *dev, int vf, u16 vlan, u8 qos);
@@ -956,6 +1009,9 @@ struct net_device_ops {
 						     struct netpoll_info *info,
 						     gfp_t gfp);
 	void			(*ndo_netpoll_cleanup)(struct net_device *dev);
+#endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	int			(*ndo_busy_poll)(struct napi_struct *napi);
 #endif
 	int			(*ndo_set_vf_mac)(struct net_device *dev,
 						  int queue, u8 *mac);
@@ -1207,6 +1263,7 @@ struct net_device {
 
 	rx_handler_func_t __rcu	*rx_handler;
 	void __rcu		*rx_handler_data;
+	struct sk_filter __rcu	*rx_filter;
 
 	struct netdev_queue __rcu *ingress_queue;
 
@@ -1521,7 +1578,8 @@ struct packet_type {
 	int			(*gso_send_check)(struct sk_buff *skb);
 	struct sk_buff		**(*gro_receive)(struct sk_buff **head,
 					       struct sk_buff *skb);
-	int			(*gro_complete)(struct sk_buff *skb);
+	int			(*gro_complete)(struct sk_buff *skb,
+						int nhoff);
 	bool			(*id_match)(struct packet_type *ptype,
 					    struct sock *sk);
 	void			*af_packet_priv;
@@ -2153,6 +2211,8 @@ extern gro_result_t	napi_skb_finish(gro_result_t ret, struct sk_buff *skb);
 extern gro_result_t	napi_gro_receive(struct napi_struct *napi,
 					 struct sk_buff *skb);
 extern void		napi_gro_flush(struct napi_struct *napi);
+extern struct packet_type *gro_find_receive_by_type(__be16 type);
+extern struct packet_type *gro_find_complete_by_type(__be16 type);
 extern struct sk_buff *	napi_get_frags(struct napi_struct *napi);
 extern gro_result_t	napi_frags_finish(struct napi_struct *napi,
 					  struct sk_buff *skb,
@@ -2170,6 +2230,46 @@ extern int netdev_rx_handler_register(struct net_device *dev,
 				      void *rx_handler_data);
 extern void netdev_rx_handler_unregister(struct net_device *dev);
 
+extern void dev_set_rx_filter(struct net_device *dev, struct sk_filter *fp);
+extern bool __dev_rx_filter(struct net_device *dev, void *data,
+			    unsigned int len);
+extern bool __dev_rx_filter_skb(struct net_device *dev, struct sk_buff *skb);
+
+/**
+ *	dev_rx_filter - run the early receive filter over a raw frame
+ *	@dev: receiving device
+ *	@data: frame, from the Ethernet header on
+ *	@len: frame length
+ *
+ *	For drivers setting IFF_RX_FILTER, called from the receive loop with
+ *	the buffer synced for the CPU and before any skb is built for it.
+ *	Returns true if the filter dropped the frame or sent a copy back out
+ *	of @dev; the driver then recycles the buffer.
+ */
+static inline bool dev_rx_filter(struct net_device *dev, void *data,
+				 unsigned int len)
+{
+	if (likely(!rcu_access_pointer(dev->rx_filter)))
+		return false;
+	return __dev_rx_filter(dev, data, len);
+}
+
+/**
+ *	dev_rx_filter_skb - run the early receive filter over an skb
+ *	@dev: receiving device
+ *	@skb: frame, after eth_type_trans()
+ *
+ *	For frames a driver could not filter with dev_rx_filter(), such as
+ *	those spanning several buffers.  Returns true if @skb was consumed.
+ */
+static inline bool dev_rx_filter_skb(struct net_device *dev,
+				     struct sk_buff *skb)
+{
+	if (likely(!rcu_access_pointer(dev->rx_filter)))
+		return false;
+	return __dev_rx_filter_skb(dev, skb);
+}
+
 extern bool		dev_valid_name(const char *name);
 extern int		dev_ioctl(struct net *net, unsigned int cmd, void __user *);
 extern int		dev_ethtool(struct net *net, struct ifreq *);
@@ -2187,10 +2287,29 @@ extern int		dev_set_mac_address(struct net_device *,
 					    struct sockaddr *);
 extern int		dev_hard_start_xmit(struct sk_buff *skb,
 					    struct net_device *dev,
-					    struct netdev_queue *txq);
+					    struct netdev_queue *txq,
+					    bool more);
+extern bool		dev_xmit_needs_fixup(struct sk_buff *skb);
 extern int		dev_forward_skb(struct net_device *dev,
 					struct sk_buff *skb);
 
+static inline netdev_tx_t __netdev_start_xmit(const struct net_device_ops *ops,
+					      struct sk_buff *skb,
+					      struct net_device *dev,
+					      bool more)
+{
+	skb->xmit_more = more ? 1 : 0;
+	return ops->ndo_start_xmit(skb, dev);
+}
+
+/* Hand one packet to the driver; @more tells it another one follows. */
+static inline netdev_tx_t netdev_start_xmit(struct sk_buff *skb,
+					    struct net_device *dev,
+					    bool more)
+{
+	return __netdev_start_xmit(dev->netdev_ops, skb, dev, more);
+}
+
 extern int		netdev_budget;
 
 /* Called by rtnetlink.c:rtnl_unlock() */
@@ -2620,6 +2739,8 @@ extern int netdev_set_bond_master(struct net_device *dev,
 extern int skb_checksum_help(struct sk_buff *skb);
 extern struct sk_buff *skb_gso_segment(struct sk_buff *skb,
 	netdev_features_t features);
+extern struct sk_buff *skb_encap_gso_segment(struct sk_buff *skb,
+	netdev_features_t features, unsigned int hlen, __be16 type, bool csum);
 #ifdef CONFIG_BUG
 extern void netdev_rx_csum_fault(struct net_device *dev);
 #else
@@ -2673,6 +2794,7 @@ static inline bool net_gso_ok(netdev_features_t features, int gso_type)
 	BUILD_BUG_ON(SKB_GSO_TCP_ECN != (NETIF_F_TSO_ECN >> NETIF_F_GSO_SHIFT));
 	BUILD_BUG_ON(SKB_GSO_TCPV6   != (NETIF_F_TSO6 >> NETIF_F_GSO_SHIFT));
 	BUILD_BUG_ON(SKB_GSO_FCOE    != (NETIF_F_FSO >> NETIF_F_GSO_SHIFT));
+	BUILD_BUG_ON(SKB_GSO_GRE     != (NETIF_F_GSO_GRE >> NETIF_F_GSO_SHIFT));
 
 	return (features & feature) == feature;
 }
@@ -0,0 +1,199 @@
+/*
+ *	Definitions for a fixed size ring of pointers.
+ *
+ *	Producers and the consumer take separate locks, each on its own
+ *	cache line, so that a producer never has to touch the consumer
+ *	side of the ring and vice versa.  A NULL slot means "empty", so
+ *	NULL can not be queued.
+ *
+ *	This program is free software; you can redistribute it and/or modify it
+ *	under the terms of the GNU General Public License as published by the
+ *	Free Software Foundation; either version 2 of the License, or (at your
+ *	option) any later version.
+ */
+
+#ifndef _LINUX_PTR_RING_H
+#define _LINUX_PTR_RING_H 1
+
+#include <linux/spinlock.h>
+#include <linux/cache.h>
+#include <linux/types.h>
+#include <linux/compiler.h>
+#include <linux/slab.h>
+#include <linux/errno.h>
+#include <asm/barrier.h>
+
+struct ptr_ring {
+	int producer ____cacheline_aligned_in_smp;
+	spinlock_t producer_lock;
+	int consumer ____cacheline_aligned_in_smp;
+	spinlock_t consumer_lock;
+	/* Shared consumer/producer data */
+	int size ____cacheline_aligned_in_smp;	/* max entries in queue */
+	void **queue;
+};
+
+/* Note: callers invoking this in a loop must use a compiler barrier,
+ * for example cpu_relax().  Callers must hold producer_lock.
+ */
+static inline bool __ptr_ring_full(struct ptr_ring *r)
+{
+	return r->queue[r->producer];
+}
+
+static inline bool ptr_ring_full(struct ptr_ring *r)
+{
+	bool ret;
+
+	spin_lock(&r->producer_lock);
+	ret = __ptr_ring_full(r);
+	spin_unlock(&r->producer_lock);
+
+	return ret;
+}
+
+/* Note: callers invoking this in a loop must use a compiler barrier,
+ * for example cpu_relax().  Callers must hold producer_lock.
+ */
+static inline int __ptr_ring_produce(struct ptr_ring *r, void *ptr)
+{
+	if (unlikely(!r->size) || r->queue[r->producer])
+		return -ENOSPC;
+
+	/* Make sure the pointer we are storing points to a valid data. */
+	smp_wmb();
+
+	ACCESS_ONCE(r->queue[r->producer++]) = ptr;
+	if (unlikely(r->producer >= r->size))
+		r->producer = 0;
+	return 0;
+}
+
+/* Returns -ENOSPC if the ring is full, in which case @ptr is not queued. */
+static inline int ptr_ring_produce(struct ptr_ring *r, void *ptr)
+{
+	int ret;
+
+	spin_lock(&r->producer_lock);
+	ret = __ptr_ring_produce(r, ptr);
+	spin_unlock(&r->producer_lock);
+
+	return ret;
+}
+
+static inline int ptr_ring_produce_bh(struct ptr_ring *r, void *ptr)
+{
+	int ret;
+
+	spin_lock_bh(&r->producer_lock);
+	ret = __ptr_ring_produce(r, ptr);
+	spin_unlock_bh(&r->producer_lock);
+
+	return ret;
+}
+
+/* Callers must hold consumer_lock. */
+static inline void *__ptr_ring_peek(struct ptr_ring *r)
+{
+	if (likely(r->size))
+		return ACCESS_ONCE(r->queue[r->consumer]);
+	return NULL;
+}
+
+static inline bool ptr_ring_empty(struct ptr_ring *r)
+{
+	return !__ptr_ring_peek(r);
+}
+
+/* Callers must hold consumer_lock. */
+static inline void *__ptr_ring_consume(struct ptr_ring *r)
+{
+	void *ptr;
+
+	ptr = __ptr_ring_peek(r);
+	if (ptr) {
+		/* Pairs with smp_wmb() in __ptr_ring_produce(): make sure
+		 * the contents of the entry are read after the pointer.
+		 */
+		smp_read_barrier_depends();
+		r->queue[r->consumer++] = NULL;
+		if (unlikely(r->consumer >= r->size))
+			r->consumer = 0;
+	}
+
+	return ptr;
+}
+
+static inline void *ptr_ring_consume(struct ptr_ring *r)
+{
+	void *ptr;
+
+	spin_lock(&r->consumer_lock);
+	ptr = __ptr_ring_consume(r);
+	spin_unlock(&r->consumer_lock);
+
+	return ptr;
+}
+
+static inline void *ptr_ring_consume_bh(struct ptr_ring *r)
+{
+	void *ptr;
+
+	spin_lock_bh(&r->consumer_lock);
+	ptr = __ptr_ring_consume(r);
+	spin_unlock_bh(&r->consumer_lock);
+
+	return ptr;
+}
+
+/* The pointer returned is only stable while consumer_lock is held or
+ * while the caller is the only consumer; it may be used as a hint
+ * otherwise.
+ */
+static inline void *ptr_ring_peek(struct ptr_ring *r)
+{
+	void *ptr;
+
+	spin_lock(&r->consumer_lock);
+	ptr = __ptr_ring_peek(r);
+	spin_unlock(&r->consumer_lock);
+
+	return ptr;
+}
+
+/* Locks are always initialised, even if the allocation fails, so the
+ * ring may be passed to ptr_ring_cleanup() regardless.  A ring of size
+ * zero is valid and rejects every produce.
+ */
+static inline int ptr_ring_init(struct ptr_ring *r, int size, gfp_t gfp)
+{
+	spin_lock_init(&r->producer_lock);
+	spin_lock_init(&r->consumer_lock);
+	r->producer = r->consumer = 0;
+	r->size = 0;
+	r->queue = NULL;
+
+	if (!size)
+		return 0;
+
+	r->queue = kcalloc(size, sizeof(void *), gfp);
+	if (!r->queue)
+		return -ENOMEM;
+
+	r->size = size;
+	return 0;
+}
+
+static inline void ptr_ring_cleanup(struct ptr_ring *r, void (*destroy)(void *))
+{
+	void *ptr;
+
+	if (destroy)
+		while ((ptr = ptr_ring_consume(r)))
+			destroy(ptr);
+	kfree(r->queue);
+	r->queue = NULL;
+	r->size = 0;
+}
+
+#endif /* _LINUX_PTR_RING_H */
@@ -52,6 +52,8 @@ static inline int udp_hashfn(struct net *net, unsigned num, unsigned mask)
 	return (num + net_hash_mix(net)) & mask;
 }
 
+struct udp_dst_cache;
+
 struct udp_sock {
 	/* inet_sock has to be the first member */
 	struct inet_sock inet;
@@ -81,6 +83,15 @@ struct udp_sock {
 	 * For encapsulation sockets.
 	 */
 	int (*encap_rcv)(struct sock *sk, struct sk_buff *skb);
+	/*
+	 * Routes of recent unconnected sends, allocated on first use.
+	 */
+	struct udp_dst_cache __rcu *dst_cache;
+	/*
+	 * Datagrams moved off sk_receive_queue in one batch by a reader,
+	 * so that following reads do not contend with softirq enqueue.
+	 */
+	struct sk_buff_head	 reader_queue ____cacheline_aligned_in_smp;
 };
 
 static inline struct udp_sock *udp_sk(const struct sock *sk)
@@ -6,9 +6,12 @@
 #include <linux/mutex.h>
 #include <net/sock.h>
 
-extern void unix_inflight(struct file *fp);
-extern void unix_notinflight(struct file *fp);
+struct scm_fp_list;
+
+extern void unix_inflight(struct scm_fp_list *fpl);
+extern void unix_notinflight(struct scm_fp_list *fpl);
 extern void unix_gc(void);
+extern void unix_gc_flush(void);
 extern void wait_for_unix_gc(void);
 extern struct sock *unix_get_socket(struct file *filp);
 extern struct sock *unix_peer_get(struct sock *);
@@ -34,6 +37,7 @@ struct unix_skb_parms {
 #ifdef CONFIG_SECURITY_NETWORK
 	u32			secid;		/* Security ID		*/
 #endif
+	u32			consumed;	/* Stream bytes read	*/
 };
 
 #define UNIXCB(skb) 	(*(struct unix_skb_parms *)&((skb)->cb))
@@ -59,6 +63,8 @@ struct unix_sock {
 	spinlock_t		lock;
 	unsigned int		gc_candidate : 1;
 	unsigned int		gc_maybe_cycle : 1;
+	unsigned int		gc_dirty : 1;
+	unsigned int		gc_scanned : 1;
 	unsigned char		recursion_level;
 	struct socket_wq	peer_wq;
 };
@@ -103,8 +103,6 @@ struct inet_cork {
 	unsigned int		fragsize;
 	struct dst_entry	*dst;
 	int			length; /* Total length of all frames */
-	struct page		*page;
-	u32			off;
 	u8			tx_flags;
 };
 
@@ -195,6 +195,10 @@ extern int fib_table_dump(struct fib_table *table, struct sk_buff *skb,
 			  struct netlink_callback *cb);
 extern int fib_table_flush(struct fib_table *table);
 extern void fib_free_table(struct fib_table *tb);
+#ifdef CONFIG_IP_FIB_TRIE_DIR
+extern int fib_table_set_dir(struct fib_table *tb, bool enable);
+extern int fib_dir_select_tables(struct net *net);
+#endif
 
 
 
@@ -400,6 +400,7 @@ struct ip_vs_protocol {
 			     struct ip_vs_proto_data *pd,
 			     int *verdict, struct ip_vs_conn **cpp);
 
+	/* lookups for the packet path, see ip_vs_conn_in_get_noref() */
 	struct ip_vs_conn *
 	(*conn_in_get)(int af,
 		       const struct sk_buff *skb,
@@ -531,6 +532,8 @@ struct ip_vs_conn {
 	const struct ip_vs_pe	*pe;
 	char			*pe_data;
 	__u8			pe_data_len;
+
+	struct rcu_head		rcu_head;
 };
 
 /*
@@ -1061,6 +1064,7 @@ static inline void ip_vs_conn_fill_param(struct net *net, int af, int protocol,
 }
 
 struct ip_vs_conn *ip_vs_conn_in_get(const struct ip_vs_conn_param *p);
+struct ip_vs_conn *ip_vs_conn_in_get_noref(const struct ip_vs_conn_param *p);
 struct ip_vs_conn *ip_vs_ct_in_get(const struct ip_vs_conn_param *p);
 
 struct ip_vs_conn * ip_vs_conn_in_get_proto(int af, const struct sk_buff *skb,
@@ -1069,6 +1073,7 @@ struct ip_vs_conn * ip_vs_conn_in_get_proto(int af, const struct sk_buff *skb,
 					    int inverse);
 
 struct ip_vs_conn *ip_vs_conn_out_get(const struct ip_vs_conn_param *p);
+struct ip_vs_conn *ip_vs_conn_out_get_noref(const struct ip_vs_conn_param *p);
 
 struct ip_vs_conn * ip_vs_conn_out_get_proto(int af, const struct sk_buff *skb,
 					     const struct ip_vs_iphdr *iph,
@@ -1080,6 +1085,19 @@ static inline void __ip_vs_conn_put(struct ip_vs_conn *cp)
 {
 	atomic_dec(&cp->refcnt);
 }
+
+/*
+ * Restart the timer of a conn found by a lookup that took no reference,
+ * under rcu_read_lock().  Only a pending timer is pushed forward, one
+ * that ip_vs_conn_expire has deleted for good stays so.
+ */
+static inline void ip_vs_conn_touch(struct ip_vs_conn *cp)
+{
+	unsigned long expires = jiffies + cp->timeout;
+
+	if (cp->timer.expires != expires)
+		mod_timer_pending(&cp->timer, expires);
+}
 extern void ip_vs_conn_put(struct ip_vs_conn *cp);
 extern void ip_vs_conn_fill_cport(struct ip_vs_conn *cp, __be16 cport);
 
@@ -1130,6 +1148,8 @@ static inline void ip_vs_control_del(struct ip_vs_conn *cp)
 		return;
 	}
 	atomic_dec(&ctl_cp->n_control);
+	/* drop the reference taken by ip_vs_control_add */
+	__ip_vs_conn_put(ctl_cp);
 }
 
 static inline void
@@ -1153,6 +1173,13 @@ ip_vs_control_add(struct ip_vs_conn *cp, struct ip_vs_conn *ctl_cp)
 		      IP_VS_DBG_ADDR(cp->af, &ctl_cp->caddr),
 		      ntohs(ctl_cp->cport));
 
+	/*
+	 * ctl_cp may come from a lookup on the packet path that took no
+	 * reference, do not attach to a conn that is being released.
+	 */
+	if (!atomic_inc_not_zero(&ctl_cp->refcnt))
+		return;
+
 	cp->control = ctl_cp;
 	atomic_inc(&ctl_cp->n_control);
 }
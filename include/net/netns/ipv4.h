@@ -15,6 +15,9 @@ struct hlist_head;
 struct fib_table;
 struct sock;
 
+/* tables that can be given direct lookup arrays at the same time */
+#define FIB_DIR_MAX_TABLES	4
+
 struct netns_ipv4 {
 #ifdef CONFIG_SYSCTL
 	struct ctl_table_header	*forw_hdr;
@@ -36,6 +39,9 @@ struct netns_ipv4 {
 #endif
 	struct hlist_head	*fib_table_hash;
 	struct sock		*fibnl;
+#ifdef CONFIG_IP_FIB_TRIE_DIR
+	unsigned long		sysctl_fib_dir_tables[FIB_DIR_MAX_TABLES];
+#endif
 
 	struct sock		**icmp_sk;
 	struct inet_peer_base	*peers;
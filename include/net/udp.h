@@ -162,6 +162,7 @@ static inline void udp_lib_hash(struct sock *sk)
 	BUG();
 }
 
+extern void udp_dst_cache_release(struct sock *sk);
 extern void udp_lib_unhash(struct sock *sk);
 extern void udp_lib_rehash(struct sock *sk, u16 new_hash);
 
@@ -182,6 +183,10 @@ extern void udp_err(struct sk_buff *, u32);
 extern int udp_sendmsg(struct kiocb *iocb, struct sock *sk,
 			    struct msghdr *msg, size_t len);
 extern void udp_flush_pending_frames(struct sock *sk);
+extern int udp_init_sock(struct sock *sk);
+extern struct sk_buff *__skb_recv_udp(struct sock *sk, unsigned int flags,
+				      int noblock, int *peeked, int *off,
+				      int *err);
 extern int udp_rcv(struct sk_buff *skb);
 extern int udp_ioctl(struct sock *sk, int cmd, unsigned long arg);
 extern int udp_disconnect(struct sock *sk, int flags);
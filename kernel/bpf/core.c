@@ -0,0 +1,372 @@
+/*
+ * Extended BPF interpreter and program life cycle
+ *
+ * Programs are sequences of struct bpf_insn operating on ten 64 bit
+ * registers and a 512 byte stack.  They come either from sk_convert_filter()
+ * translating a classic socket filter, which is trusted, or from the bpf()
+ * system call after bpf_check() proved them safe.  In both cases this
+ * interpreter does not need to check anything but division by zero.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ */
+
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <linux/skbuff.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/module.h>
+#include <linux/ratelimit.h>
+#include <linux/math64.h>
+#include <asm/unaligned.h>
+
+/* Registers */
+#define BPF_R0	regs[BPF_REG_0]
+#define BPF_R1	regs[BPF_REG_1]
+#define BPF_R2	regs[BPF_REG_2]
+#define BPF_R3	regs[BPF_REG_3]
+#define BPF_R4	regs[BPF_REG_4]
+#define BPF_R5	regs[BPF_REG_5]
+#define FP	regs[BPF_REG_FP]
+#define ARG1	regs[BPF_REG_ARG1]
+#define CTX	regs[BPF_REG_CTX]
+
+/* Named operands */
+#define DST	regs[insn->dst_reg]
+#define SRC	regs[insn->src_reg]
+#define IMM	insn->imm
+
+/* No hurry in this branch */
+static void *bpf_load_pointer(const struct sk_buff *skb, int k,
+			      unsigned int size, void *buffer)
+{
+	if (k >= 0)
+		return skb_header_pointer(skb, k, size, buffer);
+	return bpf_internal_load_pointer_neg_helper(skb, k, size);
+}
+
+/* Base function for offset calculation.  BPF_CALL instructions store the
+ * distance of the helper from here, so it must stay in .text.
+ */
+noinline u64 __bpf_call_base(u64 r1, u64 r2, u64 r3, u64 r4, u64 r5)
+{
+	return 0;
+}
+EXPORT_SYMBOL_GPL(__bpf_call_base);
+
+/**
+ *	__bpf_prog_run - run an extended BPF program
+ *	@ctx: context passed in R1
+ *	@insn: first instruction of the program
+ *
+ * Returns the low 32 bits of R0 at BPF_EXIT, or 0 if the program divided
+ * by zero or a packet load went out of bounds.
+ */
+static unsigned int __bpf_prog_run(void *ctx, const struct bpf_insn *insn)
+{
+	u64 stack[MAX_BPF_STACK / sizeof(u64)];
+	u64 regs[MAX_BPF_REG], tmp;
+	void *ptr;
+	int off;
+
+	FP = (u64) (unsigned long) &stack[ARRAY_SIZE(stack)];
+	ARG1 = (u64) (unsigned long) ctx;
+
+	for (;; insn++) {
+		switch (insn->code) {
+#define ALU(OPCODE, OP)					\
+		case BPF_ALU64 | BPF_##OPCODE | BPF_X:	\
+			DST = DST OP SRC;		\
+			continue;			\
+		case BPF_ALU | BPF_##OPCODE | BPF_X:	\
+			DST = (u32) DST OP (u32) SRC;	\
+			continue;			\
+		case BPF_ALU64 | BPF_##OPCODE | BPF_K:	\
+			DST = DST OP IMM;		\
+			continue;			\
+		case BPF_ALU | BPF_##OPCODE | BPF_K:	\
+			DST = (u32) DST OP (u32) IMM;	\
+			continue;
+		ALU(ADD,  +)
+		ALU(SUB,  -)
+		ALU(AND,  &)
+		ALU(OR,   |)
+		ALU(LSH, <<)
+		ALU(RSH, >>)
+		ALU(XOR,  ^)
+		ALU(MUL,  *)
+#undef ALU
+		case BPF_ALU | BPF_NEG:
+			DST = (u32) -DST;
+			continue;
+		case BPF_ALU64 | BPF_NEG:
+			DST = -DST;
+			continue;
+		case BPF_ALU | BPF_MOV | BPF_X:
+			DST = (u32) SRC;
+			continue;
+		case BPF_ALU | BPF_MOV | BPF_K:
+			DST = (u32) IMM;
+			continue;
+		case BPF_ALU64 | BPF_MOV | BPF_X:
+			DST = SRC;
+			continue;
+		case BPF_ALU64 | BPF_MOV | BPF_K:
+			DST = IMM;
+			continue;
+		case BPF_LD | BPF_IMM | BPF_DW:
+			DST = (u64) (u32) insn[0].imm |
+			      ((u64) (u32) insn[1].imm) << 32;
+			insn++;
+			continue;
+		case BPF_ALU64 | BPF_ARSH | BPF_X:
+			(*(s64 *) &DST) >>= SRC;
+			continue;
+		case BPF_ALU64 | BPF_ARSH | BPF_K:
+			(*(s64 *) &DST) >>= IMM;
+			continue;
+		case BPF_ALU64 | BPF_MOD | BPF_X:
+			if (unlikely(SRC == 0))
+				return 0;
+			DST -= div64_u64(DST, SRC) * SRC;
+			continue;
+		case BPF_ALU | BPF_MOD | BPF_X:
+			if (unlikely((u32) SRC == 0))
+				return 0;
+			DST = (u32) DST % (u32) SRC;
+			continue;
+		case BPF_ALU64 | BPF_MOD | BPF_K:
+			tmp = (u64) (s64) IMM;
+			DST -= div64_u64(DST, tmp) * tmp;
+			continue;
+		case BPF_ALU | BPF_MOD | BPF_K:
+			DST = (u32) DST % (u32) IMM;
+			continue;
+		case BPF_ALU64 | BPF_DIV | BPF_X:
+			if (unlikely(SRC == 0))
+				return 0;
+			DST = div64_u64(DST, SRC);
+			continue;
+		case BPF_ALU | BPF_DIV | BPF_X:
+			if (unlikely((u32) SRC == 0))
+				return 0;
+			DST = (u32) DST / (u32) SRC;
+			continue;
+		case BPF_ALU64 | BPF_DIV | BPF_K:
+			DST = div64_u64(DST, (u64) (s64) IMM);
+			continue;
+		case BPF_ALU | BPF_DIV | BPF_K:
+			DST = (u32) DST / (u32) IMM;
+			continue;
+		case BPF_ALU | BPF_END | BPF_TO_BE:
+			switch (IMM) {
+			case 16:
+				DST = (__force u16) cpu_to_be16(DST);
+				break;
+			case 32:
+				DST = (__force u32) cpu_to_be32(DST);
+				break;
+			case 64:
+				DST = (__force u64) cpu_to_be64(DST);
+				break;
+			}
+			continue;
+		case BPF_ALU | BPF_END | BPF_TO_LE:
+			switch (IMM) {
+			case 16:
+				DST = (__force u16) cpu_to_le16(DST);
+				break;
+			case 32:
+				DST = (__force u32) cpu_to_le32(DST);
+				break;
+			case 64:
+				DST = (__force u64) cpu_to_le64(DST);
+				break;
+			}
+			continue;
+
+		/* Function call scratches R1-R5, preserves R6-R9 and
+		 * returns its result in R0.
+		 */
+		case BPF_JMP | BPF_CALL:
+			BPF_R0 = (__bpf_call_base + IMM)(BPF_R1, BPF_R2, BPF_R3,
+							  BPF_R4, BPF_R5);
+			continue;
+
+		case BPF_JMP | BPF_JA:
+			insn += insn->off;
+			continue;
+#define COND_JMP(OPCODE, COND_X, COND_K)		\
+		case BPF_JMP | BPF_##OPCODE | BPF_X:	\
+			if (COND_X)			\
+				insn += insn->off;	\
+			continue;			\
+		case BPF_JMP | BPF_##OPCODE | BPF_K:	\
+			if (COND_K)			\
+				insn += insn->off;	\
+			continue;
+		COND_JMP(JEQ, DST == SRC, DST == (u64) (s64) IMM)
+		COND_JMP(JNE, DST != SRC, DST != (u64) (s64) IMM)
+		COND_JMP(JGT, DST > SRC, DST > (u64) (s64) IMM)
+		COND_JMP(JGE, DST >= SRC, DST >= (u64) (s64) IMM)
+		COND_JMP(JSGT, (s64) DST > (s64) SRC, (s64) DST > (s64) IMM)
+		COND_JMP(JSGE, (s64) DST >= (s64) SRC, (s64) DST >= (s64) IMM)
+		COND_JMP(JSET, DST & SRC, DST & (u64) (s64) IMM)
+#undef COND_JMP
+		case BPF_JMP | BPF_EXIT:
+			return BPF_R0;
+
+#define LDST(SIZEOP, SIZE)						\
+		case BPF_STX | BPF_MEM | BPF_##SIZEOP:			\
+			*(SIZE *)(unsigned long) (DST + insn->off) = SRC;	\
+			continue;					\
+		case BPF_ST | BPF_MEM | BPF_##SIZEOP:			\
+			*(SIZE *)(unsigned long) (DST + insn->off) = IMM;	\
+			continue;					\
+		case BPF_LDX | BPF_MEM | BPF_##SIZEOP:			\
+			DST = *(SIZE *)(unsigned long) (SRC + insn->off);	\
+			continue;
+		LDST(B,   u8)
+		LDST(H,  u16)
+		LDST(W,  u32)
+		LDST(DW, u64)
+#undef LDST
+		case BPF_STX | BPF_XADD | BPF_W:
+			atomic_add((u32) SRC, (atomic_t *)(unsigned long)
+				   (DST + insn->off));
+			continue;
+		case BPF_STX | BPF_XADD | BPF_DW:
+			atomic64_add((u64) SRC, (atomic64_t *)(unsigned long)
+				     (DST + insn->off));
+			continue;
+
+		/* Packet loads only appear in programs whose context is an
+		 * skb, which the verifier requires to be in R6.  A load out
+		 * of bounds ends the program, like in classic BPF.
+		 */
+		case BPF_LD | BPF_ABS | BPF_W:
+			off = IMM;
+load_word:
+			ptr = bpf_load_pointer((struct sk_buff *)
+					       (unsigned long) CTX, off, 4, &tmp);
+			if (likely(ptr != NULL)) {
+				BPF_R0 = get_unaligned_be32(ptr);
+				continue;
+			}
+			return 0;
+		case BPF_LD | BPF_ABS | BPF_H:
+			off = IMM;
+load_half:
+			ptr = bpf_load_pointer((struct sk_buff *)
+					       (unsigned long) CTX, off, 2, &tmp);
+			if (likely(ptr != NULL)) {
+				BPF_R0 = get_unaligned_be16(ptr);
+				continue;
+			}
+			return 0;
+		case BPF_LD | BPF_ABS | BPF_B:
+			off = IMM;
+load_byte:
+			ptr = bpf_load_pointer((struct sk_buff *)
+					       (unsigned long) CTX, off, 1, &tmp);
+			if (likely(ptr != NULL)) {
+				BPF_R0 = *(u8 *)ptr;
+				continue;
+			}
+			return 0;
+		case BPF_LD | BPF_IND | BPF_W:
+			off = IMM + SRC;
+			goto load_word;
+		case BPF_LD | BPF_IND | BPF_H:
+			off = IMM + SRC;
+			goto load_half;
+		case BPF_LD | BPF_IND | BPF_B:
+			off = IMM + SRC;
+			goto load_byte;
+
+		default:
+			WARN_RATELIMIT(1, "unknown opcode %02x\n", insn->code);
+			return 0;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ *	bpf_prog_run - run a program on a context
+ *	@prog: program from bpf_prog_alloc() that was verified or converted
+ *	@ctx: the context its type expects, an skb for socket filters
+ */
+unsigned int bpf_prog_run(const struct bpf_prog *prog, void *ctx)
+{
+	return __bpf_prog_run(ctx, prog->insnsi);
+}
+EXPORT_SYMBOL_GPL(bpf_prog_run);
+
+/**
+ *	bpf_prog_alloc - allocate a program
+ *	@insn_cnt: number of instructions
+ *
+ * Returns a zeroed program with one reference and room for @insn_cnt
+ * instructions, or NULL.
+ */
+struct bpf_prog *bpf_prog_alloc(unsigned int insn_cnt)
+{
+	size_t size = sizeof(struct bpf_prog) +
+		      insn_cnt * sizeof(struct bpf_insn);
+	struct bpf_prog *prog;
+
+	/* converted socket filters are small and there is one per socket */
+	if (size <= PAGE_SIZE)
+		prog = kzalloc(size, GFP_KERNEL);
+	else
+		prog = vzalloc(size);
+	if (!prog)
+		return NULL;
+
+	atomic_set(&prog->refcnt, 1);
+	prog->len = insn_cnt;
+	return prog;
+}
+EXPORT_SYMBOL_GPL(bpf_prog_alloc);
+
+static void bpf_prog_free_deferred(struct work_struct *work)
+{
+	struct bpf_prog *prog = container_of(work, struct bpf_prog, work);
+	int i;
+
+	for (i = 0; i < prog->used_map_cnt; i++)
+		bpf_map_put(prog->used_maps[i]);
+	kfree(prog->used_maps);
+
+	if (is_vmalloc_addr(prog))
+		vfree(prog);
+	else
+		kfree(prog);
+}
+
+static void bpf_prog_free_rcu(struct rcu_head *rcu)
+{
+	struct bpf_prog *prog = container_of(rcu, struct bpf_prog, rcu);
+
+	/* vfree() and the map destructors may sleep */
+	INIT_WORK(&prog->work, bpf_prog_free_deferred);
+	schedule_work(&prog->work);
+}
+
+/**
+ *	bpf_prog_free - free a program and drop its maps
+ *	@prog: program whose last reference is gone
+ *
+ * Kprobe handlers run programs with preemption disabled and without taking
+ * a reference, so the memory is only released after an RCU-sched grace
+ * period.  Can be called from any context.
+ */
+void bpf_prog_free(struct bpf_prog *prog)
+{
+	call_rcu_sched(&prog->rcu, bpf_prog_free_rcu);
+}
+EXPORT_SYMBOL_GPL(bpf_prog_free);
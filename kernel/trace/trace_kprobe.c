@@ -19,6 +19,7 @@
 
 #include <linux/module.h>
 #include <linux/uaccess.h>
+#include <linux/bpf.h>
 
 #include "trace_probe.h"
 
@@ -985,6 +986,9 @@ static __kprobes void kprobe_perf_func(struct kprobe *kp,
 	int size, __size, dsize;
 	int rctx;
 
+	if (call->prog && !trace_call_bpf(call->prog, regs))
+		return;
+
 	dsize = __get_data_size(tp, regs);
 	__size = sizeof(*entry) + tp->size + dsize;
 	size = ALIGN(__size + sizeof(u32), sizeof(u64));
@@ -1017,6 +1021,9 @@ static __kprobes void kretprobe_perf_func(struct kretprobe_instance *ri,
 	int size, __size, dsize;
 	int rctx;
 
+	if (call->prog && !trace_call_bpf(call->prog, regs))
+		return;
+
 	dsize = __get_data_size(tp, regs);
 	__size = sizeof(*entry) + tp->size + dsize;
 	size = ALIGN(__size + sizeof(u32), sizeof(u64));
@@ -1125,7 +1132,7 @@ static int register_probe_event(struct trace_probe *tp)
 		kfree(call->print_fmt);
 		return -ENODEV;
 	}
-	call->flags = 0;
+	call->flags = TRACE_EVENT_FL_KPROBE;
 	call->class->reg = kprobe_register;
 	call->data = tp;
 	ret = trace_add_event_call(call);
@@ -55,6 +55,7 @@
 #include <net/checksum.h>
 #include <net/sock.h>
 #include <net/tcp_states.h>
+#include <net/busy_poll.h>
 #include <trace/events/skb.h>
 
 /*
@@ -77,10 +78,18 @@ static int receiver_wake_function(wait_queue_t *wait, unsigned int mode, int syn
 		return 0;
 	return autoremove_wake_function(wait, mode, sync, key);
 }
-/*
- * Wait for a packet..
+/**
+ *	__skb_wait_for_more_packets - wait for a datagram to arrive
+ *	@sk: socket
+ *	@err: error code returned
+ *	@timeo_p: remaining time to wait, updated on return
+ *	@queue: private queue the caller also reads from, or %NULL
+ *
+ *	Returns 0 when the caller should look at the queues again, non-zero
+ *	if it should give up, with *err set to the reason.
  */
-static int wait_for_packet(struct sock *sk, int *err, long *timeo_p)
+int __skb_wait_for_more_packets(struct sock *sk, int *err, long *timeo_p,
+				const struct sk_buff_head *queue)
 {
 	int error;
 	DEFINE_WAIT_FUNC(wait, receiver_wake_function);
@@ -92,7 +101,8 @@ static int wait_for_packet(struct sock *sk, int *err, long *timeo_p)
 	if (error)
 		goto out_err;
 
-	if (!skb_queue_empty(&sk->sk_receive_queue))
+	if (!skb_queue_empty(&sk->sk_receive_queue) ||
+	    (queue && !skb_queue_empty(queue)))
 		goto out;
 
 	/* Socket shut down? */
@@ -126,6 +136,44 @@ out_noerr:
 	error = 1;
 	goto out;
 }
+EXPORT_SYMBOL(__skb_wait_for_more_packets);
+
+/**
+ *	__skb_try_recv_from_queue - dequeue or peek the next datagram
+ *	@queue: queue to look at, its lock held by the caller
+ *	@flags: MSG_ flags
+ *	@peeked: returns non-zero if this packet has been seen before
+ *	@off: an offset in bytes to peek skb from.  Only updated, to the
+ *	      offset within the returned skb, if one is found
+ *
+ *	Returns the datagram, unlinked unless MSG_PEEK is set, or %NULL if
+ *	the queue holds nothing at the requested offset.
+ */
+struct sk_buff *__skb_try_recv_from_queue(struct sk_buff_head *queue,
+					  unsigned int flags, int *peeked,
+					  int *off)
+{
+	struct sk_buff *skb;
+	int _off = *off;
+
+	skb_queue_walk(queue, skb) {
+		*peeked = skb->peeked;
+		if (flags & MSG_PEEK) {
+			if (_off >= skb->len) {
+				_off -= skb->len;
+				continue;
+			}
+			skb->peeked = 1;
+			atomic_inc(&skb->users);
+		} else
+			__skb_unlink(skb, queue);
+
+		*off = _off;
+		return skb;
+	}
+	return NULL;
+}
+EXPORT_SYMBOL(__skb_try_recv_from_queue);
 
 /**
  *	__skb_recv_datagram - Receive a datagram skbuff
@@ -184,29 +232,21 @@ struct sk_buff *__skb_recv_datagram(struct sock *sk, unsigned int flags,
 		struct sk_buff_head *queue = &sk->sk_receive_queue;
 
 		spin_lock_irqsave(&queue->lock, cpu_flags);
-		skb_queue_walk(queue, skb) {
-			*peeked = skb->peeked;
-			if (flags & MSG_PEEK) {
-				if (*off >= skb->len) {
-					*off -= skb->len;
-					continue;
-				}
-				skb->peeked = 1;
-				atomic_inc(&skb->users);
-			} else
-				__skb_unlink(skb, queue);
-
-			spin_unlock_irqrestore(&queue->lock, cpu_flags);
-			return skb;
-		}
+		skb = __skb_try_recv_from_queue(queue, flags, peeked, off);
 		spin_unlock_irqrestore(&queue->lock, cpu_flags);
+		if (skb)
+			return skb;
+
+		if (sk_can_busy_loop(sk) &&
+		    sk_busy_loop(sk, flags & MSG_DONTWAIT))
+			continue;
 
 		/* User doesn't want to wait */
 		error = -EAGAIN;
 		if (!timeo)
 			goto no_packet;
 
-	} while (!wait_for_packet(sk, err, &timeo));
+	} while (!__skb_wait_for_more_packets(sk, err, &timeo, NULL));
 
 	return NULL;
 
@@ -253,8 +293,9 @@ void skb_free_datagram_locked(struct sock *sk, struct sk_buff *skb)
 EXPORT_SYMBOL(skb_free_datagram_locked);
 
 /**
- *	skb_kill_datagram - Free a datagram skbuff forcibly
+ *	__skb_kill_datagram - Free a datagram skbuff forcibly
  *	@sk: socket
+ *	@queue: queue the datagram was received from
  *	@skb: datagram skbuff
  *	@flags: MSG_ flags
  *
@@ -263,29 +304,29 @@ EXPORT_SYMBOL(skb_free_datagram_locked);
  *	used for skb_recv_datagram.
  *
  *	If the MSG_PEEK flag is set, and the packet is still on the
- *	receive queue of the socket, it will be taken off the queue
- *	before it is freed.
+ *	queue, it will be taken off the queue before it is freed.
  *
  *	This function currently only disables BH when acquiring the
- *	sk_receive_queue lock.  Therefore it must not be used in a
+ *	queue lock.  Therefore it must not be used in a
  *	context where that lock is acquired in an IRQ context.
  *
  *	It returns 0 if the packet was removed by us.
  */
 
-int skb_kill_datagram(struct sock *sk, struct sk_buff *skb, unsigned int flags)
+int __skb_kill_datagram(struct sock *sk, struct sk_buff_head *queue,
+			struct sk_buff *skb, unsigned int flags)
 {
 	int err = 0;
 
 	if (flags & MSG_PEEK) {
 		err = -ENOENT;
-		spin_lock_bh(&sk->sk_receive_queue.lock);
-		if (skb == skb_peek(&sk->sk_receive_queue)) {
-			__skb_unlink(skb, &sk->sk_receive_queue);
+		spin_lock_bh(&queue->lock);
+		if (skb == skb_peek(queue)) {
+			__skb_unlink(skb, queue);
 			atomic_dec(&skb->users);
 			err = 0;
 		}
-		spin_unlock_bh(&sk->sk_receive_queue.lock);
+		spin_unlock_bh(&queue->lock);
 	}
 
 	kfree_skb(skb);
@@ -294,6 +335,12 @@ int skb_kill_datagram(struct sock *sk, struct sk_buff *skb, unsigned int flags)
 
 	return err;
 }
+EXPORT_SYMBOL(__skb_kill_datagram);
+
+int skb_kill_datagram(struct sock *sk, struct sk_buff *skb, unsigned int flags)
+{
+	return __skb_kill_datagram(sk, &sk->sk_receive_queue, skb, flags);
+}
 EXPORT_SYMBOL(skb_kill_datagram);
 
 /**
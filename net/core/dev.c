@@ -91,6 +91,7 @@
 #include <linux/if_ether.h>
 #include <linux/netdevice.h>
 #include <linux/etherdevice.h>
+#include <linux/filter.h>
 #include <linux/ethtool.h>
 #include <linux/notifier.h>
 #include <linux/skbuff.h>
@@ -1603,12 +1604,10 @@ static inline bool is_skb_forwardable(struct net_device *dev,
  */
 int dev_forward_skb(struct net_device *dev, struct sk_buff *skb)
 {
-	if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY) {
-		if (skb_copy_ubufs(skb, GFP_ATOMIC)) {
-			atomic_long_inc(&dev->rx_dropped);
-			kfree_skb(skb);
-			return NET_RX_DROP;
-		}
+	if (skb_orphan_frags_rx(skb, GFP_ATOMIC)) {
+		atomic_long_inc(&dev->rx_dropped);
+		kfree_skb(skb);
+		return NET_RX_DROP;
 	}
 
 	skb_orphan(skb);
@@ -1636,7 +1635,7 @@ static inline int deliver_skb(struct sk_buff *skb,
 			      struct packet_type *pt_prev,
 			      struct net_device *orig_dev)
 {
-	if (unlikely(skb_orphan_frags(skb, GFP_ATOMIC)))
+	if (unlikely(skb_orphan_frags_rx(skb, GFP_ATOMIC)))
 		return -ENOMEM;
 	atomic_inc(&skb->users);
 	return pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
@@ -1704,8 +1703,12 @@ static void dev_queue_xmit_nit(struct sk_buff *skb, struct net_device *dev)
 			pt_prev = ptype;
 		}
 	}
-	if (pt_prev)
-		pt_prev->func(skb2, skb->dev, pt_prev, skb->dev);
+	if (pt_prev) {
+		if (!skb_orphan_frags_rx(skb2, GFP_ATOMIC))
+			pt_prev->func(skb2, skb->dev, pt_prev, skb->dev);
+		else
+			kfree_skb(skb2);
+	}
 	rcu_read_unlock();
 }
 
@@ -2024,6 +2027,90 @@ struct sk_buff *skb_gso_segment(struct sk_buff *skb,
 }
 EXPORT_SYMBOL(skb_gso_segment);
 
+/**
+ *	skb_encap_gso_segment - segment the packet inside a tunnel header
+ *	@skb: buffer to segment, data pointing to the tunnel header
+ *	@features: features for the output path
+ *	@hlen: length of the tunnel header
+ *	@type: ethertype of the encapsulated packet
+ *	@csum: the tunnel header carries a checksum over the payload
+ *
+ *	Segments the encapsulated packet and puts a copy of the outer
+ *	headers, from the link layer header up to the end of the tunnel
+ *	header, in front of every segment.  The inner checksum is completed
+ *	in software unless the device can checksum any packet and @csum is
+ *	false.  Tunnel header fields that differ between segments are left
+ *	to the caller; the transport header of each segment points to the
+ *	tunnel header.
+ */
+struct sk_buff *skb_encap_gso_segment(struct sk_buff *skb,
+				      netdev_features_t features,
+				      unsigned int hlen, __be16 type, bool csum)
+{
+	unsigned int outer_hlen = skb->data - skb_mac_header(skb);
+	unsigned int tnl_hlen = outer_hlen + hlen;
+	__be16 protocol = skb->protocol;
+	int mac_len = skb->mac_len;
+	struct sk_buff *segs, *seg;
+	int err;
+
+	if (unlikely(!pskb_may_pull(skb, hlen)))
+		return ERR_PTR(-EINVAL);
+
+	__skb_pull(skb, hlen);
+	skb_reset_network_header(skb);
+	skb->protocol = type;
+
+	/* Pretend the device can checksum anything, the inner checksum is
+	 * sorted out below once the outer headers are back in place.
+	 */
+	segs = skb_gso_segment(skb, (features & ~NETIF_F_GSO_MASK) |
+				    NETIF_F_HW_CSUM);
+	if (IS_ERR_OR_NULL(segs)) {
+		__skb_push(skb, tnl_hlen);
+		skb_reset_mac_header(skb);
+		skb_set_network_header(skb, mac_len);
+		skb->mac_len = mac_len;
+		skb->protocol = protocol;
+		__skb_pull(skb, outer_hlen);
+		return segs;
+	}
+
+	/* skb->data is back at the inner packet, the outer headers are
+	 * still in its headroom.
+	 */
+	for (seg = segs; seg; seg = seg->next) {
+		err = skb_cow_head(seg, tnl_hlen);
+		if (unlikely(err))
+			goto err;
+
+		__skb_push(seg, tnl_hlen);
+		skb_copy_to_linear_data(seg, skb->data - tnl_hlen, tnl_hlen);
+		skb_reset_mac_header(seg);
+		skb_set_network_header(seg, mac_len);
+		skb_set_transport_header(seg, outer_hlen);
+		seg->mac_len = mac_len;
+		seg->protocol = protocol;
+
+		if (seg->ip_summed == CHECKSUM_PARTIAL &&
+		    (csum || !(features & NETIF_F_HW_CSUM))) {
+			err = skb_checksum_help(seg);
+			if (unlikely(err))
+				goto err;
+		}
+	}
+
+	return segs;
+
+err:
+	while ((seg = segs)) {
+		segs = seg->next;
+		kfree_skb(seg);
+	}
+	return ERR_PTR(err);
+}
+EXPORT_SYMBOL(skb_encap_gso_segment);
+
 /* Take action when hardware reception checksum errors are detected. */
 #ifdef CONFIG_BUG
 void netdev_rx_csum_fault(struct net_device *dev)
@@ -2134,6 +2221,12 @@ static bool can_checksum_protocol(netdev_features_t features, __be16 protocol)
 static netdev_features_t harmonize_features(struct sk_buff *skb,
 	__be16 protocol, netdev_features_t features)
 {
+	/* The checksum to fill in is in the inner headers, only a device
+	 * that can checksum any packet knows how to find it.
+	 */
+	if (skb->encapsulation)
+		features &= ~NETIF_F_ALL_CSUM | NETIF_F_GEN_CSUM;
+
 	if (skb->ip_summed != CHECKSUM_NONE &&
 	    !can_checksum_protocol(features, protocol)) {
 		features &= ~NETIF_F_ALL_CSUM;
@@ -2189,10 +2282,32 @@ static inline int skb_needs_linearize(struct sk_buff *skb,
 				!(features & NETIF_F_SG)));
 }
 
+/**
+ *	dev_xmit_needs_fixup - will the stack have to touch up this skb
+ *	@skb: buffer about to be passed to dev_hard_start_xmit()
+ *
+ *	True if the vlan tag, segmentation, linearizing or checksum of @skb
+ *	has to be done in software for skb->dev.  Any of those can fail, and
+ *	then dev_hard_start_xmit() drops the skb without the driver seeing it.
+ */
+bool dev_xmit_needs_fixup(struct sk_buff *skb)
+{
+	netdev_features_t features = netif_skb_features(skb);
+
+	if (vlan_tx_tag_present(skb) && !(features & NETIF_F_HW_VLAN_TX))
+		return true;
+	if (netif_needs_gso(skb, features))
+		return true;
+	if (skb_needs_linearize(skb, features))
+		return true;
+	return skb->ip_summed == CHECKSUM_PARTIAL &&
+	       !(features & NETIF_F_ALL_CSUM);
+}
+EXPORT_SYMBOL(dev_xmit_needs_fixup);
+
 int dev_hard_start_xmit(struct sk_buff *skb, struct net_device *dev,
-			struct netdev_queue *txq)
+			struct netdev_queue *txq, bool more)
 {
-	const struct net_device_ops *ops = dev->netdev_ops;
 	int rc = NETDEV_TX_OK;
 	unsigned int skb_len;
 
@@ -2244,7 +2359,7 @@ int dev_hard_start_xmit(struct sk_buff *skb, struct net_device *dev,
 		}
 
 		skb_len = skb->len;
-		rc = ops->ndo_start_xmit(skb, dev);
+		rc = netdev_start_xmit(skb, dev, more);
 		trace_net_dev_xmit(skb, rc, dev, skb_len);
 		if (rc == NETDEV_TX_OK)
 			txq_trans_update(txq);
@@ -2266,7 +2381,7 @@ gso:
 			skb_dst_drop(nskb);
 
 		skb_len = nskb->len;
-		rc = ops->ndo_start_xmit(nskb, dev);
+		rc = netdev_start_xmit(nskb, dev, more || skb->next);
 		trace_net_dev_xmit(nskb, rc, dev, skb_len);
 		if (unlikely(rc != NETDEV_TX_OK)) {
 			if (rc & ~NETDEV_TX_MASK)
@@ -2421,6 +2536,25 @@ static inline int __dev_xmit_skb(struct sk_buff *skb, struct Qdisc *q,
 
 	qdisc_skb_cb(skb)->pkt_len = skb->len;
 	qdisc_calculate_pkt_len(skb, q);
+
+	if (q->flags & TCQ_F_NOLOCK) {
+		/*
+		 * The qdisc serialises enqueues itself and dequeues are
+		 * serialised by qdisc_run_begin(): neither the root lock
+		 * nor the busylock are needed.  dev_deactivate_many()
+		 * flushes whatever races with the DEACTIVATED test.
+		 */
+		if (unlikely(test_bit(__QDISC_STATE_DEACTIVATED, &q->state))) {
+			kfree_skb(skb);
+			rc = NET_XMIT_DROP;
+		} else {
+			skb_dst_force(skb);
+			rc = q->enqueue(skb, q) & NET_XMIT_MASK;
+			qdisc_run(q);
+		}
+		return rc;
+	}
+
 	/*
 	 * Heuristic to force contended enqueues to serialize on a
 	 * separate lock before trying to get qdisc main lock.
@@ -2585,7 +2719,7 @@ int dev_queue_xmit(struct sk_buff *skb)
 
 			if (!netif_xmit_stopped(txq)) {
 				__this_cpu_inc(xmit_recursion);
-				rc = dev_hard_start_xmit(skb, dev, txq);
+				rc = dev_hard_start_xmit(skb, dev, txq, false);
 				__this_cpu_dec(xmit_recursion);
 				if (dev_xmit_complete(rc)) {
 					HARD_TX_UNLOCK(dev, txq);
@@ -3039,6 +3173,15 @@ static void net_tx_action(struct softirq_action *h)
 
 			head = head->next_sched;
 
+			if (q->flags & TCQ_F_NOLOCK) {
+				smp_mb__before_clear_bit();
+				clear_bit(__QDISC_STATE_SCHED, &q->state);
+				if (!test_bit(__QDISC_STATE_DEACTIVATED,
+					      &q->state))
+					qdisc_run(q);
+				continue;
+			}
+
 			root_lock = qdisc_lock(q);
 			if (spin_trylock(root_lock)) {
 				smp_mb__before_clear_bit();
@@ -3178,6 +3321,123 @@ void netdev_rx_handler_unregister(struct net_device *dev)
 }
 EXPORT_SYMBOL_GPL(netdev_rx_handler_unregister);
 
+/*
+ * Early receive filter.  Drivers setting IFF_RX_FILTER run dev->rx_filter
+ * from their receive loop over the DMA buffer, before an skb is allocated,
+ * so that traffic which is going to be dropped costs as little as possible.
+ * It is a classic BPF program, JIT compiled where the architecture can.
+ */
+
+/**
+ *	dev_set_rx_filter - attach or detach the early receive filter
+ *	@dev: device
+ *	@fp: filter from sk_unattached_filter_create(), NULL to detach
+ *
+ *	The caller must hold the rtnl_mutex.
+ */
+void dev_set_rx_filter(struct net_device *dev, struct sk_filter *fp)
+{
+	struct sk_filter *old;
+
+	ASSERT_RTNL();
+
+	old = rtnl_dereference(dev->rx_filter);
+	rcu_assign_pointer(dev->rx_filter, fp);
+	if (old)
+		sk_unattached_filter_destroy(old);
+}
+EXPORT_SYMBOL_GPL(dev_set_rx_filter);
+
+/* SKF_RX_TX: send the frame back out of the port it came in on */
+static void dev_rx_filter_xmit(struct net_device *dev, struct sk_buff *skb)
+{
+	struct ethhdr *eth = eth_hdr(skb);
+	u8 addr[ETH_ALEN];
+
+	memcpy(addr, eth->h_dest, ETH_ALEN);
+	memcpy(eth->h_dest, eth->h_source, ETH_ALEN);
+	memcpy(eth->h_source, addr, ETH_ALEN);
+
+	skb->dev = dev;
+	skb->ip_summed = CHECKSUM_NONE;
+	dev_queue_xmit(skb);
+}
+
+bool __dev_rx_filter(struct net_device *dev, void *data, unsigned int len)
+{
+	struct sk_filter *fp;
+	struct sk_buff *nskb;
+	struct sk_buff skb;
+	unsigned int res;
+
+	if (unlikely(len < ETH_HLEN))
+		return false;
+
+	/* The filter reads packet data and a few header fields only, so an
+	 * skb on the stack describing the receive buffer stands in for one.
+	 */
+	memset(&skb, 0, offsetof(struct sk_buff, tail));
+	skb.head = data;
+	skb.data = data;
+	skb.len = len;
+	skb_reset_tail_pointer(&skb);
+	skb_set_tail_pointer(&skb, len);
+	skb.end = skb.tail;
+	skb_reset_mac_header(&skb);
+	skb_set_network_header(&skb, ETH_HLEN);
+	skb.protocol = eth_hdr(&skb)->h_proto;
+	skb.dev = dev;
+
+	rcu_read_lock();
+	fp = rcu_dereference(dev->rx_filter);
+	res = fp ? SK_RUN_FILTER(fp, &skb) : ~0U;
+	rcu_read_unlock();
+
+	if (res == SKF_RX_DROP)
+		return true;
+	if (res != SKF_RX_TX)
+		return false;
+
+	/* the receive buffer goes back to the driver, transmit a copy */
+	nskb = netdev_alloc_skb(dev, len);
+	if (nskb) {
+		memcpy(skb_put(nskb, len), data, len);
+		skb_reset_mac_header(nskb);
+		nskb->protocol = skb.protocol;
+		dev_rx_filter_xmit(dev, nskb);
+	}
+	return true;
+}
+EXPORT_SYMBOL_GPL(__dev_rx_filter);
+
+bool __dev_rx_filter_skb(struct net_device *dev, struct sk_buff *skb)
+{
+	unsigned int mac_len = skb->data - skb_mac_header(skb);
+	struct sk_filter *fp;
+	unsigned int res;
+
+	/* the filter sees the frame from the Ethernet header on */
+	__skb_push(skb, mac_len);
+
+	rcu_read_lock();
+	fp = rcu_dereference(dev->rx_filter);
+	res = fp ? SK_RUN_FILTER(fp, skb) : ~0U;
+	rcu_read_unlock();
+
+	if (res == SKF_RX_DROP) {
+		kfree_skb(skb);
+		return true;
+	}
+	if (res == SKF_RX_TX) {
+		dev_rx_filter_xmit(dev, skb);
+		return true;
+	}
+
+	__skb_pull(skb, mac_len);
+	return false;
+}
+EXPORT_SYMBOL_GPL(__dev_rx_filter_skb);
+
 /*
  * Limit the use of PFMEMALLOC reserves to those protocols that implement
  * the special handling of PFMEMALLOC skbs.
@@ -3327,7 +3587,7 @@ ncls:
 	}
 
 	if (pt_prev) {
-		if (unlikely(skb_orphan_frags(skb, GFP_ATOMIC)))
+		if (unlikely(skb_orphan_frags_rx(skb, GFP_ATOMIC)))
 			goto drop;
 		else
 			ret = pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
@@ -3436,7 +3696,7 @@ static int napi_gro_complete(struct sk_buff *skb)
 		if (ptype->type != type || ptype->dev || !ptype->gro_complete)
 			continue;
 
-		err = ptype->gro_complete(skb);
+		err = ptype->gro_complete(skb, 0);
 		break;
 	}
 	rcu_read_unlock();
@@ -3558,6 +3818,37 @@ normal:
 }
 EXPORT_SYMBOL(dev_gro_receive);
 
+/* For protocols that carry another packet: find the GRO handlers of the
+ * encapsulated protocol.  Called under rcu_read_lock().
+ */
+struct packet_type *gro_find_receive_by_type(__be16 type)
+{
+	struct list_head *head = &ptype_base[ntohs(type) & PTYPE_HASH_MASK];
+	struct packet_type *ptype;
+
+	list_for_each_entry_rcu(ptype, head, list) {
+		if (ptype->type != type || ptype->dev || !ptype->gro_receive)
+			continue;
+		return ptype;
+	}
+	return NULL;
+}
+EXPORT_SYMBOL(gro_find_receive_by_type);
+
+struct packet_type *gro_find_complete_by_type(__be16 type)
+{
+	struct list_head *head = &ptype_base[ntohs(type) & PTYPE_HASH_MASK];
+	struct packet_type *ptype;
+
+	list_for_each_entry_rcu(ptype, head, list) {
+		if (ptype->type != type || ptype->dev || !ptype->gro_complete)
+			continue;
+		return ptype;
+	}
+	return NULL;
+}
+EXPORT_SYMBOL(gro_find_complete_by_type);
+
 static inline gro_result_t
 __napi_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 {
@@ -3863,6 +4154,74 @@ void napi_complete(struct napi_struct *n)
 }
 EXPORT_SYMBOL(napi_complete);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/*
+ * NAPI contexts that can be busy polled from sockets are kept in a small
+ * hash table keyed by napi_id.  Sockets remember the id of the last NAPI
+ * context that delivered to them (see sk_mark_napi_id()) instead of a
+ * pointer, so a stale id simply fails the lookup.
+ */
+#define NAPI_HASH_BITS	8
+#define NAPI_HASH_SIZE	(1 << NAPI_HASH_BITS)
+
+static struct hlist_head napi_hash[NAPI_HASH_SIZE];
+static DEFINE_SPINLOCK(napi_hash_lock);
+static unsigned int napi_gen_id;
+
+/* must be called under rcu_read_lock(), as we dont take a reference */
+struct napi_struct *napi_by_id(unsigned int napi_id)
+{
+	unsigned int hash = napi_id % NAPI_HASH_SIZE;
+	struct napi_struct *napi;
+	struct hlist_node *node;
+
+	hlist_for_each_entry_rcu(napi, node, &napi_hash[hash], napi_hash_node)
+		if (napi->napi_id == napi_id)
+			return napi;
+
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(napi_by_id);
+
+void napi_hash_add(struct napi_struct *napi)
+{
+	if (!test_and_set_bit(NAPI_STATE_HASHED, &napi->state)) {
+
+		spin_lock(&napi_hash_lock);
+
+		/* 0 is not a valid id, we also skip an id that is taken
+		 * we expect both events to be extremely rare
+		 */
+		napi->napi_id = 0;
+		while (!napi->napi_id) {
+			napi->napi_id = ++napi_gen_id;
+			if (napi_by_id(napi->napi_id))
+				napi->napi_id = 0;
+		}
+
+		hlist_add_head_rcu(&napi->napi_hash_node,
+			&napi_hash[napi->napi_id % NAPI_HASH_SIZE]);
+
+		spin_unlock(&napi_hash_lock);
+	}
+}
+EXPORT_SYMBOL_GPL(napi_hash_add);
+
+/* Warning : caller is responsible to make sure rcu grace period
+ * is respected before freeing memory containing @napi
+ */
+void napi_hash_del(struct napi_struct *napi)
+{
+	spin_lock(&napi_hash_lock);
+
+	if (test_and_clear_bit(NAPI_STATE_HASHED, &napi->state))
+		hlist_del_rcu(&napi->napi_hash_node);
+
+	spin_unlock(&napi_hash_lock);
+}
+EXPORT_SYMBOL_GPL(napi_hash_del);
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 		    int (*poll)(struct napi_struct *, int), int weight)
 {
@@ -3886,6 +4245,7 @@ void netif_napi_del(struct napi_struct *napi)
 {
 	struct sk_buff *skb, *next;
 
+	napi_hash_del(napi);
 	list_del_init(&napi->dev_list);
 	napi_free_frags(napi);
 
@@ -5300,6 +5660,8 @@ static void rollback_registered_many(struct list_head *head)
 		/* Shutdown queueing discipline. */
 		dev_shutdown(dev);
 
+		dev_set_rx_filter(dev, NULL);
+
 
 		/* Notify protocols, that we are about to destroy
 		   this device. They should clean all the things.
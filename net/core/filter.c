@@ -39,6 +39,8 @@
 #include <linux/reciprocal_div.h>
 #include <linux/ratelimit.h>
 #include <linux/seccomp.h>
+#include <linux/if_vlan.h>
+#include <linux/bpf.h>
 
 /* No hurry in this branch
  *
@@ -381,6 +383,552 @@ load_b:
 }
 EXPORT_SYMBOL(sk_run_filter);
 
+/* Ancillary loads that are helper calls in extended BPF.  They follow the
+ * BPF_CALL convention: context, A and X come in R1-R3, the result in R0.
+ */
+static u64 __skb_get_nlattr(u64 ctx, u64 A, u64 X, u64 r4, u64 r5)
+{
+	struct sk_buff *skb = (struct sk_buff *)(unsigned long) ctx;
+	struct nlattr *nla;
+
+	if (skb_is_nonlinear(skb))
+		return 0;
+
+	if (skb->len < sizeof(struct nlattr))
+		return 0;
+
+	if (A > skb->len - sizeof(struct nlattr))
+		return 0;
+
+	nla = nla_find((struct nlattr *) &skb->data[A], skb->len - A, X);
+	if (nla)
+		return (void *) nla - (void *) skb->data;
+
+	return 0;
+}
+
+static u64 __skb_get_nlattr_nest(u64 ctx, u64 A, u64 X, u64 r4, u64 r5)
+{
+	struct sk_buff *skb = (struct sk_buff *)(unsigned long) ctx;
+	struct nlattr *nla;
+
+	if (skb_is_nonlinear(skb))
+		return 0;
+
+	if (skb->len < sizeof(struct nlattr))
+		return 0;
+
+	if (A > skb->len - sizeof(struct nlattr))
+		return 0;
+
+	nla = (struct nlattr *) &skb->data[A];
+	if (nla->nla_len > skb->len - A)
+		return 0;
+
+	nla = nla_find_nested(nla, X);
+	if (nla)
+		return (void *) nla - (void *) skb->data;
+
+	return 0;
+}
+
+static u64 __get_raw_cpu_id(u64 ctx, u64 A, u64 X, u64 r4, u64 r5)
+{
+	return raw_smp_processor_id();
+}
+
+/* Classic filters use u32 mem[BPF_MEMWORDS], kept below the frame pointer */
+#define BPF_MEM_OFF(k)	(-(int)((BPF_MEMWORDS - (k)) * sizeof(u32)))
+
+static bool convert_bpf_extensions(struct sock_filter *fp,
+				   struct bpf_insn **insnp)
+{
+	struct bpf_insn *insn = *insnp;
+
+	switch (fp->code) {
+	case BPF_S_ANC_PROTOCOL:
+		/* A = ntohs(*(u16 *) (CTX + offsetof(protocol))) */
+		*insn++ = BPF_LDX_MEM(BPF_H, BPF_REG_A, BPF_REG_CTX,
+				      offsetof(struct sk_buff, protocol));
+		/* A = ntohs(A) [emitting a nop or swap16] */
+		*insn = BPF_ENDIAN(BPF_FROM_BE, BPF_REG_A, 16);
+		break;
+
+	case BPF_S_ANC_PKTTYPE:
+		*insn++ = BPF_LDX_MEM(BPF_B, BPF_REG_A, BPF_REG_CTX,
+				      PKT_TYPE_OFFSET());
+		*insn = BPF_ALU32_IMM(BPF_AND, BPF_REG_A, PKT_TYPE_MAX);
+#ifdef __BIG_ENDIAN_BITFIELD
+		insn++;
+		*insn = BPF_ALU32_IMM(BPF_RSH, BPF_REG_A, 5);
+#endif
+		break;
+
+	case BPF_S_ANC_IFINDEX:
+	case BPF_S_ANC_HATYPE:
+		*insn++ = BPF_LDX_MEM(bytes_to_bpf_size(sizeof(void *)),
+				      BPF_REG_TMP, BPF_REG_CTX,
+				      offsetof(struct sk_buff, dev));
+		/* if (tmp != 0) goto pc + 2, else return 0 */
+		*insn++ = BPF_JMP_IMM(BPF_JNE, BPF_REG_TMP, 0, 2);
+		*insn++ = BPF_MOV32_IMM(BPF_REG_A, 0);
+		*insn++ = BPF_EXIT_INSN();
+		if (fp->code == BPF_S_ANC_IFINDEX) {
+			BUILD_BUG_ON(FIELD_SIZEOF(struct net_device, ifindex) != 4);
+			*insn = BPF_LDX_MEM(BPF_W, BPF_REG_A, BPF_REG_TMP,
+					    offsetof(struct net_device, ifindex));
+		} else {
+			BUILD_BUG_ON(FIELD_SIZEOF(struct net_device, type) != 2);
+			*insn = BPF_LDX_MEM(BPF_H, BPF_REG_A, BPF_REG_TMP,
+					    offsetof(struct net_device, type));
+		}
+		break;
+
+	case BPF_S_ANC_MARK:
+		BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, mark) != 4);
+		*insn = BPF_LDX_MEM(BPF_W, BPF_REG_A, BPF_REG_CTX,
+				    offsetof(struct sk_buff, mark));
+		break;
+
+	case BPF_S_ANC_RXHASH:
+		BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, rxhash) != 4);
+		*insn = BPF_LDX_MEM(BPF_W, BPF_REG_A, BPF_REG_CTX,
+				    offsetof(struct sk_buff, rxhash));
+		break;
+
+	case BPF_S_ANC_QUEUE:
+		BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, queue_mapping) != 2);
+		*insn = BPF_LDX_MEM(BPF_H, BPF_REG_A, BPF_REG_CTX,
+				    offsetof(struct sk_buff, queue_mapping));
+		break;
+
+	case BPF_S_ANC_NLATTR:
+	case BPF_S_ANC_NLATTR_NEST:
+	case BPF_S_ANC_CPU:
+		/* arg1 = CTX */
+		*insn++ = BPF_MOV64_REG(BPF_REG_ARG1, BPF_REG_CTX);
+		/* arg2 = A */
+		*insn++ = BPF_MOV64_REG(BPF_REG_ARG2, BPF_REG_A);
+		/* arg3 = X */
+		*insn++ = BPF_MOV64_REG(BPF_REG_ARG3, BPF_REG_X);
+		/* Emit call(arg1=CTX, arg2=A, arg3=X) */
+		switch (fp->code) {
+		case BPF_S_ANC_NLATTR:
+			*insn = BPF_EMIT_CALL(__skb_get_nlattr);
+			break;
+		case BPF_S_ANC_NLATTR_NEST:
+			*insn = BPF_EMIT_CALL(__skb_get_nlattr_nest);
+			break;
+		case BPF_S_ANC_CPU:
+			*insn = BPF_EMIT_CALL(__get_raw_cpu_id);
+			break;
+		}
+		break;
+
+	case BPF_S_ANC_ALU_XOR_X:
+		/* A ^= X */
+		*insn = BPF_ALU32_REG(BPF_XOR, BPF_REG_A, BPF_REG_X);
+		break;
+
+	default:
+		/* This is just a dummy call to avoid letting the compiler
+		 * evict __bpf_call_base() as an optimization. Placed here
+		 * where no-one bothers.
+		 */
+		BUG_ON(__bpf_call_base(0, 0, 0, 0, 0) != 0);
+		return false;
+	}
+
+	*insnp = insn;
+	return true;
+}
+
+/* A jump offset from the instruction emitted at @insn, part of classic
+ * instruction @i, to the start of classic instruction @target.
+ */
+static int convert_jmp_off(const int *addrs, int i, int target,
+			   const struct bpf_insn *insn,
+			   const struct bpf_insn *tmp_insns)
+{
+	return addrs[target] - addrs[i] - (insn - tmp_insns) - 1;
+}
+
+/**
+ *	sk_convert_filter - convert filter program
+ *	@prog: the checked classic program, see sk_chk_filter()
+ *	@len: the length of the classic program
+ *	@new_prog: buffer where the converted program will be stored
+ *	@new_len: pointer to store length of converted program
+ *
+ * Remap classic BPF to extended BPF with A in R0, X in R7, the context in
+ * R6 and mem[] on the stack.  A and X are kept zero extended by only
+ * using 32 bit operations on them.
+ *
+ * Conversion workflow:
+ *
+ * 1) First pass for calculating the new program length:
+ *   sk_convert_filter(old_prog, old_len, NULL, &new_len)
+ *
+ * 2) 2nd pass to remap in two passes: 1st pass finds new
+ *    jump offsets, 2nd pass remapping:
+ *   new_prog = bpf_prog_alloc(new_len);
+ *   sk_convert_filter(old_prog, old_len, new_prog->insnsi, &new_len);
+ *
+ * Returns -EINVAL for instructions only seccomp filters use.
+ */
+static int sk_convert_filter(struct sock_filter *prog, int len,
+			     struct bpf_insn *new_prog, int *new_len)
+{
+	int new_flen = 0, pass = 0, target, i;
+	struct bpf_insn *new_insn;
+	struct sock_filter *fp;
+	int *addrs = NULL;
+
+	BUILD_BUG_ON(BPF_MEMWORDS * sizeof(u32) > MAX_BPF_STACK);
+	BUILD_BUG_ON(BPF_REG_FP + 1 != MAX_BPF_REG);
+
+	if (len <= 0 || len > BPF_MAXINSNS)
+		return -EINVAL;
+
+	if (new_prog) {
+		addrs = kcalloc(len, sizeof(*addrs), GFP_KERNEL);
+		if (!addrs)
+			return -ENOMEM;
+	}
+
+do_pass:
+	new_insn = new_prog;
+	fp = prog;
+
+	if (new_insn) {
+		/* classic BPF starts with A = X = 0 */
+		*new_insn++ = BPF_ALU32_REG(BPF_XOR, BPF_REG_A, BPF_REG_A);
+		*new_insn++ = BPF_ALU32_REG(BPF_XOR, BPF_REG_X, BPF_REG_X);
+		/* the context stays in R6 for LD_ABS/LD_IND */
+		*new_insn = BPF_MOV64_REG(BPF_REG_CTX, BPF_REG_ARG1);
+	}
+	new_insn += 3;
+
+	for (i = 0; i < len; fp++, i++) {
+		struct bpf_insn tmp_insns[6] = { };
+		struct bpf_insn *insn = tmp_insns;
+		bool big_k = fp->k >= (1U << 31);
+
+		if (addrs)
+			addrs[i] = new_insn - new_prog;
+
+		switch (fp->code) {
+		/* All arithmetic insns and skb loads map as-is. */
+		case BPF_S_ALU_ADD_X:
+		case BPF_S_ALU_ADD_K:
+		case BPF_S_ALU_SUB_X:
+		case BPF_S_ALU_SUB_K:
+		case BPF_S_ALU_AND_X:
+		case BPF_S_ALU_AND_K:
+		case BPF_S_ALU_OR_X:
+		case BPF_S_ALU_OR_K:
+		case BPF_S_ALU_LSH_X:
+		case BPF_S_ALU_LSH_K:
+		case BPF_S_ALU_RSH_X:
+		case BPF_S_ALU_RSH_K:
+		case BPF_S_ALU_MUL_X:
+		case BPF_S_ALU_MUL_K:
+		case BPF_S_ALU_DIV_X:
+		case BPF_S_ALU_NEG:
+		case BPF_S_LD_W_ABS:
+		case BPF_S_LD_H_ABS:
+		case BPF_S_LD_B_ABS:
+		case BPF_S_LD_W_IND:
+		case BPF_S_LD_H_IND:
+		case BPF_S_LD_B_IND:
+			switch (fp->code) {
+			case BPF_S_ALU_ADD_X:
+				*insn = BPF_ALU32_REG(BPF_ADD, BPF_REG_A, BPF_REG_X);
+				break;
+			case BPF_S_ALU_ADD_K:
+				*insn = BPF_ALU32_IMM(BPF_ADD, BPF_REG_A, fp->k);
+				break;
+			case BPF_S_ALU_SUB_X:
+				*insn = BPF_ALU32_REG(BPF_SUB, BPF_REG_A, BPF_REG_X);
+				break;
+			case BPF_S_ALU_SUB_K:
+				*insn = BPF_ALU32_IMM(BPF_SUB, BPF_REG_A, fp->k);
+				break;
+			case BPF_S_ALU_AND_X:
+				*insn = BPF_ALU32_REG(BPF_AND, BPF_REG_A, BPF_REG_X);
+				break;
+			case BPF_S_ALU_AND_K:
+				*insn = BPF_ALU32_IMM(BPF_AND, BPF_REG_A, fp->k);
+				break;
+			case BPF_S_ALU_OR_X:
+				*insn = BPF_ALU32_REG(BPF_OR, BPF_REG_A, BPF_REG_X);
+				break;
+			case BPF_S_ALU_OR_K:
+				*insn = BPF_ALU32_IMM(BPF_OR, BPF_REG_A, fp->k);
+				break;
+			case BPF_S_ALU_LSH_X:
+				*insn = BPF_ALU32_REG(BPF_LSH, BPF_REG_A, BPF_REG_X);
+				break;
+			case BPF_S_ALU_LSH_K:
+				*insn = BPF_ALU32_IMM(BPF_LSH, BPF_REG_A, fp->k);
+				break;
+			case BPF_S_ALU_RSH_X:
+				*insn = BPF_ALU32_REG(BPF_RSH, BPF_REG_A, BPF_REG_X);
+				break;
+			case BPF_S_ALU_RSH_K:
+				*insn = BPF_ALU32_IMM(BPF_RSH, BPF_REG_A, fp->k);
+				break;
+			case BPF_S_ALU_MUL_X:
+				*insn = BPF_ALU32_REG(BPF_MUL, BPF_REG_A, BPF_REG_X);
+				break;
+			case BPF_S_ALU_MUL_K:
+				*insn = BPF_ALU32_IMM(BPF_MUL, BPF_REG_A, fp->k);
+				break;
+			case BPF_S_ALU_DIV_X:
+				/* X == 0 ends the program with 0, as in sk_run_filter() */
+				*insn = BPF_ALU32_REG(BPF_DIV, BPF_REG_A, BPF_REG_X);
+				break;
+			case BPF_S_ALU_NEG:
+				*insn = BPF_ALU32_IMM(BPF_NEG, BPF_REG_A, 0);
+				break;
+			case BPF_S_LD_W_ABS:
+				*insn = BPF_LD_ABS(BPF_W, fp->k);
+				break;
+			case BPF_S_LD_H_ABS:
+				*insn = BPF_LD_ABS(BPF_H, fp->k);
+				break;
+			case BPF_S_LD_B_ABS:
+				*insn = BPF_LD_ABS(BPF_B, fp->k);
+				break;
+			case BPF_S_LD_W_IND:
+				*insn = BPF_LD_IND(BPF_W, BPF_REG_X, fp->k);
+				break;
+			case BPF_S_LD_H_IND:
+				*insn = BPF_LD_IND(BPF_H, BPF_REG_X, fp->k);
+				break;
+			case BPF_S_LD_B_IND:
+				*insn = BPF_LD_IND(BPF_B, BPF_REG_X, fp->k);
+				break;
+			}
+			break;
+
+		case BPF_S_ALU_DIV_K:
+			/* sk_chk_filter() replaced K by its reciprocal,
+			 * A = ((u64) A * K) >> 32 as in reciprocal_divide()
+			 */
+			*insn++ = BPF_MOV32_IMM(BPF_REG_TMP, fp->k);
+			*insn++ = BPF_ALU64_REG(BPF_MUL, BPF_REG_A, BPF_REG_TMP);
+			*insn = BPF_ALU64_IMM(BPF_RSH, BPF_REG_A, 32);
+			break;
+
+		/* Jump transformation cannot use BPF block macros
+		 * everywhere as offset calculation and target updates
+		 * require a bit more work than the rest, i.e. jump
+		 * opcodes map as-is, but offsets need adjustment.
+		 */
+		case BPF_S_JMP_JA:
+			target = i + fp->k + 1;
+			insn->code = BPF_JMP | BPF_JA;
+			insn->off = addrs ? convert_jmp_off(addrs, i, target,
+							    insn, tmp_insns) : 0;
+			break;
+
+		case BPF_S_JMP_JEQ_K:
+		case BPF_S_JMP_JEQ_X:
+		case BPF_S_JMP_JSET_K:
+		case BPF_S_JMP_JSET_X:
+		case BPF_S_JMP_JGT_K:
+		case BPF_S_JMP_JGT_X:
+		case BPF_S_JMP_JGE_K:
+		case BPF_S_JMP_JGE_X: {
+			bool is_k = false;
+			u8 op = 0;
+
+			switch (fp->code) {
+			case BPF_S_JMP_JEQ_K:
+				is_k = true;
+			case BPF_S_JMP_JEQ_X:
+				op = BPF_JEQ;
+				break;
+			case BPF_S_JMP_JSET_K:
+				is_k = true;
+			case BPF_S_JMP_JSET_X:
+				op = BPF_JSET;
+				break;
+			case BPF_S_JMP_JGT_K:
+				is_k = true;
+			case BPF_S_JMP_JGT_X:
+				op = BPF_JGT;
+				break;
+			case BPF_S_JMP_JGE_K:
+				is_k = true;
+			case BPF_S_JMP_JGE_X:
+				op = BPF_JGE;
+				break;
+			}
+
+			if (is_k && big_k) {
+				/* extended BPF sign extends imm, compare
+				 * against a zero extended copy in TMP instead
+				 */
+				*insn++ = BPF_MOV32_IMM(BPF_REG_TMP, fp->k);
+				is_k = false;
+				insn->src_reg = BPF_REG_TMP;
+			} else if (is_k) {
+				insn->imm = fp->k;
+			} else {
+				insn->src_reg = BPF_REG_X;
+			}
+			insn->dst_reg = BPF_REG_A;
+
+			/* Common case where 'jump_false' is next insn. */
+			if (fp->jf == 0) {
+				insn->code = BPF_JMP | op | (is_k ? BPF_K : BPF_X);
+				target = i + fp->jt + 1;
+				insn->off = addrs ? convert_jmp_off(addrs, i,
+					target, insn, tmp_insns) : 0;
+				break;
+			}
+
+			/* Convert JEQ into JNE when 'jump_true' is next insn. */
+			if (fp->jt == 0 && op == BPF_JEQ) {
+				insn->code = BPF_JMP | BPF_JNE |
+					     (is_k ? BPF_K : BPF_X);
+				target = i + fp->jf + 1;
+				insn->off = addrs ? convert_jmp_off(addrs, i,
+					target, insn, tmp_insns) : 0;
+				break;
+			}
+
+			/* Other jumps are mapped into two insns: Jxx and JA. */
+			target = i + fp->jt + 1;
+			insn->code = BPF_JMP | op | (is_k ? BPF_K : BPF_X);
+			insn->off = addrs ? convert_jmp_off(addrs, i, target,
+							    insn, tmp_insns) : 0;
+			insn++;
+
+			insn->code = BPF_JMP | BPF_JA;
+			target = i + fp->jf + 1;
+			insn->off = addrs ? convert_jmp_off(addrs, i, target,
+							    insn, tmp_insns) : 0;
+			break;
+		}
+
+		/* ldxb 4 * ([14] & 0xf) is remaped into 6 insns. */
+		case BPF_S_LDX_B_MSH:
+			/* tmp = A */
+			*insn++ = BPF_MOV64_REG(BPF_REG_TMP, BPF_REG_A);
+			/* A = BPF_R0 = *(u8 *) (skb->data + K) */
+			*insn++ = BPF_LD_ABS(BPF_B, fp->k);
+			/* A &= 0xf */
+			*insn++ = BPF_ALU32_IMM(BPF_AND, BPF_REG_A, 0xf);
+			/* A <<= 2 */
+			*insn++ = BPF_ALU32_IMM(BPF_LSH, BPF_REG_A, 2);
+			/* X = A */
+			*insn++ = BPF_MOV64_REG(BPF_REG_X, BPF_REG_A);
+			/* A = tmp */
+			*insn = BPF_MOV64_REG(BPF_REG_A, BPF_REG_TMP);
+			break;
+
+		/* RET_K, RET_A are remaped into 2 insns. */
+		case BPF_S_RET_A:
+		case BPF_S_RET_K:
+			if (fp->code == BPF_S_RET_K)
+				*insn++ = BPF_MOV32_IMM(BPF_REG_A, fp->k);
+			*insn = BPF_EXIT_INSN();
+			break;
+
+		/* Store to stack. */
+		case BPF_S_ST:
+		case BPF_S_STX:
+			*insn = BPF_STX_MEM(BPF_W, BPF_REG_FP,
+					    fp->code == BPF_S_ST ?
+					    BPF_REG_A : BPF_REG_X,
+					    BPF_MEM_OFF(fp->k));
+			break;
+
+		/* Load from stack. */
+		case BPF_S_LD_MEM:
+		case BPF_S_LDX_MEM:
+			*insn = BPF_LDX_MEM(BPF_W, fp->code == BPF_S_LD_MEM ?
+					    BPF_REG_A : BPF_REG_X, BPF_REG_FP,
+					    BPF_MEM_OFF(fp->k));
+			break;
+
+		/* A = K or X = K */
+		case BPF_S_LD_IMM:
+		case BPF_S_LDX_IMM:
+			*insn = BPF_MOV32_IMM(fp->code == BPF_S_LD_IMM ?
+					      BPF_REG_A : BPF_REG_X, fp->k);
+			break;
+
+		/* X = A */
+		case BPF_S_MISC_TAX:
+			*insn = BPF_MOV64_REG(BPF_REG_X, BPF_REG_A);
+			break;
+
+		/* A = X */
+		case BPF_S_MISC_TXA:
+			*insn = BPF_MOV64_REG(BPF_REG_A, BPF_REG_X);
+			break;
+
+		/* A = skb->len or X = skb->len */
+		case BPF_S_LD_W_LEN:
+		case BPF_S_LDX_W_LEN:
+			*insn = BPF_LDX_MEM(BPF_W, fp->code == BPF_S_LD_W_LEN ?
+					    BPF_REG_A : BPF_REG_X, BPF_REG_CTX,
+					    offsetof(struct sk_buff, len));
+			break;
+
+		/* Access seccomp_data fields, or unknown instructions. */
+		default:
+			if (convert_bpf_extensions(fp, &insn))
+				break;
+			kfree(addrs);
+			return -EINVAL;
+		}
+
+		insn++;
+		if (new_prog)
+			memcpy(new_insn, tmp_insns,
+			       sizeof(*insn) * (insn - tmp_insns));
+		new_insn += insn - tmp_insns;
+	}
+
+	if (!new_prog) {
+		/* Only calculating new length. */
+		*new_len = new_insn - new_prog;
+		return 0;
+	}
+
+	pass++;
+	if (new_flen != new_insn - new_prog) {
+		new_flen = new_insn - new_prog;
+		if (pass > 2)
+			goto err;
+		goto do_pass;
+	}
+
+	kfree(addrs);
+	BUG_ON(*new_len != new_flen);
+	return 0;
+err:
+	kfree(addrs);
+	return -EINVAL;
+}
+
+/* bpf_func of filters that run an extended BPF program, either converted
+ * from the classic instructions or attached with SO_ATTACH_BPF
+ */
+static unsigned int sk_run_filter_prog(const struct sk_buff *skb,
+				       const struct sock_filter *insns)
+{
+	const struct sk_filter *fp = (const void *)insns -
+				     offsetof(struct sk_filter, insns);
+
+	return bpf_prog_run(fp->prog, (void *)skb);
+}
+
 /*
  * Security :
  * A BPF program is able to use 16 cells of memory to store intermediate
@@ -602,22 +1150,54 @@ void sk_filter_release_rcu(struct rcu_head *rcu)
 {
 	struct sk_filter *fp = container_of(rcu, struct sk_filter, rcu);
 
-	bpf_jit_free(fp);
+	if (fp->prog)
+		bpf_prog_put(fp->prog);
+	else
+		bpf_jit_free(fp);
 	kfree(fp);
 }
 EXPORT_SYMBOL(sk_filter_release_rcu);
 
+/* Translate a classic filter the JIT did not take to extended BPF.  Any
+ * failure leaves it to sk_run_filter(), which handles everything.
+ */
+static void sk_convert_to_prog(struct sk_filter *fp)
+{
+	struct bpf_prog *prog;
+	int new_len, err;
+
+	err = sk_convert_filter(fp->insns, fp->len, NULL, &new_len);
+	if (err)
+		return;
+
+	prog = bpf_prog_alloc(new_len);
+	if (!prog)
+		return;
+
+	err = sk_convert_filter(fp->insns, fp->len, prog->insnsi, &new_len);
+	if (err) {
+		bpf_prog_free(prog);
+		return;
+	}
+
+	fp->prog = prog;
+	fp->bpf_func = sk_run_filter_prog;
+}
+
 static int __sk_prepare_filter(struct sk_filter *fp)
 {
 	int err;
 
 	fp->bpf_func = sk_run_filter;
+	fp->prog = NULL;
 
 	err = sk_chk_filter(fp->insns, fp->len);
 	if (err)
 		return err;
 
 	bpf_jit_compile(fp);
+	if (fp->bpf_func == sk_run_filter)
+		sk_convert_to_prog(fp);
 	return 0;
 }
 
@@ -715,6 +1295,49 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 }
 EXPORT_SYMBOL_GPL(sk_attach_filter);
 
+/**
+ *	sk_attach_bpf - attach an extended BPF program as socket filter
+ *	@ufd: file descriptor of a BPF_PROG_TYPE_SOCKET_FILTER program
+ *	@sk: the socket to use
+ *
+ * The program was verified when it was loaded with bpf(BPF_PROG_LOAD),
+ * the filter takes a reference to it and replaces any previous filter.
+ */
+int sk_attach_bpf(u32 ufd, struct sock *sk)
+{
+	struct sk_filter *fp, *old_fp;
+	struct bpf_prog *prog;
+
+	prog = bpf_prog_get(ufd);
+	if (IS_ERR(prog))
+		return PTR_ERR(prog);
+
+	if (prog->type != BPF_PROG_TYPE_SOCKET_FILTER) {
+		bpf_prog_put(prog);
+		return -EINVAL;
+	}
+
+	fp = sock_kmalloc(sk, sizeof(*fp), GFP_KERNEL);
+	if (!fp) {
+		bpf_prog_put(prog);
+		return -ENOMEM;
+	}
+
+	atomic_set(&fp->refcnt, 1);
+	fp->len = 0;
+	fp->bpf_func = sk_run_filter_prog;
+	fp->prog = prog;
+
+	old_fp = rcu_dereference_protected(sk->sk_filter,
+					   sock_owned_by_user(sk));
+	rcu_assign_pointer(sk->sk_filter, fp);
+
+	if (old_fp)
+		sk_filter_uncharge(sk, old_fp);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(sk_attach_bpf);
+
 int sk_detach_filter(struct sock *sk)
 {
 	int ret = -ENOENT;
@@ -730,3 +1353,132 @@ int sk_detach_filter(struct sock *sk)
 	return ret;
 }
 EXPORT_SYMBOL_GPL(sk_detach_filter);
+
+#ifdef CONFIG_BPF_SYSCALL
+static const struct bpf_func_proto *
+sk_filter_func_proto(enum bpf_func_id func_id)
+{
+	switch (func_id) {
+	case BPF_FUNC_map_lookup_elem:
+		return &bpf_map_lookup_elem_proto;
+	case BPF_FUNC_map_update_elem:
+		return &bpf_map_update_elem_proto;
+	case BPF_FUNC_map_delete_elem:
+		return &bpf_map_delete_elem_proto;
+	case BPF_FUNC_get_smp_processor_id:
+		return &bpf_get_smp_processor_id_proto;
+	default:
+		return NULL;
+	}
+}
+
+static bool sk_filter_is_valid_access(int off, int size,
+				      enum bpf_access_type type)
+{
+	/* only read is allowed */
+	if (type != BPF_READ)
+		return false;
+
+	/* check bounds */
+	if (off < 0 || off >= sizeof(struct __sk_buff))
+		return false;
+
+	/* disallow misaligned access */
+	if (off % size != 0)
+		return false;
+
+	/* all __sk_buff fields are __u32 */
+	if (size != 4)
+		return false;
+
+	return true;
+}
+
+static u32 sk_filter_convert_ctx_access(int dst_reg, int src_reg, int ctx_off,
+					struct bpf_insn *insn_buf)
+{
+	struct bpf_insn *insn = insn_buf;
+
+	switch (ctx_off) {
+	case offsetof(struct __sk_buff, len):
+		BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, len) != 4);
+
+		*insn++ = BPF_LDX_MEM(BPF_W, dst_reg, src_reg,
+				      offsetof(struct sk_buff, len));
+		break;
+
+	case offsetof(struct __sk_buff, mark):
+		BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, mark) != 4);
+
+		*insn++ = BPF_LDX_MEM(BPF_W, dst_reg, src_reg,
+				      offsetof(struct sk_buff, mark));
+		break;
+
+	case offsetof(struct __sk_buff, priority):
+		BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, priority) != 4);
+
+		*insn++ = BPF_LDX_MEM(BPF_W, dst_reg, src_reg,
+				      offsetof(struct sk_buff, priority));
+		break;
+
+	case offsetof(struct __sk_buff, pkt_type):
+		*insn++ = BPF_LDX_MEM(BPF_B, dst_reg, src_reg,
+				      PKT_TYPE_OFFSET());
+		*insn++ = BPF_ALU32_IMM(BPF_AND, dst_reg, PKT_TYPE_MAX);
+#ifdef __BIG_ENDIAN_BITFIELD
+		*insn++ = BPF_ALU32_IMM(BPF_RSH, dst_reg, 5);
+#endif
+		break;
+
+	case offsetof(struct __sk_buff, queue_mapping):
+		BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, queue_mapping) != 2);
+
+		*insn++ = BPF_LDX_MEM(BPF_H, dst_reg, src_reg,
+				      offsetof(struct sk_buff, queue_mapping));
+		break;
+
+	case offsetof(struct __sk_buff, protocol):
+		BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, protocol) != 2);
+
+		*insn++ = BPF_LDX_MEM(BPF_H, dst_reg, src_reg,
+				      offsetof(struct sk_buff, protocol));
+		break;
+
+	case offsetof(struct __sk_buff, vlan_present):
+	case offsetof(struct __sk_buff, vlan_tci):
+		BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, vlan_tci) != 2);
+		BUILD_BUG_ON(VLAN_TAG_PRESENT != 0x1000);
+
+		*insn++ = BPF_LDX_MEM(BPF_H, dst_reg, src_reg,
+				      offsetof(struct sk_buff, vlan_tci));
+		if (ctx_off == offsetof(struct __sk_buff, vlan_tci)) {
+			*insn++ = BPF_ALU32_IMM(BPF_AND, dst_reg,
+						~VLAN_TAG_PRESENT);
+		} else {
+			*insn++ = BPF_ALU32_IMM(BPF_RSH, dst_reg, 12);
+			*insn++ = BPF_ALU32_IMM(BPF_AND, dst_reg, 1);
+		}
+		break;
+	}
+
+	return insn - insn_buf;
+}
+
+static const struct bpf_verifier_ops sk_filter_ops = {
+	.get_func_proto = sk_filter_func_proto,
+	.is_valid_access = sk_filter_is_valid_access,
+	.convert_ctx_access = sk_filter_convert_ctx_access,
+};
+
+static struct bpf_prog_type_list sk_filter_type __read_mostly = {
+	.ops = &sk_filter_ops,
+	.type = BPF_PROG_TYPE_SOCKET_FILTER,
+};
+
+static int __init register_sk_filter_ops(void)
+{
+	bpf_register_prog_type(&sk_filter_type);
+	return 0;
+}
+late_initcall(register_sk_filter_ops);
+#endif /* CONFIG_BPF_SYSCALL */
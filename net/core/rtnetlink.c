@@ -763,6 +763,15 @@ static size_t rtnl_port_size(const struct net_device *dev)
 		return port_self_size;
 }
 
+static size_t rtnl_rx_filter_size(const struct net_device *dev)
+{
+	struct sk_filter *fp = rtnl_dereference(dev->rx_filter);
+
+	if (!fp)
+		return 0;
+	return nla_total_size(fp->len * sizeof(struct sock_filter));
+}
+
 static noinline size_t if_nlmsg_size(const struct net_device *dev,
 				     u32 ext_filter_mask)
 {
@@ -789,6 +798,7 @@ static noinline size_t if_nlmsg_size(const struct net_device *dev,
 			        & RTEXT_FILTER_VF ? 4 : 0) /* IFLA_NUM_VF */
 	       + rtnl_vfinfo_size(dev, ext_filter_mask) /* IFLA_VFINFO_LIST */
 	       + rtnl_port_size(dev) /* IFLA_VF_PORTS + IFLA_PORT_SELF */
+	       + rtnl_rx_filter_size(dev) /* IFLA_RX_FILTER */
 	       + rtnl_link_get_size(dev) /* IFLA_LINKINFO */
 	       + rtnl_link_get_af_size(dev); /* IFLA_AF_SPEC */
 }
@@ -879,6 +889,7 @@ static int rtnl_fill_ifinfo(struct sk_buff *skb, struct net_device *dev,
 	const struct rtnl_link_stats64 *stats;
 	struct nlattr *attr, *af_spec;
 	struct rtnl_af_ops *af_ops;
+	struct sk_filter *fp;
 
 	ASSERT_RTNL();
 	nlh = nlmsg_put(skb, pid, seq, type, sizeof(*ifm), flags);
@@ -915,6 +926,11 @@ static int rtnl_fill_ifinfo(struct sk_buff *skb, struct net_device *dev,
 	     nla_put_string(skb, IFLA_IFALIAS, dev->ifalias)))
 		goto nla_put_failure;
 
+	fp = rtnl_dereference(dev->rx_filter);
+	if (fp && nla_put(skb, IFLA_RX_FILTER,
+			  fp->len * sizeof(struct sock_filter), fp->insns))
+		goto nla_put_failure;
+
 	if (1) {
 		struct rtnl_link_ifmap map = {
 			.mem_start   = dev->mem_start,
@@ -1124,6 +1140,7 @@ const struct nla_policy ifla_policy[IFLA_MAX+1] = {
 	[IFLA_PROMISCUITY]	= { .type = NLA_U32 },
 	[IFLA_NUM_TX_QUEUES]	= { .type = NLA_U32 },
 	[IFLA_NUM_RX_QUEUES]	= { .type = NLA_U32 },
+	[IFLA_RX_FILTER]	= { .type = NLA_BINARY },
 };
 EXPORT_SYMBOL(ifla_policy);
 
@@ -1303,6 +1320,32 @@ static int do_set_master(struct net_device *dev, int ifindex)
 	return 0;
 }
 
+/* IFLA_RX_FILTER carries struct sock_filter[], empty to detach */
+static int do_set_rx_filter(struct net_device *dev, const struct nlattr *attr)
+{
+	struct sk_filter *fp = NULL;
+	struct sock_fprog fprog;
+	int len = nla_len(attr);
+	int err;
+
+	if (!(dev->priv_flags & IFF_RX_FILTER))
+		return -EOPNOTSUPP;
+
+	if (len) {
+		if (len % sizeof(struct sock_filter))
+			return -EINVAL;
+
+		fprog.len = len / sizeof(struct sock_filter);
+		fprog.filter = nla_data(attr);
+		err = sk_unattached_filter_create(&fp, &fprog);
+		if (err)
+			return err;
+	}
+
+	dev_set_rx_filter(dev, fp);
+	return 0;
+}
+
 static int do_setlink(struct net_device *dev, struct ifinfomsg *ifm,
 		      struct nlattr **tb, char *ifname, int modified)
 {
@@ -1396,6 +1439,13 @@ static int do_setlink(struct net_device *dev, struct ifinfomsg *ifm,
 		modified = 1;
 	}
 
+	if (tb[IFLA_RX_FILTER]) {
+		err = do_set_rx_filter(dev, tb[IFLA_RX_FILTER]);
+		if (err < 0)
+			goto errout;
+		modified = 1;
+	}
+
 	/*
 	 * Interface selected by interface index but interface
 	 * name provided implies that a name change has been
@@ -46,6 +46,43 @@
 #include <net/rtnetlink.h>
 #include <net/xfrm.h>
 
+#ifdef CONFIG_IP_FIB_TRIE_DIR
+static bool fib_dir_selected(struct net *net, u32 id)
+{
+	int i;
+
+	for (i = 0; i < FIB_DIR_MAX_TABLES; i++)
+		if (net->ipv4.sysctl_fib_dir_tables[i] == id)
+			return true;
+	return false;
+}
+
+/*
+ * Give the tables listed in net.ipv4.fib_dir_tables direct lookup arrays
+ * and take them away from all others.  Caller must hold RTNL.
+ */
+int fib_dir_select_tables(struct net *net)
+{
+	struct fib_table *tb;
+	struct hlist_node *node;
+	struct hlist_head *head;
+	unsigned int h;
+	int err = 0;
+
+	for (h = 0; h < FIB_TABLE_HASHSZ; h++) {
+		head = &net->ipv4.fib_table_hash[h];
+		hlist_for_each_entry(tb, node, head, tb_hlist) {
+			int ret = fib_table_set_dir(tb,
+					fib_dir_selected(net, tb->tb_id));
+
+			if (ret && !err)
+				err = ret;
+		}
+	}
+	return err;
+}
+#endif
+
 #ifndef CONFIG_IP_MULTIPLE_TABLES
 
 static int __net_init fib4_rules_init(struct net *net)
@@ -87,6 +124,13 @@ struct fib_table *fib_new_table(struct net *net, u32 id)
 	if (!tb)
 		return NULL;
 
+#ifdef CONFIG_IP_FIB_TRIE_DIR
+	/* the arrays are allocated even for an empty table */
+	if (fib_table_set_dir(tb, fib_dir_selected(net, id)))
+		pr_warn("fib_trie: no memory for direct lookup table of "
+			"table %u, falling back to the trie\n", id);
+#endif
+
 	switch (id) {
 	case RT_TABLE_LOCAL:
 		net->ipv4.fib_local = tb;
@@ -131,6 +175,7 @@ struct fib_table *fib_get_table(struct net *net, u32 id)
 	rcu_read_unlock();
 	return NULL;
 }
+EXPORT_SYMBOL_GPL(fib_get_table);
 #endif /* CONFIG_IP_MULTIPLE_TABLES */
 
 static void fib_flush(struct net *net)
@@ -71,6 +71,7 @@
 #include <linux/init.h>
 #include <linux/list.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <linux/prefetch.h>
 #include <linux/export.h>
 #include <net/net_namespace.h>
@@ -152,8 +153,42 @@ struct trie_stat {
 	unsigned int nodesizes[MAX_STAT_DEPTH];
 };
 
+#ifdef CONFIG_IP_FIB_TRIE_DIR
+/*
+ * Direct lookup tables (DIR-16-8-8).
+ *
+ * A table selected with net.ipv4.fib_dir_tables gets a multibit array
+ * next to its trie, indexed by the destination: 16 bits in the root,
+ * then 8 and 8 bits in chunks of 256 slots.  A slot holds the leaf_info
+ * of the longest prefix covering it, or a tagged pointer to the chunk
+ * resolving the next 8 bits, so a lookup is at most three dependent
+ * loads instead of a tnode walk.  The trie stays authoritative: the
+ * arrays are updated incrementally under RTNL whenever a prefix appears
+ * or disappears, with single word stores, so RCU readers see either the
+ * old or the new leaf_info of a slot.
+ */
+#define FIB_DIR_CHUNK	1UL	/* slot tag: points to a fib_dir_chunk */
+#define FIB_DIR_LEVELS	3
+
+static const u8 fib_dir_start[FIB_DIR_LEVELS] = { 0, 16, 24 };
+static const u8 fib_dir_bits[FIB_DIR_LEVELS] = { 16, 8, 8 };
+
+struct fib_dir_chunk {
+	unsigned long slot[256];
+	struct rcu_head rcu;
+};
+
+struct fib_dir {
+	unsigned int chunks;
+	unsigned long root[1 << 16];
+};
+#endif
+
 struct trie {
 	struct rt_trie_node __rcu *trie;
+#ifdef CONFIG_IP_FIB_TRIE_DIR
+	struct fib_dir __rcu *dir;
+#endif
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 	struct trie_use_stats stats;
 #endif
@@ -177,6 +212,9 @@ static const int sync_pages = 128;
 
 static struct kmem_cache *fn_alias_kmem __read_mostly;
 static struct kmem_cache *trie_leaf_kmem __read_mostly;
+#ifdef CONFIG_IP_FIB_TRIE_DIR
+static struct kmem_cache *fib_dir_kmem __read_mostly;
+#endif
 
 /*
  * caller must hold RTNL
@@ -1177,6 +1215,223 @@ done:
 	return fa_head;
 }
 
+#ifdef CONFIG_IP_FIB_TRIE_DIR
+static inline struct fib_dir_chunk *fib_dir_chunk_of(unsigned long v)
+{
+	return (struct fib_dir_chunk *)(v & ~FIB_DIR_CHUNK);
+}
+
+static inline void fib_dir_set(unsigned long *slot, unsigned long v)
+{
+	/* what v points to must be visible before v is */
+	smp_wmb();
+	ACCESS_ONCE(*slot) = v;
+}
+
+static void fib_dir_chunk_free_rcu(struct rcu_head *head)
+{
+	struct fib_dir_chunk *c = container_of(head, struct fib_dir_chunk, rcu);
+
+	kmem_cache_free(fib_dir_kmem, c);
+}
+
+/* Fold a chunk whose slots all hold the same leaf_info into its parent */
+static void fib_dir_collapse(struct fib_dir *dir, unsigned long *slot)
+{
+	struct fib_dir_chunk *c = fib_dir_chunk_of(*slot);
+	unsigned long v = c->slot[0];
+	int i;
+
+	if (v & FIB_DIR_CHUNK)
+		return;
+
+	for (i = 1; i < 256; i++)
+		if (c->slot[i] != v)
+			return;
+
+	fib_dir_set(slot, v);
+	call_rcu(&c->rcu, fib_dir_chunk_free_rcu);
+	dir->chunks--;
+}
+
+/*
+ * Adding a prefix takes over the slots held by shorter prefixes, removing
+ * one (old != NULL) hands its slots to the next shorter covering prefix.
+ */
+static inline bool fib_dir_replaces(unsigned long v, int plen,
+				    const struct leaf_info *old)
+{
+	if (old)
+		return v == (unsigned long)old;
+
+	return !v || ((struct leaf_info *)v)->plen < plen;
+}
+
+/* Update a slot the prefix covers entirely, including any chunks below */
+static void fib_dir_fill_slot(struct fib_dir *dir, unsigned long *slot,
+			      int plen, const struct leaf_info *old,
+			      struct leaf_info *new)
+{
+	unsigned long v = *slot;
+	int i;
+
+	if (v & FIB_DIR_CHUNK) {
+		struct fib_dir_chunk *c = fib_dir_chunk_of(v);
+
+		for (i = 0; i < 256; i++)
+			fib_dir_fill_slot(dir, &c->slot[i], plen, old, new);
+		fib_dir_collapse(dir, slot);
+	} else if (fib_dir_replaces(v, plen, old)) {
+		fib_dir_set(slot, (unsigned long)new);
+	}
+}
+
+static int fib_dir_fill(struct fib_dir *dir, unsigned long *tbl, int level,
+			t_key key, int plen, const struct leaf_info *old,
+			struct leaf_info *new)
+{
+	unsigned int start = fib_dir_start[level];
+	unsigned int bits = fib_dir_bits[level];
+	t_key idx = tkey_extract_bits(key, start, bits);
+	struct fib_dir_chunk *c;
+	unsigned long v;
+	int i, err;
+
+	if (plen <= start + bits) {
+		/* prefix ends at this level and covers a run of slots */
+		for (i = 0; i < 1 << (start + bits - plen); i++)
+			fib_dir_fill_slot(dir, &tbl[idx + i], plen, old, new);
+		return 0;
+	}
+
+	v = tbl[idx];
+	if (v & FIB_DIR_CHUNK) {
+		c = fib_dir_chunk_of(v);
+	} else {
+		/* a longer prefix being removed cannot be below a plain slot */
+		if (old)
+			return 0;
+
+		c = kmem_cache_alloc(fib_dir_kmem, GFP_KERNEL);
+		if (!c)
+			return -ENOMEM;
+		for (i = 0; i < 256; i++)
+			c->slot[i] = v;
+		fib_dir_set(&tbl[idx], (unsigned long)c | FIB_DIR_CHUNK);
+		dir->chunks++;
+	}
+
+	err = fib_dir_fill(dir, c->slot, level + 1, key, plen, old, new);
+	fib_dir_collapse(dir, &tbl[idx]);
+	return err;
+}
+
+static void fib_dir_free_slot(unsigned long v)
+{
+	struct fib_dir_chunk *c;
+	int i;
+
+	if (!(v & FIB_DIR_CHUNK))
+		return;
+
+	c = fib_dir_chunk_of(v);
+	for (i = 0; i < 256; i++)
+		fib_dir_free_slot(c->slot[i]);
+	kmem_cache_free(fib_dir_kmem, c);
+}
+
+/* Readers must be gone, or the arrays never published */
+static void fib_dir_free(struct fib_dir *dir)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(dir->root); i++)
+		fib_dir_free_slot(dir->root[i]);
+	vfree(dir);
+}
+
+static void fib_dir_drop(struct trie *t)
+{
+	struct fib_dir *dir = rtnl_dereference(t->dir);
+
+	RCU_INIT_POINTER(t->dir, NULL);
+	synchronize_rcu();
+	fib_dir_free(dir);
+}
+
+/* Longest prefix shorter than plen covering key */
+static struct leaf_info *fib_dir_covering(struct trie *t, t_key key, int plen)
+{
+	struct leaf_info *li;
+	struct leaf *l;
+
+	while (--plen >= 0) {
+		l = fib_find_node(t, mask_pfx(key, plen));
+		if (l) {
+			li = find_leaf_info(l, plen);
+			if (li)
+				return li;
+		}
+	}
+
+	return NULL;
+}
+
+/* Caller must hold RTNL; li has just been linked into the trie */
+static void fib_dir_insert(struct trie *t, t_key key, struct leaf_info *li)
+{
+	struct fib_dir *dir = rtnl_dereference(t->dir);
+
+	if (!dir)
+		return;
+
+	if (fib_dir_fill(dir, dir->root, 0, key, li->plen, NULL, li)) {
+		pr_warn("fib_trie: no memory for direct lookup table, "
+			"falling back to the trie\n");
+		fib_dir_drop(t);
+	}
+}
+
+/* Caller must hold RTNL; li has just been unlinked from the trie */
+static void fib_dir_remove(struct trie *t, t_key key, struct leaf_info *li)
+{
+	struct fib_dir *dir = rtnl_dereference(t->dir);
+
+	if (!dir)
+		return;
+
+	fib_dir_fill(dir, dir->root, 0, key, li->plen, li,
+		     fib_dir_covering(t, key, li->plen));
+}
+
+/* should be called with rcu_read_lock */
+static inline struct leaf_info *fib_dir_lookup(struct fib_dir *dir, t_key key)
+{
+	unsigned long v = ACCESS_ONCE(dir->root[key >> 16]);
+
+	if (v & FIB_DIR_CHUNK) {
+		smp_read_barrier_depends();
+		v = ACCESS_ONCE(fib_dir_chunk_of(v)->slot[(key >> 8) & 0xff]);
+		if (v & FIB_DIR_CHUNK) {
+			smp_read_barrier_depends();
+			v = ACCESS_ONCE(fib_dir_chunk_of(v)->slot[key & 0xff]);
+		}
+	}
+	smp_read_barrier_depends();
+	return (struct leaf_info *)v;
+}
+#else
+static inline void fib_dir_insert(struct trie *t, t_key key,
+				  struct leaf_info *li)
+{
+}
+
+static inline void fib_dir_remove(struct trie *t, t_key key,
+				  struct leaf_info *li)
+{
+}
+#endif /* CONFIG_IP_FIB_TRIE_DIR */
+
 /*
  * Caller must hold RTNL.
  */
@@ -1191,6 +1446,7 @@ int fib_table_insert(struct fib_table *tb, struct fib_config *cfg)
 	u32 key, mask;
 	int err;
 	struct leaf *l;
+	bool new_li = false;
 
 	if (plen > 32)
 		return -EINVAL;
@@ -1325,6 +1581,7 @@ int fib_table_insert(struct fib_table *tb, struct fib_config *cfg)
 			err = -ENOMEM;
 			goto out_free_new_fa;
 		}
+		new_li = true;
 	}
 
 	if (!plen)
@@ -1333,6 +1590,10 @@ int fib_table_insert(struct fib_table *tb, struct fib_config *cfg)
 	list_add_tail_rcu(&new_fa->fa_list,
 			  (fa ? &fa->fa_list : fa_head));
 
+	if (new_li)
+		fib_dir_insert(t, key,
+			       container_of(fa_head, struct leaf_info, falh));
+
 	rt_cache_flush(cfg->fc_nlinfo.nl_net);
 	rtmsg_fib(RTM_NEWROUTE, htonl(key), new_fa, plen, tb->tb_id,
 		  &cfg->fc_nlinfo, 0);
@@ -1348,67 +1609,79 @@ err:
 }
 
 /* should be called with rcu_read_lock */
-static int check_leaf(struct fib_table *tb, struct trie *t, struct leaf *l,
-		      t_key key,  const struct flowi4 *flp,
-		      struct fib_result *res, int fib_flags)
+static int check_leaf_info(struct fib_table *tb, struct trie *t,
+			   struct leaf_info *li, const struct flowi4 *flp,
+			   struct fib_result *res, int fib_flags)
 {
-	struct leaf_info *li;
-	struct hlist_head *hhead = &l->list;
-	struct hlist_node *node;
+	struct fib_alias *fa;
 
-	hlist_for_each_entry_rcu(li, node, hhead, hlist) {
-		struct fib_alias *fa;
+	list_for_each_entry_rcu(fa, &li->falh, fa_list) {
+		struct fib_info *fi = fa->fa_info;
+		int nhsel, err;
 
-		if (l->key != (key & li->mask_plen))
+		if (fa->fa_tos && fa->fa_tos != flp->flowi4_tos)
 			continue;
-
-		list_for_each_entry_rcu(fa, &li->falh, fa_list) {
-			struct fib_info *fi = fa->fa_info;
-			int nhsel, err;
-
-			if (fa->fa_tos && fa->fa_tos != flp->flowi4_tos)
-				continue;
-			if (fi->fib_dead)
-				continue;
-			if (fa->fa_info->fib_scope < flp->flowi4_scope)
-				continue;
-			fib_alias_accessed(fa);
-			err = fib_props[fa->fa_type].error;
-			if (err) {
+		if (fi->fib_dead)
+			continue;
+		if (fa->fa_info->fib_scope < flp->flowi4_scope)
+			continue;
+		fib_alias_accessed(fa);
+		err = fib_props[fa->fa_type].error;
+		if (err) {
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-				t->stats.semantic_match_passed++;
+			t->stats.semantic_match_passed++;
 #endif
-				return err;
-			}
-			if (fi->fib_flags & RTNH_F_DEAD)
-				continue;
-			for (nhsel = 0; nhsel < fi->fib_nhs; nhsel++) {
-				const struct fib_nh *nh = &fi->fib_nh[nhsel];
+			return err;
+		}
+		if (fi->fib_flags & RTNH_F_DEAD)
+			continue;
+		for (nhsel = 0; nhsel < fi->fib_nhs; nhsel++) {
+			const struct fib_nh *nh = &fi->fib_nh[nhsel];
 
-				if (nh->nh_flags & RTNH_F_DEAD)
-					continue;
-				if (flp->flowi4_oif && flp->flowi4_oif != nh->nh_oif)
-					continue;
+			if (nh->nh_flags & RTNH_F_DEAD)
+				continue;
+			if (flp->flowi4_oif && flp->flowi4_oif != nh->nh_oif)
+				continue;
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-				t->stats.semantic_match_passed++;
+			t->stats.semantic_match_passed++;
 #endif
-				res->prefixlen = li->plen;
-				res->nh_sel = nhsel;
-				res->type = fa->fa_type;
-				res->scope = fa->fa_info->fib_scope;
-				res->fi = fi;
-				res->table = tb;
-				res->fa_head = &li->falh;
-				if (!(fib_flags & FIB_LOOKUP_NOREF))
-					atomic_inc(&fi->fib_clntref);
-				return 0;
-			}
+			res->prefixlen = li->plen;
+			res->nh_sel = nhsel;
+			res->type = fa->fa_type;
+			res->scope = fa->fa_info->fib_scope;
+			res->fi = fi;
+			res->table = tb;
+			res->fa_head = &li->falh;
+			if (!(fib_flags & FIB_LOOKUP_NOREF))
+				atomic_inc(&fi->fib_clntref);
+			return 0;
 		}
+	}
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-		t->stats.semantic_match_miss++;
+	t->stats.semantic_match_miss++;
 #endif
+	return 1;
+}
+
+/* should be called with rcu_read_lock */
+static int check_leaf(struct fib_table *tb, struct trie *t, struct leaf *l,
+		      t_key key,  const struct flowi4 *flp,
+		      struct fib_result *res, int fib_flags)
+{
+	struct leaf_info *li;
+	struct hlist_head *hhead = &l->list;
+	struct hlist_node *node;
+	int ret;
+
+	hlist_for_each_entry_rcu(li, node, hhead, hlist) {
+		if (l->key != (key & li->mask_plen))
+			continue;
+
+		ret = check_leaf_info(tb, t, li, flp, res, fib_flags);
+		if (ret <= 0)
+			return ret;
 	}
 
 	return 1;
@@ -1428,9 +1701,28 @@ int fib_table_lookup(struct fib_table *tb, const struct flowi4 *flp,
 	unsigned int current_prefix_length = KEYLENGTH;
 	struct tnode *cn;
 	t_key pref_mismatch;
+#ifdef CONFIG_IP_FIB_TRIE_DIR
+	struct fib_dir *dir;
+	struct leaf_info *li;
+#endif
 
 	rcu_read_lock();
 
+#ifdef CONFIG_IP_FIB_TRIE_DIR
+	dir = rcu_dereference(t->dir);
+	if (dir) {
+		li = fib_dir_lookup(dir, key);
+		if (!li)
+			goto failed;
+
+		ret = check_leaf_info(tb, t, li, flp, res, fib_flags);
+		if (ret <= 0)
+			goto found;
+
+		/* no alias of the longest match fits, let the trie backtrack */
+	}
+#endif
+
 	n = rcu_dereference(t->trie);
 	if (!n)
 		goto failed;
@@ -1701,6 +1993,7 @@ int fib_table_delete(struct fib_table *tb, struct fib_config *cfg)
 
 	if (list_empty(fa_head)) {
 		hlist_del_rcu(&li->hlist);
+		fib_dir_remove(t, key, li);
 		free_leaf_info(li);
 	}
 
@@ -1733,7 +2026,7 @@ static int trie_flush_list(struct list_head *head)
 	return found;
 }
 
-static int trie_flush_leaf(struct leaf *l)
+static int trie_flush_leaf(struct trie *t, struct leaf *l)
 {
 	int found = 0;
 	struct hlist_head *lih = &l->list;
@@ -1745,6 +2038,7 @@ static int trie_flush_leaf(struct leaf *l)
 
 		if (list_empty(&li->falh)) {
 			hlist_del_rcu(&li->hlist);
+			fib_dir_remove(t, l->key, li);
 			free_leaf_info(li);
 		}
 	}
@@ -1832,7 +2126,7 @@ int fib_table_flush(struct fib_table *tb)
 	int found = 0;
 
 	for (l = trie_firstleaf(t); l; l = trie_nextleaf(l)) {
-		found += trie_flush_leaf(l);
+		found += trie_flush_leaf(t, l);
 
 		if (ll && hlist_empty(&ll->list))
 			trie_leaf_remove(t, ll);
@@ -1846,8 +2140,56 @@ int fib_table_flush(struct fib_table *tb)
 	return found;
 }
 
+#ifdef CONFIG_IP_FIB_TRIE_DIR
+/*
+ * Build or drop the direct lookup arrays of a table.
+ * Caller must hold RTNL.
+ */
+int fib_table_set_dir(struct fib_table *tb, bool enable)
+{
+	struct trie *t = (struct trie *) tb->tb_data;
+	struct fib_dir *dir = rtnl_dereference(t->dir);
+	struct hlist_node *node;
+	struct leaf_info *li;
+	struct leaf *l;
+
+	if (!enable) {
+		if (dir)
+			fib_dir_drop(t);
+		return 0;
+	}
+
+	if (dir)
+		return 0;
+
+	dir = vzalloc(sizeof(*dir));
+	if (!dir)
+		return -ENOMEM;
+
+	for (l = trie_firstleaf(t); l; l = trie_nextleaf(l)) {
+		hlist_for_each_entry(li, node, &l->list, hlist) {
+			if (fib_dir_fill(dir, dir->root, 0, l->key, li->plen,
+					 NULL, li)) {
+				fib_dir_free(dir);
+				return -ENOMEM;
+			}
+		}
+	}
+
+	rcu_assign_pointer(t->dir, dir);
+	return 0;
+}
+#endif
+
 void fib_free_table(struct fib_table *tb)
 {
+#ifdef CONFIG_IP_FIB_TRIE_DIR
+	struct trie *t = (struct trie *) tb->tb_data;
+	struct fib_dir *dir = rcu_dereference_protected(t->dir, 1);
+
+	if (dir)
+		fib_dir_free(dir);
+#endif
 	kfree(tb);
 }
 
@@ -1974,6 +2316,11 @@ void __init fib_trie_init(void)
 					   max(sizeof(struct leaf),
 					       sizeof(struct leaf_info)),
 					   0, SLAB_PANIC, NULL);
+#ifdef CONFIG_IP_FIB_TRIE_DIR
+	fib_dir_kmem = kmem_cache_create("ip_fib_dir",
+					 sizeof(struct fib_dir_chunk),
+					 0, SLAB_PANIC, NULL);
+#endif
 }
 
 
@@ -2174,6 +2521,21 @@ static void trie_show_usage(struct seq_file *seq,
 }
 #endif /*  CONFIG_IP_FIB_TRIE_STATS */
 
+#ifdef CONFIG_IP_FIB_TRIE_DIR
+static void fib_dir_show_stats(struct seq_file *seq, struct trie *t)
+{
+	struct fib_dir *dir;
+
+	rcu_read_lock();
+	dir = rcu_dereference(t->dir);
+	if (dir)
+		seq_printf(seq, "\tDirect chunks:  %u (%Zd kB)\n", dir->chunks,
+			   (sizeof(*dir) +
+			    dir->chunks * sizeof(struct fib_dir_chunk)) >> 10);
+	rcu_read_unlock();
+}
+#endif
+
 static void fib_table_print(struct seq_file *seq, struct fib_table *tb)
 {
 	if (tb->tb_id == RT_TABLE_LOCAL)
@@ -2211,6 +2573,9 @@ static int fib_triestat_seq_show(struct seq_file *seq, void *v)
 
 			trie_collect_stats(t, &stat);
 			trie_show_stats(seq, &stat);
+#ifdef CONFIG_IP_FIB_TRIE_DIR
+			fib_dir_show_stats(seq, t);
+#endif
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 			trie_show_usage(seq, &t->stats);
 #endif
@@ -19,6 +19,7 @@
 #include <linux/in.h>
 #include <linux/ip.h>
 #include <linux/netdevice.h>
+#include <linux/if_tunnel.h>
 #include <linux/spinlock.h>
 #include <net/protocol.h>
 #include <net/gre.h>
@@ -112,9 +113,200 @@ static void gre_err(struct sk_buff *skb, u32 info)
 	rcu_read_unlock();
 }
 
+static unsigned int gre_hdr_len(__be16 flags)
+{
+	unsigned int hlen = sizeof(struct gre_base_hdr);
+
+	if (flags & GRE_CSUM)
+		hlen += GRE_HEADER_SECTION;
+	if (flags & GRE_KEY)
+		hlen += GRE_HEADER_SECTION;
+	if (flags & GRE_SEQ)
+		hlen += GRE_HEADER_SECTION;
+	return hlen;
+}
+
+static int gre_gso_send_check(struct sk_buff *skb)
+{
+	if (!skb->encapsulation)
+		return -EINVAL;
+	return 0;
+}
+
+static struct sk_buff *gre_gso_segment(struct sk_buff *skb,
+				       netdev_features_t features)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	const struct gre_base_hdr *greh;
+	unsigned int ghl;
+	bool csum;
+
+	if (unlikely(skb_shinfo(skb)->gso_type &
+		     ~(SKB_GSO_TCPV4 |
+		       SKB_GSO_TCPV6 |
+		       SKB_GSO_DODGY |
+		       SKB_GSO_TCP_ECN |
+		       SKB_GSO_GRE |
+		       0) ||
+		     !(skb_shinfo(skb)->gso_type & SKB_GSO_GRE)))
+		goto out;
+
+	if (unlikely(!pskb_may_pull(skb, sizeof(*greh))))
+		goto out;
+
+	greh = (struct gre_base_hdr *)skb_transport_header(skb);
+
+	/* Every segment would carry the same sequence number. */
+	if (greh->flags & (GRE_VERSION | GRE_ROUTING | GRE_SEQ))
+		goto out;
+
+	ghl = gre_hdr_len(greh->flags);
+	csum = !!(greh->flags & GRE_CSUM);
+
+	segs = skb_encap_gso_segment(skb, features, ghl, greh->protocol, csum);
+	if (IS_ERR_OR_NULL(segs) || !csum)
+		goto out;
+
+	for (skb = segs; skb; skb = skb->next) {
+		unsigned int len = skb->len - skb_transport_offset(skb);
+		__sum16 *pcsum;
+
+		pcsum = (__sum16 *)(skb_transport_header(skb) +
+				    sizeof(*greh));
+		*(__be32 *)pcsum = 0;
+		*pcsum = csum_fold(skb_checksum(skb, skb_transport_offset(skb),
+						len, 0));
+	}
+
+out:
+	return segs;
+}
+
+static struct sk_buff **gre_gro_receive(struct sk_buff **head,
+					struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct sk_buff *p;
+	const struct gre_base_hdr *greh;
+	struct packet_type *ptype;
+	unsigned int hlen, ghl;
+	unsigned int off;
+	int flush = 1;
+	__wsum csum;
+
+	off = skb_gro_offset(skb);
+	hlen = off + sizeof(*greh);
+	greh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	/* Only version 0 with optional checksum and key is aggregated,
+	 * a merged packet could not carry the individual sequence numbers.
+	 */
+	if (greh->flags & ~(GRE_CSUM | GRE_KEY))
+		goto out;
+
+	ghl = gre_hdr_len(greh->flags);
+	hlen = off + ghl;
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	rcu_read_lock();
+	ptype = gro_find_receive_by_type(greh->protocol);
+	if (!ptype)
+		goto out_unlock;
+
+	/* Devices rarely verify anything inside a GRE header.  Sum the
+	 * packet once here; the receive path would have to do it anyway
+	 * and the inner protocol cannot aggregate without it.
+	 */
+	if (skb->ip_summed == CHECKSUM_NONE) {
+		skb->csum = skb_checksum(skb, off, skb_gro_len(skb), 0);
+		skb->ip_summed = CHECKSUM_COMPLETE;
+	}
+
+	if ((greh->flags & GRE_CSUM) &&
+	    skb->ip_summed == CHECKSUM_COMPLETE && csum_fold(skb->csum))
+		goto out_unlock;
+
+	flush = 0;
+
+	for (p = *head; p; p = p->next) {
+		const struct gre_base_hdr *greh2;
+
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		/* Flags, protocol and key must match, the checksum word
+		 * differs from packet to packet.
+		 */
+		greh2 = (struct gre_base_hdr *)(p->data + off);
+
+		if (greh2->flags != greh->flags ||
+		    greh2->protocol != greh->protocol ||
+		    ((greh->flags & GRE_KEY) &&
+		     *(__be32 *)((u8 *)greh + ghl - GRE_HEADER_SECTION) !=
+		     *(__be32 *)((u8 *)greh2 + ghl - GRE_HEADER_SECTION))) {
+			NAPI_GRO_CB(p)->same_flow = 0;
+			continue;
+		}
+	}
+
+	skb_gro_pull(skb, ghl);
+
+	csum = skb->csum;
+	skb_postpull_rcsum(skb, greh, ghl);
+
+	pp = ptype->gro_receive(head, skb);
+
+	skb->csum = csum;
+
+out_unlock:
+	rcu_read_unlock();
+
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+static int gre_gro_complete(struct sk_buff *skb, int nhoff)
+{
+	const struct gre_base_hdr *greh;
+	struct packet_type *ptype;
+	int err = -ENOENT;
+
+	greh = (struct gre_base_hdr *)(skb->data + nhoff);
+
+	rcu_read_lock();
+	ptype = gro_find_complete_by_type(greh->protocol);
+	if (!WARN_ON(!ptype))
+		err = ptype->gro_complete(skb, nhoff +
+					  gre_hdr_len(greh->flags));
+	rcu_read_unlock();
+
+	/* Lets the merged packet be resegmented if it is forwarded as is,
+	 * the tunnel clears it again on decapsulation.
+	 */
+	if (!err)
+		skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+
+	return err;
+}
+
 static const struct net_protocol net_gre_protocol = {
 	.handler     = gre_rcv,
 	.err_handler = gre_err,
+	.gso_send_check = gre_gso_send_check,
+	.gso_segment = gre_gso_segment,
+	.gro_receive = gre_gro_receive,
+	.gro_complete = gre_gro_complete,
 	.netns_ok    = 1,
 };
 
@@ -39,6 +39,7 @@ struct inet_bind_bucket *inet_bind_bucket_create(struct kmem_cache *cachep,
 		write_pnet(&tb->ib_net, hold_net(net));
 		tb->port      = snum;
 		tb->fastreuse = 0;
+		tb->fastreuseport = 0;
 		tb->num_owners = 0;
 		INIT_HLIST_HEAD(&tb->owners);
 		hlist_add_head(&tb->node, &head->chain);
@@ -176,6 +177,7 @@ static inline int compute_score(struct sock *sk, struct net *net,
 
 struct sock *__inet_lookup_listener(struct net *net,
 				    struct inet_hashinfo *hashinfo,
+				    const __be32 saddr, const __be16 sport,
 				    const __be32 daddr, const unsigned short hnum,
 				    const int dif)
 {
@@ -183,7 +185,8 @@ struct sock *__inet_lookup_listener(struct net *net,
 	struct hlist_nulls_node *node;
 	unsigned int hash = inet_lhashfn(net, hnum);
 	struct inet_listen_hashbucket *ilb = &hashinfo->listening_hash[hash];
-	int score, hiscore;
+	int score, hiscore, matches = 0, reuseport = 0;
+	u32 phash = 0;
 
 	rcu_read_lock();
 begin:
@@ -194,6 +197,21 @@ begin:
 		if (score > hiscore) {
 			result = sk;
 			hiscore = score;
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				phash = inet_ehashfn(net, daddr, hnum,
+						     saddr, sport);
+				matches = 1;
+			}
+		} else if (score == hiscore && reuseport) {
+			/* Spread flows over all SO_REUSEPORT listeners
+			 * sharing the best score, picking each one with
+			 * probability 1/matches (reservoir sampling).
+			 */
+			matches++;
+			if (((u64)phash * matches) >> 32 == 0)
+				result = sk;
+			phash = next_pseudo_random32(phash);
 		}
 	}
 	/*
@@ -451,6 +469,16 @@ void inet_unhash(struct sock *sk)
 }
 EXPORT_SYMBOL_GPL(inet_unhash);
 
+/*
+ * Where the next ephemeral port search starts, per bucket of
+ * (saddr, daddr, dport) hashes.  Many connections to one destination
+ * then probe past the ports they already hold instead of walking the
+ * same occupied run from a fixed offset on every connect().
+ */
+#define INET_TABLE_PERTURB_SHIFT	8
+#define INET_TABLE_PERTURB_SIZE		(1 << INET_TABLE_PERTURB_SHIFT)
+static u32 table_perturb[INET_TABLE_PERTURB_SIZE];
+
 int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 		struct sock *sk, u32 port_offset,
 		int (*check_established)(struct inet_timewait_death_row *,
@@ -467,22 +495,35 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 
 	if (!snum) {
 		int i, remaining, low, high, port;
-		static u32 hint;
-		u32 offset = hint + port_offset;
+		u32 index, offset;
 		struct hlist_node *node;
 		struct inet_timewait_sock *tw = NULL;
 
 		inet_get_local_port_range(&low, &high);
 		remaining = (high - low) + 1;
 
-		local_bh_disable();
-		for (i = 1; i <= remaining; i++) {
-			port = low + (i + offset) % remaining;
+		/* low bits pick the hint, the others randomize the start */
+		index = port_offset & (INET_TABLE_PERTURB_SIZE - 1);
+		offset = ACCESS_ONCE(table_perturb[index]) +
+			 (port_offset >> INET_TABLE_PERTURB_SHIFT);
+		offset %= remaining;
+
+		/*
+		 * By starting with an even offset and stepping by two,
+		 * connect() tends to leave the other half of the range
+		 * to bind(0), and a second round covers it when needed.
+		 */
+		offset &= ~1;
+other_parity_scan:
+		port = low + offset;
+		for (i = 0; i < remaining; i += 2, port += 2) {
+			if (unlikely(port > high))
+				port -= remaining;
 			if (inet_is_reserved_local_port(port))
 				continue;
 			head = &hinfo->bhash[inet_bhashfn(net, port,
 					hinfo->bhash_size)];
-			spin_lock(&head->lock);
+			spin_lock_bh(&head->lock);
 
 			/* Does not bother with rcv_saddr checks,
 			 * because the established check is already
@@ -491,7 +532,8 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 			inet_bind_bucket_for_each(tb, node, &head->chain) {
 				if (net_eq(ib_net(tb), net) &&
 				    tb->port == port) {
-					if (tb->fastreuse >= 0)
+					if (tb->fastreuse >= 0 ||
+					    tb->fastreuseport >= 0)
 						goto next_port;
 					WARN_ON(hlist_empty(&tb->owners));
 					if (!check_established(death_row, sk,
@@ -504,21 +546,32 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 			tb = inet_bind_bucket_create(hinfo->bind_bucket_cachep,
 					net, head, port);
 			if (!tb) {
-				spin_unlock(&head->lock);
-				break;
+				spin_unlock_bh(&head->lock);
+				return -ENOMEM;
 			}
 			tb->fastreuse = -1;
+			tb->fastreuseport = -1;
 			goto ok;
 
 		next_port:
-			spin_unlock(&head->lock);
+			spin_unlock_bh(&head->lock);
+			cond_resched();
 		}
-		local_bh_enable();
+
+		offset++;
+		if ((offset & 1) && remaining > 1)
+			goto other_parity_scan;
 
 		return -EADDRNOTAVAIL;
 
 ok:
-		hint += i;
+		/*
+		 * Move the hint past the port just taken, plus a little
+		 * randomness: on low contention the next start is random,
+		 * on high contention it lands right after the ports in use.
+		 */
+		i = max_t(int, i, (net_random() & 7) * 2);
+		ACCESS_ONCE(table_perturb[index]) += i + 2;
 
 		/* Head lock still held and bh's disabled */
 		inet_bind_hash(sk, tb, port);
@@ -125,6 +125,11 @@ static int ipgre_tunnel_init(struct net_device *dev);
 static void ipgre_tunnel_setup(struct net_device *dev);
 static int ipgre_tunnel_bind_dev(struct net_device *dev);
 
+#define GRE_FEATURES	(NETIF_F_SG |		\
+			 NETIF_F_FRAGLIST |	\
+			 NETIF_F_HIGHDMA |	\
+			 NETIF_F_HW_CSUM)
+
 /* Fallback tunnel: no source, no destination, no key, no options */
 
 #define HASH_SIZE  16
@@ -649,6 +654,13 @@ static int ipgre_rcv(struct sk_buff *skb)
 
 		secpath_reset(skb);
 
+		/* Offload state of a GRO merged packet now describes the
+		 * inner headers only.
+		 */
+		skb->encapsulation = 0;
+		if (skb_is_gso(skb))
+			skb_shinfo(skb)->gso_type &= ~SKB_GSO_GRE;
+
 		skb->protocol = gre_proto;
 		/* WCCP version 1 and 2 protocol decoding.
 		 * - Change protocol to IP
@@ -838,7 +850,7 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 	if (skb->protocol == htons(ETH_P_IP)) {
 		df |= (old_iph->frag_off&htons(IP_DF));
 
-		if ((old_iph->frag_off&htons(IP_DF)) &&
+		if (!skb_is_gso(skb) && (old_iph->frag_off&htons(IP_DF)) &&
 		    mtu < ntohs(old_iph->tot_len)) {
 			icmp_send(skb, ICMP_DEST_UNREACH, ICMP_FRAG_NEEDED, htonl(mtu));
 			ip_rt_put(rt);
@@ -858,7 +870,8 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 			}
 		}
 
-		if (mtu >= IPV6_MIN_MTU && mtu < skb->len - tunnel->hlen + gre_hlen) {
+		if (!skb_is_gso(skb) && mtu >= IPV6_MIN_MTU &&
+		    mtu < skb->len - tunnel->hlen + gre_hlen) {
 			icmpv6_send(skb, ICMPV6_PKT_TOOBIG, 0, mtu);
 			ip_rt_put(rt);
 			goto tx_error;
@@ -896,6 +909,30 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 		old_iph = ip_hdr(skb);
 	}
 
+	if (skb_is_gso(skb)) {
+		/* gso_type lives in the shared info, a clone (think TCP
+		 * retransmit queue) must not see the GRE bit.
+		 */
+		if (skb_cloned(skb) &&
+		    pskb_expand_head(skb, 0, 0, GFP_ATOMIC)) {
+			ip_rt_put(rt);
+			dev->stats.tx_dropped++;
+			dev_kfree_skb(skb);
+			return NETDEV_TX_OK;
+		}
+		old_iph = ip_hdr(skb);
+		skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+	} else if (skb->ip_summed == CHECKSUM_PARTIAL &&
+		   (tunnel->parms.o_flags&GRE_CSUM) && skb_checksum_help(skb)) {
+		ip_rt_put(rt);
+		goto tx_error;
+	}
+
+	if (skb->ip_summed == CHECKSUM_PARTIAL)
+		skb->encapsulation = 1;
+	else
+		skb->ip_summed = CHECKSUM_NONE;
+
 	skb_reset_transport_header(skb);
 	skb_push(skb, gre_hlen);
 	skb_reset_network_header(skb);
@@ -945,9 +982,12 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 			*ptr = tunnel->parms.o_key;
 			ptr--;
 		}
-		if (tunnel->parms.o_flags&GRE_CSUM) {
+		/* GSO fills it in per segment, see gre_gso_segment() */
+		if ((tunnel->parms.o_flags&GRE_CSUM) && !skb_is_gso(skb)) {
 			*ptr = 0;
-			*(__sum16 *)ptr = ip_compute_csum((void *)(iph+1), skb->len - sizeof(struct iphdr));
+			*(__sum16 *)ptr = csum_fold(skb_checksum(skb,
+					sizeof(struct iphdr),
+					skb->len - sizeof(struct iphdr), 0));
 		}
 	}
 
@@ -1309,6 +1349,9 @@ static void ipgre_tunnel_setup(struct net_device *dev)
 	dev->addr_len		= 4;
 	dev->features		|= NETIF_F_NETNS_LOCAL;
 	dev->priv_flags		&= ~IFF_XMIT_DST_RELEASE;
+
+	dev->features		|= GRE_FEATURES;
+	dev->hw_features	|= GRE_FEATURES;
 }
 
 static int ipgre_tunnel_init(struct net_device *dev)
@@ -1337,6 +1380,14 @@ static int ipgre_tunnel_init(struct net_device *dev)
 	} else
 		dev->header_ops = &ipgre_header_ops;
 
+	/* Segments would all carry the same sequence number, and the
+	 * header_ops variants build the GRE header before we see it.
+	 */
+	if (!dev->header_ops && !(tunnel->parms.o_flags & GRE_SEQ)) {
+		dev->features |= NETIF_F_ALL_TSO;
+		dev->hw_features |= NETIF_F_ALL_TSO;
+	}
+
 	dev->tstats = alloc_percpu(struct pcpu_tstats);
 	if (!dev->tstats)
 		return -ENOMEM;
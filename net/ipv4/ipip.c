@@ -585,6 +585,7 @@ static netdev_tx_t ipip_tunnel_xmit(struct sk_buff *skb, struct net_device *dev)
 	if ((iph->ttl = tiph->ttl) == 0)
 		iph->ttl	=	old_iph->ttl;
 
+	skb->ip_summed = CHECKSUM_NONE;
 	nf_reset(skb);
 	tstats = this_cpu_ptr(dev->tstats);
 	__IPTUNNEL_XMIT(tstats, &dev->stats);
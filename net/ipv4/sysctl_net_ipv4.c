@@ -15,10 +15,12 @@
 #include <linux/slab.h>
 #include <linux/nsproxy.h>
 #include <linux/swap.h>
+#include <linux/rtnetlink.h>
 #include <net/snmp.h>
 #include <net/icmp.h>
 #include <net/ip.h>
 #include <net/route.h>
+#include <net/ip_fib.h>
 #include <net/tcp.h>
 #include <net/udp.h>
 #include <net/cipso_ipv4.h>
@@ -122,6 +124,42 @@ static int ipv4_ping_group_range(ctl_table *table, int write,
 	return ret;
 }
 
+#ifdef CONFIG_IP_FIB_TRIE_DIR
+static unsigned long fib_dir_table_max = RT_TABLE_MAX;
+
+/* Update fib_dir_tables, unlisted entries become 0, and apply it */
+static int ipv4_fib_dir_tables(ctl_table *table, int write,
+			       void __user *buffer, size_t *lenp,
+			       loff_t *ppos)
+{
+	struct net *net = container_of(table->data, struct net,
+				       ipv4.sysctl_fib_dir_tables);
+	unsigned long vec[FIB_DIR_MAX_TABLES];
+	ctl_table tmp = {
+		.data = vec,
+		.maxlen = sizeof(vec),
+		.mode = table->mode,
+		.extra2 = &fib_dir_table_max,
+	};
+	int ret;
+
+	if (!write)
+		return proc_doulongvec_minmax(table, write, buffer, lenp, ppos);
+
+	memset(vec, 0, sizeof(vec));
+	ret = proc_doulongvec_minmax(&tmp, write, buffer, lenp, ppos);
+	if (ret)
+		return ret;
+
+	rtnl_lock();
+	memcpy(net->ipv4.sysctl_fib_dir_tables, vec, sizeof(vec));
+	ret = fib_dir_select_tables(net);
+	rtnl_unlock();
+
+	return ret;
+}
+#endif
+
 static int proc_tcp_congestion_control(ctl_table *ctl, int write,
 				       void __user *buffer, size_t *lenp, loff_t *ppos)
 {
@@ -177,6 +215,45 @@ static int proc_allowed_congestion_control(ctl_table *ctl,
 	return ret;
 }
 
+static int proc_tcp_fastopen_key(ctl_table *ctl, int write, void __user *buffer,
+				 size_t *lenp, loff_t *ppos)
+{
+	ctl_table tbl = { .maxlen = (TCP_FASTOPEN_KEY_LENGTH * 2 + 10) };
+	struct tcp_fastopen_context *ctxt;
+	int ret;
+	u32  user_key[4]; /* 16 bytes, matching TCP_FASTOPEN_KEY_LENGTH */
+
+	tbl.data = kmalloc(tbl.maxlen, GFP_KERNEL);
+	if (!tbl.data)
+		return -ENOMEM;
+
+	rcu_read_lock();
+	ctxt = rcu_dereference(tcp_fastopen_ctx);
+	if (ctxt)
+		memcpy(user_key, ctxt->key, TCP_FASTOPEN_KEY_LENGTH);
+	else
+		memset(user_key, 0, sizeof(user_key));
+	rcu_read_unlock();
+
+	snprintf(tbl.data, tbl.maxlen, "%08x-%08x-%08x-%08x",
+		user_key[0], user_key[1], user_key[2], user_key[3]);
+	ret = proc_dostring(&tbl, write, buffer, lenp, ppos);
+
+	if (write && ret == 0) {
+		if (sscanf(tbl.data, "%x-%x-%x-%x", user_key, user_key + 1,
+			   user_key + 2, user_key + 3) != 4) {
+			ret = -EINVAL;
+			goto bad_key;
+		}
+		ret = tcp_fastopen_reset_cipher(user_key,
+						TCP_FASTOPEN_KEY_LENGTH);
+	}
+
+bad_key:
+	kfree(tbl.data);
+	return ret;
+}
+
 static int ipv4_tcp_mem(ctl_table *ctl, int write,
 			   void __user *buffer, size_t *lenp,
 			   loff_t *ppos)
@@ -373,6 +450,12 @@ static struct ctl_table ipv4_table[] = {
 		.mode		= 0644,
 		.proc_handler	= proc_dointvec,
 	},
+	{
+		.procname	= "tcp_fastopen_key",
+		.mode		= 0600,
+		.maxlen		= ((TCP_FASTOPEN_KEY_LENGTH * 2) + 10),
+		.proc_handler	= proc_tcp_fastopen_key,
+	},
 	{
 		.procname	= "tcp_tw_recycle",
 		.data		= &tcp_death_row.sysctl_tw_recycle,
@@ -796,6 +879,15 @@ static struct ctl_table ipv4_net_table[] = {
 		.mode		= 0644,
 		.proc_handler	= ipv4_tcp_mem,
 	},
+#ifdef CONFIG_IP_FIB_TRIE_DIR
+	{
+		.procname	= "fib_dir_tables",
+		.data		= &init_net.ipv4.sysctl_fib_dir_tables,
+		.maxlen		= sizeof(init_net.ipv4.sysctl_fib_dir_tables),
+		.mode		= 0644,
+		.proc_handler	= ipv4_fib_dir_tables,
+	},
+#endif
 	{ }
 };
 
@@ -823,6 +915,10 @@ static __net_init int ipv4_sysctl_init_net(struct net *net)
 			&net->ipv4.sysctl_icmp_ratemask;
 		table[6].data =
 			&net->ipv4.sysctl_ping_group_range;
+#ifdef CONFIG_IP_FIB_TRIE_DIR
+		table[8].data =
+			&net->ipv4.sysctl_fib_dir_tables;
+#endif
 
 	}
 
@@ -97,6 +97,7 @@
 #include <linux/inet.h>
 #include <linux/netdevice.h>
 #include <linux/slab.h>
+#include <linux/jhash.h>
 #include <net/tcp_states.h>
 #include <linux/skbuff.h>
 #include <linux/proc_fs.h>
@@ -106,6 +107,7 @@
 #include <net/route.h>
 #include <net/checksum.h>
 #include <net/xfrm.h>
+#include <net/busy_poll.h>
 #include <trace/events/udp.h>
 #include <linux/static_key.h>
 #include <trace/events/skb.h>
@@ -139,6 +141,7 @@ static int udp_lib_lport_inuse(struct net *net, __u16 num,
 {
 	struct sock *sk2;
 	struct hlist_nulls_node *node;
+	int uid = sock_i_uid(sk);
 
 	sk_nulls_for_each(sk2, node, &hslot->head)
 		if (net_eq(sock_net(sk2), net) &&
@@ -147,6 +150,8 @@ static int udp_lib_lport_inuse(struct net *net, __u16 num,
 		    (!sk2->sk_reuse || !sk->sk_reuse) &&
 		    (!sk2->sk_bound_dev_if || !sk->sk_bound_dev_if ||
 		     sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
+		    (!sk2->sk_reuseport || !sk->sk_reuseport ||
+		     uid != sock_i_uid(sk2)) &&
 		    (*saddr_comp)(sk, sk2)) {
 			if (bitmap)
 				__set_bit(udp_sk(sk2)->udp_port_hash >> log,
@@ -169,6 +174,7 @@ static int udp_lib_lport_inuse2(struct net *net, __u16 num,
 {
 	struct sock *sk2;
 	struct hlist_nulls_node *node;
+	int uid = sock_i_uid(sk);
 	int res = 0;
 
 	spin_lock(&hslot2->lock);
@@ -179,6 +185,8 @@ static int udp_lib_lport_inuse2(struct net *net, __u16 num,
 		    (!sk2->sk_reuse || !sk->sk_reuse) &&
 		    (!sk2->sk_bound_dev_if || !sk->sk_bound_dev_if ||
 		     sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
+		    (!sk2->sk_reuseport || !sk->sk_reuseport ||
+		     uid != sock_i_uid(sk2)) &&
 		    (*saddr_comp)(sk, sk2)) {
 			res = 1;
 			break;
@@ -409,7 +417,8 @@ static struct sock *udp4_lib_lookup2(struct net *net,
 {
 	struct sock *sk, *result;
 	struct hlist_nulls_node *node;
-	int score, badness;
+	int score, badness, matches = 0, reuseport = 0;
+	u32 hash = 0;
 
 begin:
 	result = NULL;
@@ -420,8 +429,18 @@ begin:
 		if (score > badness) {
 			result = sk;
 			badness = score;
-			if (score == SCORE2_MAX)
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				hash = inet_ehashfn(net, daddr, hnum,
+						    saddr, sport);
+				matches = 1;
+			} else if (score == SCORE2_MAX)
 				goto exact_match;
+		} else if (score == badness && reuseport) {
+			matches++;
+			if (((u64)hash * matches) >> 32 == 0)
+				result = sk;
+			hash = next_pseudo_random32(hash);
 		}
 	}
 	/*
@@ -457,7 +476,8 @@ struct sock *__udp4_lib_lookup(struct net *net, __be32 saddr,
 	unsigned short hnum = ntohs(dport);
 	unsigned int hash2, slot2, slot = udp_hashfn(net, hnum, udptable->mask);
 	struct udp_hslot *hslot2, *hslot = &udptable->hash[slot];
-	int score, badness;
+	int score, badness, matches = 0, reuseport = 0;
+	u32 hash = 0;
 
 	rcu_read_lock();
 	if (hslot->count > 10) {
@@ -493,6 +513,20 @@ begin:
 		if (score > badness) {
 			result = sk;
 			badness = score;
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				hash = inet_ehashfn(net, daddr, hnum,
+						    saddr, sport);
+				matches = 1;
+			}
+		} else if (score == badness && reuseport) {
+			/* Spread datagrams over all SO_REUSEPORT sockets
+			 * sharing the best score, by flow hash.
+			 */
+			matches++;
+			if (((u64)hash * matches) >> 32 == 0)
+				result = sk;
+			hash = next_pseudo_random32(hash);
 		}
 	}
 	/*
@@ -794,6 +828,184 @@ out:
 	return err;
 }
 
+/*
+ * Unconnected sockets replying to many peers need a route lookup for
+ * every datagram.  The routes of recent destinations are kept in a small
+ * direct mapped table per socket, keyed by the inputs of the lookup.
+ * Entries are never modified once published: a miss replaces the slot
+ * under cache->lock and lookups run under RCU.  Like sk_dst_cache the
+ * cached route is validated with dst_check(), so a routing table change
+ * (rt_genid bump) or a PMTU/redirect update sends us back to the FIB.
+ */
+#define UDP_DST_CACHE_SIZE	64
+
+struct udp_dst_entry {
+	struct rcu_head		rcu;
+	struct dst_entry	*dst;
+	/* lookup key */
+	__be32			key_daddr;
+	__be32			key_saddr;
+	int			key_oif;
+	__u32			key_mark;
+	__u8			key_tos;
+	__u8			key_flags;
+	/* flow as completed by the route lookup */
+	struct flowi4		fl4;
+};
+
+struct udp_dst_cache {
+	spinlock_t			lock;
+	struct udp_dst_entry __rcu	*slot[UDP_DST_CACHE_SIZE];
+};
+
+static inline bool udp_dst_cache_usable(const struct sock *sk)
+{
+#ifdef CONFIG_XFRM
+	/* IPsec policies may select on ports, which are not in the key */
+	if (sock_net(sk)->xfrm.policy_count[XFRM_POLICY_OUT] ||
+	    sk->sk_policy[XFRM_POLICY_OUT])
+		return false;
+#endif
+	return true;
+}
+
+static inline u32 udp_dst_cache_hash(const struct flowi4 *fl4)
+{
+	return jhash_3words((__force u32)fl4->daddr, (__force u32)fl4->saddr,
+			    fl4->flowi4_oif ^ fl4->flowi4_tos,
+			    fl4->flowi4_mark) & (UDP_DST_CACHE_SIZE - 1);
+}
+
+static inline bool udp_dst_entry_match(const struct udp_dst_entry *e,
+				       const struct flowi4 *fl4)
+{
+	return e->key_daddr == fl4->daddr &&
+	       e->key_saddr == fl4->saddr &&
+	       e->key_oif == fl4->flowi4_oif &&
+	       e->key_mark == fl4->flowi4_mark &&
+	       e->key_tos == fl4->flowi4_tos &&
+	       e->key_flags == fl4->flowi4_flags;
+}
+
+static void udp_dst_entry_free(struct udp_dst_entry *e)
+{
+	dst_release(e->dst);
+	kfree(e);
+}
+
+static void udp_dst_entry_free_rcu(struct rcu_head *head)
+{
+	udp_dst_entry_free(container_of(head, struct udp_dst_entry, rcu));
+}
+
+/*
+ * Look up the route for the flow @fl4 was initialized with.  On a hit
+ * returns the route with a reference held and completes @fl4 the way
+ * ip_route_output_flow() would have.
+ */
+static struct rtable *udp_dst_cache_lookup(struct sock *sk,
+					   struct flowi4 *fl4)
+{
+	struct udp_dst_cache *cache;
+	struct udp_dst_entry *e;
+	struct dst_entry *dst = NULL;
+	__be16 dport, sport;
+
+	rcu_read_lock();
+	cache = rcu_dereference(udp_sk(sk)->dst_cache);
+	if (!cache)
+		goto out;
+
+	e = rcu_dereference(cache->slot[udp_dst_cache_hash(fl4)]);
+	if (!e || !udp_dst_entry_match(e, fl4))
+		goto out;
+
+	/* the entry holds a reference until a grace period after removal */
+	dst = dst_check(e->dst, 0);
+	if (dst) {
+		dst_hold(dst);
+		dport = fl4->fl4_dport;
+		sport = fl4->fl4_sport;
+		*fl4 = e->fl4;
+		fl4->fl4_dport = dport;
+		fl4->fl4_sport = sport;
+	}
+out:
+	rcu_read_unlock();
+	return (struct rtable *)dst;
+}
+
+/*
+ * Remember @rt, the result of routing @key, which completed into @fl4.
+ * Failing to allocate only costs the next send a FIB lookup.
+ */
+static void udp_dst_cache_store(struct sock *sk, const struct flowi4 *key,
+				const struct flowi4 *fl4, struct rtable *rt)
+{
+	struct udp_sock *up = udp_sk(sk);
+	struct udp_dst_cache *cache;
+	struct udp_dst_entry *e, *old;
+	u32 hash = udp_dst_cache_hash(key);
+
+	cache = rcu_dereference_raw(up->dst_cache);
+	if (!cache) {
+		cache = kzalloc(sizeof(*cache), GFP_ATOMIC);
+		if (!cache)
+			return;
+		spin_lock_init(&cache->lock);
+		/* another sender may have installed one meanwhile */
+		if (cmpxchg((__force struct udp_dst_cache **)&up->dst_cache,
+			    NULL, cache)) {
+			kfree(cache);
+			cache = rcu_dereference_raw(up->dst_cache);
+		}
+	}
+
+	e = kmalloc(sizeof(*e), GFP_ATOMIC);
+	if (!e)
+		return;
+
+	e->key_daddr = key->daddr;
+	e->key_saddr = key->saddr;
+	e->key_oif = key->flowi4_oif;
+	e->key_mark = key->flowi4_mark;
+	e->key_tos = key->flowi4_tos;
+	e->key_flags = key->flowi4_flags;
+	e->fl4 = *fl4;
+	e->dst = dst_clone(&rt->dst);
+
+	spin_lock_bh(&cache->lock);
+	old = rcu_dereference_protected(cache->slot[hash],
+					lockdep_is_held(&cache->lock));
+	rcu_assign_pointer(cache->slot[hash], e);
+	spin_unlock_bh(&cache->lock);
+
+	if (old)
+		call_rcu(&old->rcu, udp_dst_entry_free_rcu);
+}
+
+/* Called from the destroy hook, when no sender can be left */
+void udp_dst_cache_release(struct sock *sk)
+{
+	struct udp_sock *up = udp_sk(sk);
+	struct udp_dst_cache *cache;
+	struct udp_dst_entry *e;
+	int i;
+
+	cache = rcu_dereference_protected(up->dst_cache, 1);
+	if (!cache)
+		return;
+	RCU_INIT_POINTER(up->dst_cache, NULL);
+
+	for (i = 0; i < UDP_DST_CACHE_SIZE; i++) {
+		e = rcu_dereference_protected(cache->slot[i], 1);
+		if (e)
+			udp_dst_entry_free(e);
+	}
+	kfree(cache);
+}
+EXPORT_SYMBOL(udp_dst_cache_release);
+
 int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 		size_t len)
 {
@@ -932,6 +1144,8 @@ int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 
 	if (rt == NULL) {
 		struct net *net = sock_net(sk);
+		struct flowi4 key;
+		bool cacheable;
 
 		fl4 = &fl4_stack;
 		flowi4_init_output(fl4, ipc.oif, sk->sk_mark, tos,
@@ -940,13 +1154,26 @@ int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 				   faddr, saddr, dport, inet->inet_sport);
 
 		security_sk_classify_flow(sk, flowi4_to_flowi(fl4));
-		rt = ip_route_output_flow(net, fl4, sk);
-		if (IS_ERR(rt)) {
-			err = PTR_ERR(rt);
-			rt = NULL;
-			if (err == -ENETUNREACH)
-				IP_INC_STATS_BH(net, IPSTATS_MIB_OUTNOROUTES);
-			goto out;
+
+		cacheable = !connected && !ipv4_is_multicast(daddr) &&
+			    udp_dst_cache_usable(sk);
+		if (cacheable)
+			rt = udp_dst_cache_lookup(sk, fl4);
+
+		if (rt == NULL) {
+			if (cacheable)
+				key = *fl4;
+			rt = ip_route_output_flow(net, fl4, sk);
+			if (IS_ERR(rt)) {
+				err = PTR_ERR(rt);
+				rt = NULL;
+				if (err == -ENETUNREACH)
+					IP_INC_STATS_BH(net,
+						IPSTATS_MIB_OUTNOROUTES);
+				goto out;
+			}
+			if (cacheable)
+				udp_dst_cache_store(sk, &key, fl4, rt);
 		}
 
 		err = -EACCES;
@@ -1097,13 +1324,18 @@ out:
  */
 static unsigned int first_packet_length(struct sock *sk)
 {
-	struct sk_buff_head list_kill, *rcvq = &sk->sk_receive_queue;
+	struct sk_buff_head list_kill, *rcvq = &udp_sk(sk)->reader_queue;
 	struct sk_buff *skb;
 	unsigned int res;
 
 	__skb_queue_head_init(&list_kill);
 
 	spin_lock_bh(&rcvq->lock);
+	if (skb_queue_empty(rcvq)) {
+		spin_lock_irq(&sk->sk_receive_queue.lock);
+		skb_queue_splice_tail_init(&sk->sk_receive_queue, rcvq);
+		spin_unlock_irq(&sk->sk_receive_queue.lock);
+	}
 	while ((skb = skb_peek(rcvq)) != NULL &&
 		udp_lib_checksum_complete(skb)) {
 		UDP_INC_STATS_BH(sock_net(sk), UDP_MIB_INERRORS,
@@ -1162,6 +1394,68 @@ int udp_ioctl(struct sock *sk, int cmd, unsigned long arg)
 }
 EXPORT_SYMBOL(udp_ioctl);
 
+/**
+ *	__skb_recv_udp - receive a datagram from a UDP socket
+ *	@sk: socket
+ *	@flags: MSG_ flags
+ *	@noblock: do not wait for a datagram
+ *	@peeked: returns non-zero if this packet has been seen before
+ *	@off: an offset in bytes to peek skb from
+ *	@err: error code returned
+ *
+ *	Like __skb_recv_datagram(), except that datagrams are taken off
+ *	sk_receive_queue all at once into the private reader_queue.  A
+ *	burst is thus moved with a single hold of the lock shared with
+ *	softirq enqueue, and the datagrams that follow, e.g. the rest of
+ *	a recvmmsg() vector, are dequeued without touching it.
+ */
+struct sk_buff *__skb_recv_udp(struct sock *sk, unsigned int flags,
+			       int noblock, int *peeked, int *off, int *err)
+{
+	struct sk_buff_head *sk_queue = &sk->sk_receive_queue;
+	struct sk_buff_head *queue = &udp_sk(sk)->reader_queue;
+	struct sk_buff *skb;
+	long timeo;
+	int error = sock_error(sk);
+
+	if (error)
+		goto no_packet;
+
+	timeo = sock_rcvtimeo(sk, noblock);
+
+	do {
+		spin_lock_bh(&queue->lock);
+		skb = __skb_try_recv_from_queue(queue, flags, peeked, off);
+		if (!skb && !skb_queue_empty(sk_queue)) {
+			spin_lock_irq(&sk_queue->lock);
+			skb_queue_splice_tail_init(sk_queue, queue);
+			spin_unlock_irq(&sk_queue->lock);
+
+			skb = __skb_try_recv_from_queue(queue, flags, peeked,
+							off);
+		}
+		spin_unlock_bh(&queue->lock);
+		if (skb)
+			return skb;
+
+		if (sk_can_busy_loop(sk) && sk_busy_loop(sk, noblock))
+			continue;
+
+		/* User doesn't want to wait */
+		error = -EAGAIN;
+		if (!timeo)
+			goto no_packet;
+
+	} while (!__skb_wait_for_more_packets(sk, err, &timeo, queue));
+
+	return NULL;
+
+no_packet:
+	*err = error;
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(__skb_recv_udp);
+
 /*
  * 	This should be easy, if there is something there we
  * 	return it, otherwise we block.
@@ -1189,8 +1483,7 @@ int udp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 		return ip_recv_error(sk, msg, len);
 
 try_again:
-	skb = __skb_recv_datagram(sk, flags | (noblock ? MSG_DONTWAIT : 0),
-				  &peeked, &off, &err);
+	skb = __skb_recv_udp(sk, flags, noblock, &peeked, &off, &err);
 	if (!skb)
 		goto out;
 
@@ -1261,7 +1554,7 @@ out:
 
 csum_copy_err:
 	slow = lock_sock_fast(sk);
-	if (!skb_kill_datagram(sk, skb, flags))
+	if (!__skb_kill_datagram(sk, &udp_sk(sk)->reader_queue, skb, flags))
 		UDP_INC_STATS_USER(sock_net(sk), UDP_MIB_INERRORS, is_udplite);
 	unlock_sock_fast(sk, slow);
 
@@ -1373,6 +1666,7 @@ static int __udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 
 	if (inet_sk(sk)->inet_daddr)
 		sock_rps_save_rxhash(sk, skb);
+	sk_mark_napi_id(sk, skb);
 
 	rc = sock_queue_rcv_skb(sk, skb);
 	if (rc < 0) {
@@ -1735,11 +2029,26 @@ int udp_rcv(struct sk_buff *skb)
 	return __udp4_lib_rcv(skb, &udp_table, IPPROTO_UDP);
 }
 
+/* reader_queue.lock nests outside sk_receive_queue.lock */
+static struct lock_class_key udp_reader_queue_key;
+
+int udp_init_sock(struct sock *sk)
+{
+	struct udp_sock *up = udp_sk(sk);
+
+	skb_queue_head_init(&up->reader_queue);
+	lockdep_set_class(&up->reader_queue.lock, &udp_reader_queue_key);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(udp_init_sock);
+
 void udp_destroy_sock(struct sock *sk)
 {
 	bool slow = lock_sock_fast(sk);
 	udp_flush_pending_frames(sk);
 	unlock_sock_fast(sk, slow);
+	skb_queue_purge(&udp_sk(sk)->reader_queue);
+	udp_dst_cache_release(sk);
 }
 
 /*
@@ -1928,6 +2237,9 @@ unsigned int udp_poll(struct file *file, struct socket *sock, poll_table *wait)
 	unsigned int mask = datagram_poll(file, sock, wait);
 	struct sock *sk = sock->sk;
 
+	if (!skb_queue_empty(&udp_sk(sk)->reader_queue))
+		mask |= POLLIN | POLLRDNORM;
+
 	/* Check for false positives due to checksum errors */
 	if ((mask & POLLRDNORM) && !(file->f_flags & O_NONBLOCK) &&
 	    !(sk->sk_shutdown & RCV_SHUTDOWN) && !first_packet_length(sk))
@@ -1945,6 +2257,7 @@ struct proto udp_prot = {
 	.connect	   = ip4_datagram_connect,
 	.disconnect	   = udp_disconnect,
 	.ioctl		   = udp_ioctl,
+	.init		   = udp_init_sock,
 	.destroy	   = udp_destroy_sock,
 	.setsockopt	   = udp_setsockopt,
 	.getsockopt	   = udp_getsockopt,
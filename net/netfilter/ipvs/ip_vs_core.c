@@ -426,7 +426,6 @@ ip_vs_schedule(struct ip_vs_service *svc, struct sk_buff *skb,
 	    (cp = pp->conn_in_get(svc->af, skb, &iph, iph.len, 1))) {
 		IP_VS_DBG_PKT(12, svc->af, pp, skb, 0,
 			      "Not scheduling reply for existing connection");
-		__ip_vs_conn_put(cp);
 		return NULL;
 	}
 
@@ -826,8 +825,6 @@ static int handle_response_icmp(int af, struct sk_buff *skb,
 	verdict = NF_ACCEPT;
 
 out:
-	__ip_vs_conn_put(cp);
-
 	return verdict;
 }
 
@@ -1068,13 +1065,13 @@ handle_response(int af, struct sk_buff *skb, struct ip_vs_proto_data *pd,
 		ip_vs_notrack(skb);
 	else
 		ip_vs_update_conntrack(skb, cp, 0);
-	ip_vs_conn_put(cp);
+	ip_vs_conn_touch(cp);
 
 	LeaveFunction(11);
 	return NF_ACCEPT;
 
 drop:
-	ip_vs_conn_put(cp);
+	ip_vs_conn_touch(cp);
 	kfree_skb(skb);
 	LeaveFunction(11);
 	return NF_STOLEN;
@@ -1383,8 +1380,6 @@ ip_vs_in_icmp(struct sk_buff *skb, int *related, unsigned int hooknum)
 	verdict = ip_vs_icmp_xmit(skb, cp, pp, offset, hooknum);
 
 out:
-	__ip_vs_conn_put(cp);
-
 	return verdict;
 }
 
@@ -1470,8 +1465,6 @@ ip_vs_in_icmp_v6(struct sk_buff *skb, int *related, unsigned int hooknum)
 		offset += 2 * sizeof(__u16);
 	verdict = ip_vs_icmp_xmit_v6(skb, cp, pp, offset, hooknum);
 
-	__ip_vs_conn_put(cp);
-
 	return verdict;
 }
 #endif
@@ -1489,6 +1482,7 @@ ip_vs_in(unsigned int hooknum, struct sk_buff *skb, int af)
 	struct ip_vs_protocol *pp;
 	struct ip_vs_proto_data *pd;
 	struct ip_vs_conn *cp;
+	bool new_cp = false;
 	int ret, pkts;
 	struct netns_ipvs *ipvs;
 
@@ -1555,7 +1549,8 @@ ip_vs_in(unsigned int hooknum, struct sk_buff *skb, int af)
 		return NF_ACCEPT;
 	pp = pd->pp;
 	/*
-	 * Check if the packet belongs to an existing connection entry
+	 * Check if the packet belongs to an existing connection entry,
+	 * the entry found is not referenced, only a new one is
 	 */
 	cp = pp->conn_in_get(af, skb, &iph, iph.len, 0);
 
@@ -1564,6 +1559,7 @@ ip_vs_in(unsigned int hooknum, struct sk_buff *skb, int af)
 
 		if (!pp->conn_schedule(af, skb, pd, &v, &cp))
 			return v;
+		new_cp = cp != NULL;
 	}
 
 	if (unlikely(!cp)) {
@@ -1585,7 +1581,8 @@ ip_vs_in(unsigned int hooknum, struct sk_buff *skb, int af)
 		}
 		/* don't restart its timer, and silently
 		   drop the packet. */
-		__ip_vs_conn_put(cp);
+		if (new_cp)
+			__ip_vs_conn_put(cp);
 		return NF_DROP;
 	}
 
@@ -1616,7 +1613,10 @@ ip_vs_in(unsigned int hooknum, struct sk_buff *skb, int af)
 	if (ipvs->sync_state & IP_VS_STATE_MASTER)
 		ip_vs_sync_conn(net, cp, pkts);
 
-	ip_vs_conn_put(cp);
+	if (new_cp)
+		ip_vs_conn_put(cp);
+	else
+		ip_vs_conn_touch(cp);
 	return ret;
 }
 
@@ -65,7 +65,7 @@ ah_esp_conn_in_get(int af, const struct sk_buff *skb,
 	struct net *net = skb_net(skb);
 
 	ah_esp_conn_fill_param_proto(net, af, iph, inverse, &p);
-	cp = ip_vs_conn_in_get(&p);
+	cp = ip_vs_conn_in_get_noref(&p);
 	if (!cp) {
 		/*
 		 * We are not sure if the packet is from our
@@ -94,7 +94,7 @@ ah_esp_conn_out_get(int af, const struct sk_buff *skb,
 	struct net *net = skb_net(skb);
 
 	ah_esp_conn_fill_param_proto(net, af, iph, inverse, &p);
-	cp = ip_vs_conn_out_get(&p);
+	cp = ip_vs_conn_out_get_noref(&p);
 	if (!cp) {
 		IP_VS_DBG_BUF(12, "Unknown ISAKMP entry for inout packet "
 			      "%s%s %s->%s\n",
@@ -21,6 +21,7 @@
 #include <linux/list.h>
 #include <linux/module.h>
 #include <linux/random.h>
+#include <linux/rculist.h>
 #include <linux/skbuff.h>
 #include <linux/spinlock.h>
 #include <linux/netfilter/nf_conntrack_tcp.h>
@@ -31,36 +32,49 @@
 #include <net/netfilter/nf_conntrack_tuple.h>
 #include <net/netfilter/nf_conntrack_zones.h>
 
+#define CONNLIMIT_SLOTS		256
+#define CONNLIMIT_LOCK_SLOTS	32
+#define CONNLIMIT_GC_MAX_NODES	8
+
 /* we will save the tuples of all connections we care about */
 struct xt_connlimit_conn {
-	struct hlist_node		node;
+	struct list_head		list;
 	struct nf_conntrack_tuple	tuple;
-	union nf_inet_addr		addr;
+	unsigned long			added;		/* jiffies when saved */
+};
+
+/* the saved connections of one (masked) address */
+struct xt_connlimit_net {
+	struct hlist_node	node;
+	union nf_inet_addr	addr;
+	struct list_head	conns;
+	unsigned int		count;		/* entries on conns */
+	unsigned long		last_gc;	/* last walk over all of conns */
+	struct rcu_head		rcu;
 };
 
+/*
+ * Addresses are looked up under RCU, the lock of their slot covers
+ * adding and removing them as well as their list of connections.
+ */
 struct xt_connlimit_data {
-	struct hlist_head	iphash[256];
-	spinlock_t		lock;
+	struct hlist_head	iphash[CONNLIMIT_SLOTS];
+	spinlock_t		locks[CONNLIMIT_LOCK_SLOTS];
 };
 
 static u_int32_t connlimit_rnd __read_mostly;
 
 static inline unsigned int connlimit_iphash(__be32 addr)
 {
-	return jhash_1word((__force __u32)addr, connlimit_rnd) & 0xFF;
+	return jhash_1word((__force __u32)addr,
+			   connlimit_rnd) % CONNLIMIT_SLOTS;
 }
 
 static inline unsigned int
-connlimit_iphash6(const union nf_inet_addr *addr,
-                  const union nf_inet_addr *mask)
+connlimit_iphash6(const union nf_inet_addr *addr)
 {
-	union nf_inet_addr res;
-	unsigned int i;
-
-	for (i = 0; i < ARRAY_SIZE(addr->ip6); ++i)
-		res.ip6[i] = addr->ip6[i] & mask->ip6[i];
-
-	return jhash2((u32 *)res.ip6, ARRAY_SIZE(res.ip6), connlimit_rnd) & 0xFF;
+	return jhash2((u32 *)addr->ip6, ARRAY_SIZE(addr->ip6),
+		      connlimit_rnd) % CONNLIMIT_SLOTS;
 }
 
 static inline bool already_closed(const struct nf_conn *conn)
@@ -72,104 +86,172 @@ static inline bool already_closed(const struct nf_conn *conn)
 		return 0;
 }
 
-static inline unsigned int
-same_source_net(const union nf_inet_addr *addr,
-		const union nf_inet_addr *mask,
-		const union nf_inet_addr *u3, u_int8_t family)
+static void connlimit_mask(union nf_inet_addr *res,
+			   const union nf_inet_addr *addr,
+			   const union nf_inet_addr *mask, u_int8_t family)
 {
+	unsigned int i;
+
+	memset(res, 0, sizeof(*res));
 	if (family == NFPROTO_IPV4) {
-		return (addr->ip & mask->ip) == (u3->ip & mask->ip);
+		res->ip = addr->ip & mask->ip;
 	} else {
-		union nf_inet_addr lh, rh;
-		unsigned int i;
+		for (i = 0; i < ARRAY_SIZE(addr->ip6); ++i)
+			res->ip6[i] = addr->ip6[i] & mask->ip6[i];
+	}
+}
 
-		for (i = 0; i < ARRAY_SIZE(addr->ip6); ++i) {
-			lh.ip6[i] = addr->ip6[i] & mask->ip6[i];
-			rh.ip6[i] = u3->ip6[i] & mask->ip6[i];
-		}
+static struct xt_connlimit_net *
+connlimit_net_find(const struct hlist_head *head,
+		  const union nf_inet_addr *addr)
+{
+	struct xt_connlimit_net *cn;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry_rcu(cn, pos, head, node)
+		if (memcmp(&cn->addr, addr, sizeof(*addr)) == 0)
+			return cn;
+	return NULL;
+}
 
-		return memcmp(&lh.ip6, &rh.ip6, sizeof(lh.ip6)) == 0;
+/*
+ * Whether a saved connection still counts.  One that conntrack does not
+ * know may just not be confirmed yet, its first packet is still on its
+ * way through the hooks, so it is given a couple of jiffies.
+ */
+static bool connlimit_conn_alive(struct net *net,
+				 const struct xt_connlimit_conn *conn)
+{
+	const struct nf_conntrack_tuple_hash *found;
+	struct nf_conn *found_ct;
+	bool alive;
+
+	found = nf_conntrack_find_get(net, NF_CT_DEFAULT_ZONE, &conn->tuple);
+	if (found == NULL)
+		return time_before(jiffies, conn->added + 2);
+
+	found_ct = nf_ct_tuplehash_to_ctrack(found);
+	/*
+	 * we do not care about connections which are
+	 * closed already -> ditch it
+	 */
+	alive = !already_closed(found_ct);
+	nf_ct_put(found_ct);
+	return alive;
+}
+
+/*
+ * Check up to max of the saved connections, oldest first, and drop the
+ * ones that are gone.  Those still alive go to the end of the list so
+ * that the next partial walk looks at others.  Called with the slot
+ * lock held.
+ */
+static void connlimit_gc(struct net *net, struct xt_connlimit_net *cn,
+			 unsigned int max)
+{
+	struct xt_connlimit_conn *conn, *n;
+	LIST_HEAD(alive);
+
+	list_for_each_entry_safe(conn, n, &cn->conns, list) {
+		if (max-- == 0)
+			break;
+		if (connlimit_conn_alive(net, conn)) {
+			list_move_tail(&conn->list, &alive);
+			continue;
+		}
+		list_del(&conn->list);
+		kfree(conn);
+		cn->count--;
 	}
+	list_splice_tail(&alive, &cn->conns);
 }
 
+/*
+ * Number of connections from the network of addr.  A connection that
+ * is not confirmed yet is new and gets saved, one that is confirmed
+ * has been saved when it was new and only needs the count, which is
+ * read without any lock.  Saved connections that are gone are only
+ * noticed by partial walks when new ones are saved, so whenever the
+ * count is over the limit all of them are checked before it is
+ * believed, at most once a jiffy.
+ */
 static int count_them(struct net *net,
 		      struct xt_connlimit_data *data,
 		      const struct nf_conntrack_tuple *tuple,
 		      const union nf_inet_addr *addr,
 		      const union nf_inet_addr *mask,
-		      u_int8_t family)
+		      u_int8_t family, unsigned int limit, bool addit)
 {
-	const struct nf_conntrack_tuple_hash *found;
 	struct xt_connlimit_conn *conn;
-	struct hlist_node *pos, *n;
-	struct nf_conn *found_ct;
-	struct hlist_head *hash;
-	bool addit = true;
-	int matches = 0;
+	struct xt_connlimit_net *cn;
+	union nf_inet_addr key;
+	unsigned int hash;
+	spinlock_t *lock;
+	int matches;
 
+	connlimit_mask(&key, addr, mask, family);
 	if (family == NFPROTO_IPV6)
-		hash = &data->iphash[connlimit_iphash6(addr, mask)];
+		hash = connlimit_iphash6(&key);
 	else
-		hash = &data->iphash[connlimit_iphash(addr->ip & mask->ip)];
-
-	rcu_read_lock();
-
-	/* check the saved connections */
-	hlist_for_each_entry_safe(conn, pos, n, hash, node) {
-		found    = nf_conntrack_find_get(net, NF_CT_DEFAULT_ZONE,
-						 &conn->tuple);
-		found_ct = NULL;
-
-		if (found != NULL)
-			found_ct = nf_ct_tuplehash_to_ctrack(found);
-
-		if (found_ct != NULL &&
-		    nf_ct_tuple_equal(&conn->tuple, tuple) &&
-		    !already_closed(found_ct))
-			/*
-			 * Just to be sure we have it only once in the list.
-			 * We should not see tuples twice unless someone hooks
-			 * this into a table without "-p tcp --syn".
-			 */
-			addit = false;
-
-		if (found == NULL) {
-			/* this one is gone */
-			hlist_del(&conn->node);
-			kfree(conn);
-			continue;
-		}
+		hash = connlimit_iphash(key.ip);
 
-		if (already_closed(found_ct)) {
-			/*
-			 * we do not care about connections which are
-			 * closed already -> ditch it
-			 */
-			nf_ct_put(found_ct);
-			hlist_del(&conn->node);
-			kfree(conn);
-			continue;
-		}
+	if (!addit) {
+		rcu_read_lock();
+		cn = connlimit_net_find(&data->iphash[hash], &key);
+		matches = cn != NULL ? ACCESS_ONCE(cn->count) : 0;
+		rcu_read_unlock();
 
-		if (same_source_net(addr, mask, &conn->addr, family))
-			/* same source network -> be counted! */
-			++matches;
-		nf_ct_put(found_ct);
+		if (matches <= limit)
+			return matches;
 	}
 
-	rcu_read_unlock();
+	lock = &data->locks[hash % CONNLIMIT_LOCK_SLOTS];
+	spin_lock_bh(lock);
+
+	cn = connlimit_net_find(&data->iphash[hash], &key);
+	if (cn == NULL) {
+		if (!addit) {
+			spin_unlock_bh(lock);
+			return 0;
+		}
+		cn = kmalloc(sizeof(*cn), GFP_ATOMIC);
+		if (cn == NULL) {
+			spin_unlock_bh(lock);
+			return -ENOMEM;
+		}
+		cn->addr = key;
+		INIT_LIST_HEAD(&cn->conns);
+		cn->count = 0;
+		cn->last_gc = jiffies;
+		hlist_add_head_rcu(&cn->node, &data->iphash[hash]);
+	}
 
 	if (addit) {
+		connlimit_gc(net, cn, CONNLIMIT_GC_MAX_NODES);
+
 		/* save the new connection in our list */
 		conn = kmalloc(sizeof(*conn), GFP_ATOMIC);
-		if (conn == NULL)
-			return -ENOMEM;
+		if (conn == NULL) {
+			matches = -ENOMEM;
+			goto out;
+		}
 		conn->tuple = *tuple;
-		conn->addr = *addr;
-		hlist_add_head(&conn->node, hash);
-		++matches;
+		conn->added = jiffies;
+		list_add_tail(&conn->list, &cn->conns);
+		cn->count++;
 	}
 
+	if (cn->count > limit && cn->last_gc != jiffies) {
+		connlimit_gc(net, cn, UINT_MAX);
+		cn->last_gc = jiffies;
+	}
+	matches = cn->count;
+ out:
+	if (cn->count == 0) {
+		hlist_del_rcu(&cn->node);
+		kfree_rcu(cn, rcu);
+	}
+	spin_unlock_bh(lock);
 	return matches;
 }
 
@@ -182,7 +264,7 @@ connlimit_mt(const struct sk_buff *skb, struct xt_action_param *par)
 	struct nf_conntrack_tuple tuple;
 	const struct nf_conntrack_tuple *tuple_ptr = &tuple;
 	enum ip_conntrack_info ctinfo;
-	const struct nf_conn *ct;
+	struct nf_conn *ct;
 	int connections;
 
 	ct = nf_ct_get(skb, &ctinfo);
@@ -202,15 +284,17 @@ connlimit_mt(const struct sk_buff *skb, struct xt_action_param *par)
 			  iph->daddr : iph->saddr;
 	}
 
-	spin_lock_bh(&info->data->lock);
 	connections = count_them(net, info->data, tuple_ptr, &addr,
-	                         &info->mask, par->family);
-	spin_unlock_bh(&info->data->lock);
-
+	                         &info->mask, par->family, info->limit,
+	                         ct != NULL && !nf_ct_is_confirmed(ct));
 	if (connections < 0)
 		/* kmalloc failed, drop it entirely */
 		goto hotdrop;
 
+	if (ct == NULL)
+		/* cannot be saved without a conntrack, counts just once */
+		++connections;
+
 	return (connections > info->limit) ^
 	       !!(info->flags & XT_CONNLIMIT_INVERT);
 
@@ -247,7 +331,8 @@ static int connlimit_mt_check(const struct xt_mtchk_param *par)
 		return -ENOMEM;
 	}
 
-	spin_lock_init(&info->data->lock);
+	for (i = 0; i < ARRAY_SIZE(info->data->locks); ++i)
+		spin_lock_init(&info->data->locks[i]);
 	for (i = 0; i < ARRAY_SIZE(info->data->iphash); ++i)
 		INIT_HLIST_HEAD(&info->data->iphash[i]);
 
@@ -257,7 +342,8 @@ static int connlimit_mt_check(const struct xt_mtchk_param *par)
 static void connlimit_mt_destroy(const struct xt_mtdtor_param *par)
 {
 	const struct xt_connlimit_info *info = par->matchinfo;
-	struct xt_connlimit_conn *conn;
+	struct xt_connlimit_conn *conn, *next;
+	struct xt_connlimit_net *cn;
 	struct hlist_node *pos, *n;
 	struct hlist_head *hash = info->data->iphash;
 	unsigned int i;
@@ -265,9 +351,11 @@ static void connlimit_mt_destroy(const struct xt_mtdtor_param *par)
 	nf_ct_l3proto_module_put(par->family);
 
 	for (i = 0; i < ARRAY_SIZE(info->data->iphash); ++i) {
-		hlist_for_each_entry_safe(conn, pos, n, &hash[i], node) {
-			hlist_del(&conn->node);
-			kfree(conn);
+		hlist_for_each_entry_safe(cn, pos, n, &hash[i], node) {
+			list_for_each_entry_safe(conn, next, &cn->conns, list)
+				kfree(conn);
+			hlist_del(&cn->node);
+			kfree(cn);
 		}
 	}
 
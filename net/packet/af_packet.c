@@ -213,6 +213,25 @@ struct tpacket_kbdq_core {
 	struct timer_list retire_blk_timer;
 };
 
+/* Kernel state of a TPACKET_V3 tx block whose packets are being sent.
+ * The block stays TP_STATUS_SENDING until the last skb built from it is
+ * freed; pending holds one extra reference while packets are still
+ * taken from the block.
+ */
+struct tpacket_kbdq_tx {
+	struct tpacket_block_desc *pbd;
+	atomic_t	pending;
+	unsigned int	status;
+};
+
+/* kbdq tx - position of tpacket_snd() in the open block */
+struct tpacket_kbdq_tx_core {
+	struct tpacket_kbdq_tx	*blks;
+	struct tpacket_kbdq_tx	*cur;
+	unsigned int		next_offset;
+	unsigned int		pkts_left;
+};
+
 #define PGV_FROM_VMALLOC 1
 struct pgv {
 	char *buffer;
@@ -230,6 +249,7 @@ struct packet_ring_buffer {
 	unsigned int		pg_vec_len;
 
 	struct tpacket_kbdq_core	prb_bdqc;
+	struct tpacket_kbdq_tx_core	prb_txq;
 	atomic_t		pending;
 };
 
@@ -294,6 +314,7 @@ struct packet_sock {
 	unsigned int		tp_reserve;
 	unsigned int		tp_loss:1;
 	unsigned int		tp_tstamp;
+	int			fanout_cpu;
 	struct packet_type	prot_hook ____cacheline_aligned_in_smp;
 };
 
@@ -310,6 +331,7 @@ struct packet_fanout {
 	atomic_t		rr_cur;
 	struct list_head	list;
 	struct sock		*arr[PACKET_FANOUT_MAX];
+	struct sock		**cpu_arr;	/* PACKET_FANOUT_PERCPU */
 	spinlock_t		lock;
 	atomic_t		sk_ref;
 	struct packet_type	prot_hook ____cacheline_aligned_in_smp;
@@ -404,6 +426,7 @@ static void __packet_set_status(struct packet_sock *po, void *frame, int status)
 	union {
 		struct tpacket_hdr *h1;
 		struct tpacket2_hdr *h2;
+		struct tpacket_block_desc *pbd;
 		void *raw;
 	} h;
 
@@ -418,6 +441,10 @@ static void __packet_set_status(struct packet_sock *po, void *frame, int status)
 		flush_dcache_page(pgv_to_page(&h.h2->tp_status));
 		break;
 	case TPACKET_V3:
+		/* only the tx ring is frame addressed, one block per frame */
+		BLOCK_STATUS(h.pbd) = status;
+		flush_dcache_page(pgv_to_page(&BLOCK_STATUS(h.pbd)));
+		break;
 	default:
 		WARN(1, "TPACKET version not supported.\n");
 		BUG();
@@ -431,6 +458,7 @@ static int __packet_get_status(struct packet_sock *po, void *frame)
 	union {
 		struct tpacket_hdr *h1;
 		struct tpacket2_hdr *h2;
+		struct tpacket_block_desc *pbd;
 		void *raw;
 	} h;
 
@@ -445,6 +473,8 @@ static int __packet_get_status(struct packet_sock *po, void *frame)
 		flush_dcache_page(pgv_to_page(&h.h2->tp_status));
 		return h.h2->tp_status;
 	case TPACKET_V3:
+		flush_dcache_page(pgv_to_page(&BLOCK_STATUS(h.pbd)));
+		return BLOCK_STATUS(h.pbd);
 	default:
 		WARN(1, "TPACKET version not supported.\n");
 		BUG();
@@ -1205,6 +1235,21 @@ static struct sock *fanout_demux_cpu(struct packet_fanout *f, struct sk_buff *sk
 	return f->arr[cpu % num];
 }
 
+/* Every member serves the cpu it was bound to when joining, so its ring
+ * is only ever filled from one cpu.  Packets taken in on a cpu without a
+ * member of its own are spread by flow hash.
+ */
+static struct sock *fanout_demux_percpu(struct packet_fanout *f, struct sk_buff *skb, unsigned int num)
+{
+	struct sock *sk = ACCESS_ONCE(f->cpu_arr[smp_processor_id()]);
+
+	if (sk && pkt_sk(sk)->running)
+		return sk;
+
+	skb_get_rxhash(skb);
+	return fanout_demux_hash(f, skb, num);
+}
+
 static int packet_rcv_fanout(struct sk_buff *skb, struct net_device *dev,
 			     struct packet_type *pt, struct net_device *orig_dev)
 {
@@ -1236,6 +1281,9 @@ static int packet_rcv_fanout(struct sk_buff *skb, struct net_device *dev,
 	case PACKET_FANOUT_CPU:
 		sk = fanout_demux_cpu(f, skb, num);
 		break;
+	case PACKET_FANOUT_PERCPU:
+		sk = fanout_demux_percpu(f, skb, num);
+		break;
 	}
 
 	po = pkt_sk(sk);
@@ -1287,6 +1335,7 @@ static int fanout_add(struct sock *sk, u16 id, u16 type_flags)
 	struct packet_fanout *f, *match;
 	u8 type = type_flags & 0xff;
 	u8 defrag = (type_flags & PACKET_FANOUT_FLAG_DEFRAG) ? 1 : 0;
+	int cpu = -1;
 	int err;
 
 	switch (type) {
@@ -1294,6 +1343,12 @@ static int fanout_add(struct sock *sk, u16 id, u16 type_flags)
 	case PACKET_FANOUT_LB:
 	case PACKET_FANOUT_CPU:
 		break;
+	case PACKET_FANOUT_PERCPU:
+		/* The caller names its cpu by being bound to exactly one. */
+		if (cpumask_weight(tsk_cpus_allowed(current)) != 1)
+			return -EINVAL;
+		cpu = cpumask_first(tsk_cpus_allowed(current));
+		break;
 	default:
 		return -EINVAL;
 	}
@@ -1325,6 +1380,15 @@ static int fanout_add(struct sock *sk, u16 id, u16 type_flags)
 		match->id = id;
 		match->type = type;
 		match->defrag = defrag;
+		if (type == PACKET_FANOUT_PERCPU) {
+			match->cpu_arr = kcalloc(nr_cpu_ids,
+						 sizeof(*match->cpu_arr),
+						 GFP_KERNEL);
+			if (!match->cpu_arr) {
+				kfree(match);
+				goto out;
+			}
+		}
 		atomic_set(&match->rr_cur, 0);
 		INIT_LIST_HEAD(&match->list);
 		spin_lock_init(&match->lock);
@@ -1342,13 +1406,22 @@ static int fanout_add(struct sock *sk, u16 id, u16 type_flags)
 	    match->prot_hook.type == po->prot_hook.type &&
 	    match->prot_hook.dev == po->prot_hook.dev) {
 		err = -ENOSPC;
-		if (atomic_read(&match->sk_ref) < PACKET_FANOUT_MAX) {
-			__dev_remove_pack(&po->prot_hook);
-			po->fanout = match;
-			atomic_inc(&match->sk_ref);
-			__fanout_link(sk, po);
-			err = 0;
+		if (atomic_read(&match->sk_ref) >= PACKET_FANOUT_MAX)
+			goto out;
+		err = -EBUSY;
+		if (match->cpu_arr && match->cpu_arr[cpu])
+			goto out;
+		__dev_remove_pack(&po->prot_hook);
+		po->fanout = match;
+		po->fanout_cpu = cpu;
+		atomic_inc(&match->sk_ref);
+		__fanout_link(sk, po);
+		if (match->cpu_arr) {
+			spin_lock(&match->lock);
+			match->cpu_arr[cpu] = sk;
+			spin_unlock(&match->lock);
 		}
+		err = 0;
 	}
 out:
 	mutex_unlock(&fanout_mutex);
@@ -1367,9 +1440,15 @@ static void fanout_release(struct sock *sk)
 	po->fanout = NULL;
 
 	mutex_lock(&fanout_mutex);
+	if (f->cpu_arr) {
+		spin_lock(&f->lock);
+		f->cpu_arr[po->fanout_cpu] = NULL;
+		spin_unlock(&f->lock);
+	}
 	if (atomic_dec_and_test(&f->sk_ref)) {
 		list_del(&f->list);
 		dev_remove_pack(&f->prot_hook);
+		kfree(f->cpu_arr);
 		kfree(f);
 	}
 	mutex_unlock(&fanout_mutex);
@@ -1938,6 +2017,94 @@ ring_is_full:
 	goto drop_n_restore;
 }
 
+static void prb_put_tx_block(struct packet_sock *po,
+			     struct tpacket_kbdq_tx *blk)
+{
+	if (atomic_dec_and_test(&blk->pending))
+		__packet_set_status(po, blk->pbd, blk->status);
+}
+
+/* Start sending the block at the tx ring head, if user space handed it over */
+static bool prb_open_tx_block(struct packet_sock *po)
+{
+	struct packet_ring_buffer *rb = &po->tx_ring;
+	struct tpacket_kbdq_tx_core *txq = &rb->prb_txq;
+	struct tpacket_kbdq_tx *blk;
+
+	if (!packet_current_frame(po, rb, TP_STATUS_SEND_REQUEST))
+		return false;
+
+	blk = &txq->blks[rb->head];
+	packet_increment_head(rb);
+
+	blk->status = TP_STATUS_AVAILABLE;
+	atomic_set(&blk->pending, 1);
+	atomic_inc(&rb->pending);
+	__packet_set_status(po, blk->pbd, TP_STATUS_SENDING);
+
+	txq->cur = blk;
+	txq->pkts_left = BLOCK_NUM_PKTS(blk->pbd);
+	txq->next_offset = BLOCK_O2FP(blk->pbd);
+	return true;
+}
+
+/* Done taking packets from the open block: it is returned to user space
+ * with @status once the last of its skbs is freed.
+ */
+static void prb_close_tx_block(struct packet_sock *po, unsigned int status)
+{
+	struct packet_ring_buffer *rb = &po->tx_ring;
+	struct tpacket_kbdq_tx *blk = rb->prb_txq.cur;
+
+	rb->prb_txq.cur = NULL;
+	if (status != TP_STATUS_AVAILABLE)
+		blk->status = status;
+	atomic_dec(&rb->pending);
+	prb_put_tx_block(po, blk);
+}
+
+/* Next packet to send from a TPACKET_V3 tx ring, NULL if no block is ready
+ * or ERR_PTR(-EINVAL) if the block layout is corrupt.  Packets are chained
+ * from offset_to_first_pkt through tp_next_offset and must lie within
+ * their block.
+ */
+static struct tpacket3_hdr *prb_current_tx_frame(struct packet_sock *po)
+{
+	struct packet_ring_buffer *rb = &po->tx_ring;
+	struct tpacket_kbdq_tx_core *txq = &rb->prb_txq;
+	unsigned int off, hdrlen = po->tp_hdrlen - sizeof(struct sockaddr_ll);
+
+	while (!txq->cur || !txq->pkts_left) {
+		if (txq->cur)
+			prb_close_tx_block(po, TP_STATUS_AVAILABLE);
+		if (!prb_open_tx_block(po))
+			return NULL;
+	}
+
+	off = txq->next_offset;
+	if (unlikely(off < BLK_HDR_LEN || !IS_ALIGNED(off, V3_ALIGNMENT) ||
+		     off > rb->frame_size - hdrlen)) {
+		prb_close_tx_block(po, TP_STATUS_WRONG_FORMAT);
+		return ERR_PTR(-EINVAL);
+	}
+
+	return (struct tpacket3_hdr *)((char *)txq->cur->pbd + off);
+}
+
+static void prb_advance_tx_frame(struct packet_sock *po,
+				 struct tpacket3_hdr *ph)
+{
+	struct tpacket_kbdq_tx_core *txq = &po->tx_ring.prb_txq;
+	u32 next = ph->tp_next_offset;
+
+	txq->pkts_left--;
+	if (txq->pkts_left && !next)
+		txq->pkts_left = 0;
+	txq->next_offset += next;
+	if (!txq->pkts_left)
+		prb_close_tx_block(po, TP_STATUS_AVAILABLE);
+}
+
 static void tpacket_destruct_skb(struct sk_buff *skb)
 {
 	struct packet_sock *po = pkt_sk(skb->sk);
@@ -1947,7 +2114,10 @@ static void tpacket_destruct_skb(struct sk_buff *skb)
 		ph = skb_shinfo(skb)->destructor_arg;
 		BUG_ON(atomic_read(&po->tx_ring.pending) == 0);
 		atomic_dec(&po->tx_ring.pending);
-		__packet_set_status(po, ph, TP_STATUS_AVAILABLE);
+		if (po->tp_version == TPACKET_V3)
+			prb_put_tx_block(po, ph);
+		else
+			__packet_set_status(po, ph, TP_STATUS_AVAILABLE);
 	}
 
 	sock_wfree(skb);
@@ -1960,6 +2130,7 @@ static int tpacket_fill_skb(struct packet_sock *po, struct sk_buff *skb,
 	union {
 		struct tpacket_hdr *h1;
 		struct tpacket2_hdr *h2;
+		struct tpacket3_hdr *h3;
 		void *raw;
 	} ph;
 	int to_write, offset, len, tp_len, nr_frags, len_max;
@@ -1977,6 +2148,9 @@ static int tpacket_fill_skb(struct packet_sock *po, struct sk_buff *skb,
 	skb_shinfo(skb)->destructor_arg = ph.raw;
 
 	switch (po->tp_version) {
+	case TPACKET_V3:
+		tp_len = ph.h3->tp_len;
+		break;
 	case TPACKET_V2:
 		tp_len = ph.h2->tp_len;
 		break;
@@ -2051,6 +2225,83 @@ static int tpacket_fill_skb(struct packet_sock *po, struct sk_buff *skb,
 	return tp_len;
 }
 
+/* TPACKET_V3 tx: one call sends every block user space has marked
+ * TP_STATUS_SEND_REQUEST, so a whole batch of packets costs a single
+ * system call.  A block is handed back once all of its skbs are freed.
+ */
+static int tpacket_snd_v3(struct packet_sock *po, struct msghdr *msg,
+			  struct net_device *dev, __be16 proto,
+			  unsigned char *addr, int size_max)
+{
+	struct packet_ring_buffer *rb = &po->tx_ring;
+	unsigned int hdrlen = po->tp_hdrlen - sizeof(struct sockaddr_ll);
+	int hlen = LL_RESERVED_SPACE(dev);
+	int tlen = dev->needed_tailroom;
+	struct tpacket_kbdq_tx *blk;
+	struct tpacket3_hdr *ph;
+	struct sk_buff *skb;
+	int tp_len, len_sum = 0;
+	int err, room;
+
+	do {
+		ph = prb_current_tx_frame(po);
+		if (unlikely(IS_ERR(ph))) {
+			if (po->tp_loss)
+				continue;
+			return PTR_ERR(ph);
+		}
+
+		if (unlikely(ph == NULL)) {
+			schedule();
+			continue;
+		}
+
+		/* On failure the block stays open, the next call resumes
+		 * with this packet.
+		 */
+		skb = sock_alloc_send_skb(&po->sk,
+				hlen + tlen + sizeof(struct sockaddr_ll),
+				0, &err);
+		if (unlikely(skb == NULL))
+			return err;
+
+		/* a packet can not run past the end of its block */
+		blk = rb->prb_txq.cur;
+		room = rb->frame_size - ((char *)ph - (char *)blk->pbd) - hdrlen;
+		tp_len = tpacket_fill_skb(po, skb, ph, dev,
+					  min(size_max, room), proto,
+					  addr, hlen);
+		if (unlikely(tp_len < 0)) {
+			kfree_skb(skb);
+			if (po->tp_loss) {
+				prb_advance_tx_frame(po, ph);
+				continue;
+			}
+			prb_close_tx_block(po, TP_STATUS_WRONG_FORMAT);
+			return tp_len;
+		}
+
+		skb->destructor = tpacket_destruct_skb;
+		skb_shinfo(skb)->destructor_arg = blk;
+		atomic_inc(&blk->pending);
+		atomic_inc(&rb->pending);
+		prb_advance_tx_frame(po, ph);
+
+		err = dev_queue_xmit(skb);
+		if (unlikely(err > 0)) {
+			err = net_xmit_errno(err);
+			if (err)
+				return err;
+		}
+		len_sum += tp_len;
+	} while (likely((ph != NULL) ||
+			((!(msg->msg_flags & MSG_DONTWAIT)) &&
+			 (atomic_read(&rb->pending))))
+		);
+
+	return len_sum;
+}
+
 static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 {
 	struct sk_buff *skb;
@@ -2103,6 +2354,11 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 	if (size_max > dev->mtu + reserve)
 		size_max = dev->mtu + reserve;
 
+	if (po->tp_version == TPACKET_V3) {
+		err = tpacket_snd_v3(po, msg, dev, proto, addr, size_max);
+		goto out_put;
+	}
+
 	do {
 		ph = packet_current_frame(po, &po->tx_ring,
 				TP_STATUS_SEND_REQUEST);
@@ -3557,8 +3813,10 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring)
 {
 	struct pgv *pg_vec = NULL;
+	struct tpacket_kbdq_tx *tx_blks = NULL;
 	struct packet_sock *po = pkt_sk(sk);
 	int was_running, order = 0;
+	unsigned int i;
 	struct packet_ring_buffer *rb;
 	struct sk_buff_head *rb_queue;
 	__be16 num;
@@ -3566,12 +3824,6 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 	/* Added to avoid minimal code churn */
 	struct tpacket_req *req = &req_u->req;
 
-	/* Opening a Tx-ring is NOT supported in TPACKET_V3 */
-	if (!closing && tx_ring && (po->tp_version > TPACKET_V2)) {
-		WARN(1, "Tx-ring is not supported.\n");
-		goto out;
-	}
-
 	rb = tx_ring ? &po->tx_ring : &po->rx_ring;
 	rb_queue = tx_ring ? &sk->sk_write_queue : &sk->sk_receive_queue;
 
@@ -3626,12 +3878,21 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 			goto out;
 		switch (po->tp_version) {
 		case TPACKET_V3:
-		/* Transmit path is not supported. We checked
-		 * it above but just being paranoid
-		 */
-			if (!tx_ring)
+			if (!tx_ring) {
 				init_prb_bdqc(po, rb, pg_vec, req_u, tx_ring);
 				break;
+			}
+			/* The tx ring is walked block by block */
+			tx_blks = kcalloc(req->tp_block_nr, sizeof(*tx_blks),
+					  GFP_KERNEL);
+			if (unlikely(!tx_blks)) {
+				free_pg_vec(pg_vec, order, req->tp_block_nr);
+				goto out;
+			}
+			for (i = 0; i < req->tp_block_nr; i++)
+				tx_blks[i].pbd = (struct tpacket_block_desc *)
+						 pg_vec[i].buffer;
+			break;
 		default:
 			break;
 		}
@@ -3666,6 +3927,14 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		rb->frame_max = (req->tp_frame_nr - 1);
 		rb->head = 0;
 		rb->frame_size = req->tp_frame_size;
+		if (tx_ring && po->tp_version == TPACKET_V3) {
+			/* one "frame" per block, see __packet_get_status() */
+			rb->frames_per_block = 1;
+			rb->frame_max = req->tp_block_nr - 1;
+			rb->frame_size = req->tp_block_size;
+			swap(rb->prb_txq.blks, tx_blks);
+			rb->prb_txq.cur = NULL;
+		}
 		spin_unlock_bh(&rb_queue->lock);
 
 		swap(rb->pg_vec_order, order);
@@ -3688,7 +3957,7 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 	}
 	spin_unlock(&po->bind_lock);
 	if (closing && (po->tp_version > TPACKET_V2)) {
-		/* Because we don't support block-based V3 on tx-ring */
+		/* The tx ring has no retire timer */
 		if (!tx_ring)
 			prb_shutdown_retire_blk_timer(po, tx_ring, rb_queue);
 	}
@@ -3696,6 +3965,7 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 
 	if (pg_vec)
 		free_pg_vec(pg_vec, order, req->tp_block_nr);
+	kfree(tx_blks);
 out:
 	return err;
 }
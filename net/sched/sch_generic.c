@@ -25,6 +25,8 @@
 #include <linux/rcupdate.h>
 #include <linux/list.h>
 #include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/ptr_ring.h>
 #include <net/pkt_sched.h>
 #include <net/dst.h>
 
@@ -37,14 +39,24 @@
  * - enqueue, dequeue are serialized via qdisc root lock
  * - ingress filtering is also serialized via qdisc root lock
  * - updates to tree and tree walking are only done under the rtnl mutex.
+ *
+ * A TCQ_F_NOLOCK qdisc does not use the root lock on the fast path:
+ * its enqueue must be safe against concurrent callers, dequeue is
+ * serialised by qdisc->seqlock (see qdisc_run_begin()) and its counters
+ * live in qdisc->cpu_bstats/cpu_qstats.
  */
 
 static inline int dev_requeue_skb(struct sk_buff *skb, struct Qdisc *q)
 {
 	skb_dst_force(skb);
 	q->gso_skb = skb;
-	q->qstats.requeues++;
-	q->q.qlen++;	/* it's still part of the queue */
+	if (q->flags & TCQ_F_NOLOCK) {
+		qdisc_qstats_cpu_requeue(q);
+		this_cpu_inc(q->cpu_qstats->qlen);
+	} else {
+		q->qstats.requeues++;
+		q->q.qlen++;	/* it's still part of the queue */
+	}
 	__netif_schedule(q);
 
 	return 0;
@@ -54,6 +66,15 @@ static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
 {
 	struct sk_buff *skb = q->gso_skb;
 
+	/* Enqueuers that failed qdisc_run_begin() rely on us to see
+	 * their packet: clear the flag before looking at the queue.
+	 */
+	if ((q->flags & TCQ_F_NOLOCK) &&
+	    test_bit(__QDISC_STATE_MISSED, &q->state)) {
+		clear_bit(__QDISC_STATE_MISSED, &q->state);
+		smp_mb__after_clear_bit();
+	}
+
 	if (unlikely(skb)) {
 		struct net_device *dev = qdisc_dev(q);
 		struct netdev_queue *txq;
@@ -62,7 +83,10 @@ static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
 		txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
 		if (!netif_xmit_frozen_or_stopped(txq)) {
 			q->gso_skb = NULL;
-			q->q.qlen--;
+			if (q->flags & TCQ_F_NOLOCK)
+				this_cpu_dec(q->cpu_qstats->qlen);
+			else
+				q->q.qlen--;
 		} else
 			skb = NULL;
 	} else {
@@ -72,6 +96,36 @@ static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
 	return skb;
 }
 
+/* What to tell __qdisc_run() after a successful transmit.  A lockless
+ * qdisc has no exact queue length at hand; just try another dequeue.
+ */
+static inline int qdisc_backlog_hint(const struct Qdisc *q)
+{
+	if (q->flags & TCQ_F_NOLOCK)
+		return 1;
+	return qdisc_qlen(q);
+}
+
+/* Only a lockless qdisc feeding a single tx queue can pull more packets
+ * while the tx lock is held: a locked qdisc would need its root lock,
+ * which must never be taken under the tx lock.
+ */
+static inline bool qdisc_may_bulk(const struct Qdisc *q)
+{
+	return (q->flags & (TCQ_F_NOLOCK | TCQ_F_ONETXQUEUE)) ==
+	       (TCQ_F_NOLOCK | TCQ_F_ONETXQUEUE);
+}
+
+static inline int qdisc_avail_bulklimit(const struct netdev_queue *txq)
+{
+#ifdef CONFIG_BQL
+	/* Non-BQL migrated drivers will return 0, too. */
+	return dql_avail(&txq->dql);
+#else
+	return 0;
+#endif
+}
+
 static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 					   struct netdev_queue *dev_queue,
 					   struct Qdisc *q)
@@ -88,7 +142,7 @@ static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 		kfree_skb(skb);
 		net_warn_ratelimited("Dead loop on netdevice %s, fix it urgently!\n",
 				     dev_queue->dev->name);
-		ret = qdisc_qlen(q);
+		ret = qdisc_backlog_hint(q);
 	} else {
 		/*
 		 * Another cpu is holding lock, requeue & delay xmits for
@@ -104,7 +158,14 @@ static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 /*
  * Transmit one skb, and handle the return status as required. Holding the
  * __QDISC_STATE_RUNNING bit guarantees that only one CPU can execute this
- * function.
+ * function.  @root_lock is NULL for a TCQ_F_NOLOCK qdisc.
+ *
+ * When qdisc_may_bulk(), further skbs are dequeued and handed to the
+ * driver under the same tx lock, up to the room BQL reports in the
+ * device queue.  All but the last of them are sent with xmit_more set,
+ * so the driver can notify the hardware once per burst.  A burst ends
+ * before a packet that needs software fixups: those may drop it on the
+ * way to the driver, which would then never hear that the burst is over.
  *
  * Returns to the caller:
  *				0  - queue is empty or throttled.
@@ -117,19 +178,44 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 	int ret = NETDEV_TX_BUSY;
 
 	/* And release qdisc */
-	spin_unlock(root_lock);
+	if (root_lock)
+		spin_unlock(root_lock);
 
 	HARD_TX_LOCK(dev, txq, smp_processor_id());
-	if (!netif_xmit_frozen_or_stopped(txq))
-		ret = dev_hard_start_xmit(skb, dev, txq);
-
+	if (!netif_xmit_frozen_or_stopped(txq)) {
+		int bytelimit = qdisc_may_bulk(q) ? qdisc_avail_bulklimit(txq) : 0;
+
+		for (;;) {
+			struct sk_buff *next = NULL;
+			bool more;
+
+			/* We are the only consumer of a bulking qdisc, the
+			 * packet we peek at is the next one we dequeue.
+			 */
+			bytelimit -= skb->len;
+			if (bytelimit > 0)
+				next = q->ops->peek(q);
+			more = next && !dev_xmit_needs_fixup(next);
+
+			ret = dev_hard_start_xmit(skb, dev, txq, more);
+			if (!more || !dev_xmit_complete(ret) ||
+			    netif_xmit_frozen_or_stopped(txq))
+				break;
+
+			/* gso_skb was consumed by our caller */
+			skb = q->dequeue(q);
+			if (unlikely(!skb))
+				break;
+		}
+	}
 	HARD_TX_UNLOCK(dev, txq);
 
-	spin_lock(root_lock);
+	if (root_lock)
+		spin_lock(root_lock);
 
 	if (dev_xmit_complete(ret)) {
 		/* Driver sent out skb successfully or skb was consumed */
-		ret = qdisc_qlen(q);
+		ret = qdisc_backlog_hint(q);
 	} else if (ret == NETDEV_TX_LOCKED) {
 		/* Driver try lock failed */
 		ret = handle_dev_cpu_collision(skb, txq, q);
@@ -149,7 +235,8 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 }
 
 /*
- * NOTE: Called under qdisc_lock(q) with locally disabled BH.
+ * NOTE: Called under qdisc_lock(q) with locally disabled BH, or only
+ *	 with locally disabled BH for a TCQ_F_NOLOCK qdisc.
  *
  * __QDISC_STATE_RUNNING guarantees only one CPU can process
  * this qdisc at a time. qdisc_lock(q) serializes queue accesses for
@@ -179,7 +266,7 @@ static inline int qdisc_restart(struct Qdisc *q)
 	if (unlikely(!skb))
 		return 0;
 	WARN_ON_ONCE(skb_dst_is_noref(skb));
-	root_lock = qdisc_lock(q);
+	root_lock = (q->flags & TCQ_F_NOLOCK) ? NULL : qdisc_lock(q);
 	dev = qdisc_dev(q);
 	txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
 
@@ -423,85 +510,106 @@ static const u8 prio2band[TC_PRIO_MAX + 1] = {
 
 /*
  * Private data for a pfifo_fast scheduler containing:
- * 	- queues for the three band
- * 	- bitmap indicating which of the bands contain skbs
+ * 	- rings for the three bands, each holding up to tx_queue_len skbs
+ *
+ * The rings take their own producer/consumer locks, which lets
+ * pfifo_fast run as a TCQ_F_NOLOCK qdisc when it is the root of a
+ * transmit queue.  Elsewhere it runs under the root lock as usual and
+ * keeps its counters in the Qdisc itself.
  */
 struct pfifo_fast_priv {
-	u32 bitmap;
-	struct sk_buff_head q[PFIFO_FAST_BANDS];
+	struct ptr_ring q[PFIFO_FAST_BANDS];
 };
 
-/*
- * Convert a bitmap to the first band number where an skb is queued, where:
- * 	bitmap=0 means there are no skbs on any band.
- * 	bitmap=1 means there is an skb on band 0.
- *	bitmap=7 means there are skbs on all 3 bands, etc.
- */
-static const int bitmap2band[] = {-1, 0, 1, 0, 2, 0, 1, 0};
-
-static inline struct sk_buff_head *band2list(struct pfifo_fast_priv *priv,
-					     int band)
+static inline struct ptr_ring *band2list(struct pfifo_fast_priv *priv,
+					 int band)
 {
 	return priv->q + band;
 }
 
 static int pfifo_fast_enqueue(struct sk_buff *skb, struct Qdisc *qdisc)
 {
-	if (skb_queue_len(&qdisc->q) < qdisc_dev(qdisc)->tx_queue_len) {
-		int band = prio2band[skb->priority & TC_PRIO_MAX];
-		struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
-		struct sk_buff_head *list = band2list(priv, band);
+	int band = prio2band[skb->priority & TC_PRIO_MAX];
+	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
+	unsigned int pkt_len = qdisc_pkt_len(skb);
+
+	if (qdisc->flags & TCQ_F_NOLOCK) {
+		if (unlikely(ptr_ring_produce(band2list(priv, band), skb)))
+			return qdisc_drop_cpu(skb, qdisc);
+
+		/* skb may already be dequeued (and freed) by the runner */
+		this_cpu_inc(qdisc->cpu_qstats->qlen);
+		this_cpu_add(qdisc->cpu_qstats->backlog, pkt_len);
+	} else {
+		if (unlikely(ptr_ring_produce(band2list(priv, band), skb)))
+			return qdisc_drop(skb, qdisc);
 
-		priv->bitmap |= (1 << band);
 		qdisc->q.qlen++;
-		return __qdisc_enqueue_tail(skb, qdisc, list);
+		qdisc->qstats.backlog += pkt_len;
 	}
 
-	return qdisc_drop(skb, qdisc);
+	return NET_XMIT_SUCCESS;
 }
 
 static struct sk_buff *pfifo_fast_dequeue(struct Qdisc *qdisc)
 {
 	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
-	int band = bitmap2band[priv->bitmap];
-
-	if (likely(band >= 0)) {
-		struct sk_buff_head *list = band2list(priv, band);
-		struct sk_buff *skb = __qdisc_dequeue_head(qdisc, list);
-
-		qdisc->q.qlen--;
-		if (skb_queue_empty(list))
-			priv->bitmap &= ~(1 << band);
-
-		return skb;
+	struct sk_buff *skb = NULL;
+	int band;
+
+	for (band = 0; band < PFIFO_FAST_BANDS && !skb; band++)
+		skb = ptr_ring_consume(band2list(priv, band));
+
+	if (likely(skb)) {
+		if (qdisc->flags & TCQ_F_NOLOCK) {
+			this_cpu_dec(qdisc->cpu_qstats->qlen);
+			this_cpu_sub(qdisc->cpu_qstats->backlog,
+				     qdisc_pkt_len(skb));
+			qdisc_bstats_cpu_update(qdisc, skb);
+		} else {
+			qdisc->q.qlen--;
+			qdisc->qstats.backlog -= qdisc_pkt_len(skb);
+			qdisc_bstats_update(qdisc, skb);
+		}
 	}
 
-	return NULL;
+	return skb;
 }
 
 static struct sk_buff *pfifo_fast_peek(struct Qdisc *qdisc)
 {
 	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
-	int band = bitmap2band[priv->bitmap];
-
-	if (band >= 0) {
-		struct sk_buff_head *list = band2list(priv, band);
+	struct sk_buff *skb = NULL;
+	int band;
 
-		return skb_peek(list);
-	}
+	for (band = 0; band < PFIFO_FAST_BANDS && !skb; band++)
+		skb = ptr_ring_peek(band2list(priv, band));
 
-	return NULL;
+	return skb;
 }
 
 static void pfifo_fast_reset(struct Qdisc *qdisc)
 {
-	int prio;
 	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
+	struct sk_buff *skb;
+	int prio;
 
-	for (prio = 0; prio < PFIFO_FAST_BANDS; prio++)
-		__qdisc_reset_queue(qdisc, band2list(priv, prio));
+	/*
+	 * Other cpus may still be enqueueing on a TCQ_F_NOLOCK qdisc, so
+	 * its per cpu counters cannot simply be cleared: account for the
+	 * purged skbs as dequeue does, which keeps their sum right.
+	 */
+	for (prio = 0; prio < PFIFO_FAST_BANDS; prio++) {
+		while ((skb = ptr_ring_consume_bh(band2list(priv, prio))) != NULL) {
+			if (qdisc->flags & TCQ_F_NOLOCK) {
+				this_cpu_dec(qdisc->cpu_qstats->qlen);
+				this_cpu_sub(qdisc->cpu_qstats->backlog,
+					     qdisc_pkt_len(skb));
+			}
+			kfree_skb(skb);
+		}
+	}
 
-	priv->bitmap = 0;
 	qdisc->qstats.backlog = 0;
 	qdisc->q.qlen = 0;
 }
@@ -519,13 +627,39 @@ nla_put_failure:
 	return -1;
 }
 
-static int pfifo_fast_init(struct Qdisc *qdisc, struct nlattr *opt)
+static void pfifo_fast_destroy(struct Qdisc *qdisc)
 {
-	int prio;
 	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
+	int prio;
 
+	/* ->reset() already drained the rings */
 	for (prio = 0; prio < PFIFO_FAST_BANDS; prio++)
-		skb_queue_head_init(band2list(priv, prio));
+		ptr_ring_cleanup(band2list(priv, prio), NULL);
+
+	free_percpu(qdisc->cpu_bstats);
+	qdisc->cpu_bstats = NULL;
+	free_percpu(qdisc->cpu_qstats);
+	qdisc->cpu_qstats = NULL;
+}
+
+static int pfifo_fast_init(struct Qdisc *qdisc, struct nlattr *opt)
+{
+	unsigned int qlen = qdisc_dev(qdisc)->tx_queue_len;
+	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
+	int prio, err = 0;
+
+	for (prio = 0; prio < PFIFO_FAST_BANDS; prio++) {
+		if (ptr_ring_init(band2list(priv, prio), qlen, GFP_KERNEL))
+			err = -ENOMEM;
+	}
+
+	/* Only used once we become TCQ_F_NOLOCK, see qdisc_txq_attach() */
+	qdisc->cpu_bstats = alloc_percpu(struct gnet_stats_basic_cpu);
+	qdisc->cpu_qstats = alloc_percpu(struct gnet_stats_queue);
+	if (err || !qdisc->cpu_bstats || !qdisc->cpu_qstats) {
+		pfifo_fast_destroy(qdisc);
+		return -ENOMEM;
+	}
 
 	/* Can by-pass the queue discipline */
 	qdisc->flags |= TCQ_F_CAN_BYPASS;
@@ -539,6 +673,7 @@ struct Qdisc_ops pfifo_fast_ops __read_mostly = {
 	.dequeue	=	pfifo_fast_dequeue,
 	.peek		=	pfifo_fast_peek,
 	.init		=	pfifo_fast_init,
+	.destroy	=	pfifo_fast_destroy,
 	.reset		=	pfifo_fast_reset,
 	.dump		=	pfifo_fast_dump,
 	.owner		=	THIS_MODULE,
@@ -572,6 +707,7 @@ struct Qdisc *qdisc_alloc(struct netdev_queue *dev_queue,
 	INIT_LIST_HEAD(&sch->list);
 	skb_queue_head_init(&sch->q);
 	spin_lock_init(&sch->busylock);
+	spin_lock_init(&sch->seqlock);
 	sch->ops = ops;
 	sch->enqueue = ops->enqueue;
 	sch->dequeue = ops->dequeue;
@@ -620,6 +756,78 @@ void qdisc_reset(struct Qdisc *qdisc)
 }
 EXPORT_SYMBOL(qdisc_reset);
 
+/**
+ * qdisc_sync_cpu_stats - fold the per cpu counters of a lockless qdisc
+ * @q: qdisc to update
+ *
+ * A TCQ_F_NOLOCK qdisc never touches q->bstats, q->qstats or q->q.qlen;
+ * refresh them from the per cpu counters so that dumps and parents can
+ * keep using the regular fields.  Called under RTNL, the result is only
+ * a snapshot.
+ */
+void qdisc_sync_cpu_stats(struct Qdisc *q)
+{
+	struct gnet_stats_basic_packed bstats = { 0 };
+	struct gnet_stats_queue qstats = { 0 };
+	int i;
+
+	if (!(q->flags & TCQ_F_NOLOCK))
+		return;
+
+	for_each_possible_cpu(i) {
+		const struct gnet_stats_basic_cpu *bcpu;
+		const struct gnet_stats_queue *qcpu;
+		unsigned int start;
+		u64 bytes;
+		u32 packets;
+
+		bcpu = per_cpu_ptr(q->cpu_bstats, i);
+		do {
+			start = u64_stats_fetch_begin_bh(&bcpu->syncp);
+			bytes = bcpu->bstats.bytes;
+			packets = bcpu->bstats.packets;
+		} while (u64_stats_fetch_retry_bh(&bcpu->syncp, start));
+
+		bstats.bytes += bytes;
+		bstats.packets += packets;
+
+		qcpu = per_cpu_ptr(q->cpu_qstats, i);
+		qstats.qlen += qcpu->qlen;
+		qstats.backlog += qcpu->backlog;
+		qstats.drops += qcpu->drops;
+		qstats.requeues += qcpu->requeues;
+		qstats.overlimits += qcpu->overlimits;
+	}
+
+	q->bstats = bstats;
+	q->qstats = qstats;
+	q->q.qlen = qstats.qlen;
+}
+EXPORT_SYMBOL(qdisc_sync_cpu_stats);
+
+/**
+ * qdisc_txq_attach - note that a qdisc becomes the root of a tx queue
+ * @qdisc: qdisc being grafted, not yet visible to the transmit path
+ * @single: @qdisc serves this transmit queue only
+ *
+ * pfifo_fast can then drop the root lock (TCQ_F_NOLOCK): nothing but
+ * the transmit path and RTNL-serialised control code will touch it.
+ * Must be called under RTNL, before any packet is enqueued.
+ */
+void qdisc_txq_attach(struct Qdisc *qdisc, bool single)
+{
+	if (qdisc->flags & (TCQ_F_BUILTIN | TCQ_F_INGRESS))
+		return;
+
+	if (single)
+		qdisc->flags |= TCQ_F_ONETXQUEUE;
+
+	if (qdisc->ops == &pfifo_fast_ops && qdisc->cpu_qstats &&
+	    !qdisc->q.qlen)
+		qdisc->flags |= TCQ_F_NOLOCK;
+}
+EXPORT_SYMBOL(qdisc_txq_attach);
+
 static void qdisc_rcu_free(struct rcu_head *head)
 {
 	struct Qdisc *qdisc = container_of(head, struct Qdisc, rcu_head);
@@ -697,6 +905,7 @@ static void attach_one_default_qdisc(struct net_device *dev,
 			netdev_info(dev, "activation failed\n");
 			return;
 		}
+		qdisc_txq_attach(qdisc, true);
 	}
 	dev_queue->qdisc_sleeping = qdisc;
 }
@@ -782,12 +991,32 @@ static void dev_deactivate_queue(struct net_device *dev,
 			set_bit(__QDISC_STATE_DEACTIVATED, &qdisc->state);
 
 		rcu_assign_pointer(dev_queue->qdisc, qdisc_default);
+		if (qdisc->flags & TCQ_F_NOLOCK)
+			spin_lock(&qdisc->seqlock);
 		qdisc_reset(qdisc);
+		if (qdisc->flags & TCQ_F_NOLOCK)
+			spin_unlock(&qdisc->seqlock);
 
 		spin_unlock_bh(qdisc_lock(qdisc));
 	}
 }
 
+static void dev_reset_nolock_queue(struct net_device *dev,
+				   struct netdev_queue *dev_queue,
+				   void *_unused)
+{
+	struct Qdisc *qdisc = dev_queue->qdisc_sleeping;
+
+	if (!(qdisc->flags & TCQ_F_NOLOCK))
+		return;
+
+	spin_lock_bh(qdisc_lock(qdisc));
+	spin_lock(&qdisc->seqlock);
+	qdisc_reset(qdisc);
+	spin_unlock(&qdisc->seqlock);
+	spin_unlock_bh(qdisc_lock(qdisc));
+}
+
 static bool some_qdisc_is_busy(struct net_device *dev)
 {
 	unsigned int i;
@@ -846,9 +1075,17 @@ void dev_deactivate_many(struct list_head *head)
 		synchronize_net();
 
 	/* Wait for outstanding qdisc_run calls. */
-	list_for_each_entry(dev, head, unreg_list)
+	list_for_each_entry(dev, head, unreg_list) {
 		while (some_qdisc_is_busy(dev))
 			yield();
+
+		/* Lockless qdiscs test DEACTIVATED without the root lock,
+		 * a sender may have queued a packet after the reset above.
+		 */
+		if (sync_needed)
+			netdev_for_each_tx_queue(dev, dev_reset_nolock_queue,
+						 NULL);
+	}
 }
 
 void dev_deactivate(struct net_device *dev)
@@ -82,6 +82,7 @@ static void mq_attach(struct Qdisc *sch)
 
 	for (ntx = 0; ntx < dev->num_tx_queues; ntx++) {
 		qdisc = priv->qdiscs[ntx];
+		qdisc_txq_attach(qdisc, true);
 		qdisc = dev_graft_qdisc(qdisc->dev_queue, qdisc);
 		if (qdisc)
 			qdisc_destroy(qdisc);
@@ -102,6 +103,7 @@ static int mq_dump(struct Qdisc *sch, struct sk_buff *skb)
 
 	for (ntx = 0; ntx < dev->num_tx_queues; ntx++) {
 		qdisc = netdev_get_tx_queue(dev, ntx)->qdisc_sleeping;
+		qdisc_sync_cpu_stats(qdisc);
 		spin_lock_bh(qdisc_lock(qdisc));
 		sch->q.qlen		+= qdisc->q.qlen;
 		sch->bstats.bytes	+= qdisc->bstats.bytes;
@@ -149,6 +151,8 @@ static int mq_graft(struct Qdisc *sch, unsigned long cl, struct Qdisc *new,
 	if (dev->flags & IFF_UP)
 		dev_deactivate(dev);
 
+	if (new)
+		qdisc_txq_attach(new, true);
 	*old = dev_graft_qdisc(dev_queue, new);
 
 	if (dev->flags & IFF_UP)
@@ -193,6 +197,7 @@ static int mq_dump_class_stats(struct Qdisc *sch, unsigned long cl,
 	struct netdev_queue *dev_queue = mq_queue_get(sch, cl);
 
 	sch = dev_queue->qdisc_sleeping;
+	qdisc_sync_cpu_stats(sch);
 	sch->qstats.qlen = sch->q.qlen;
 	if (gnet_stats_copy_basic(d, &sch->bstats) < 0 ||
 	    gnet_stats_copy_queue(d, &sch->qstats) < 0)
@@ -172,6 +172,7 @@ static void mqprio_attach(struct Qdisc *sch)
 	/* Attach underlying qdisc */
 	for (ntx = 0; ntx < dev->num_tx_queues; ntx++) {
 		qdisc = priv->qdiscs[ntx];
+		qdisc_txq_attach(qdisc, true);
 		qdisc = dev_graft_qdisc(qdisc->dev_queue, qdisc);
 		if (qdisc)
 			qdisc_destroy(qdisc);
@@ -203,6 +204,8 @@ static int mqprio_graft(struct Qdisc *sch, unsigned long cl, struct Qdisc *new,
 	if (dev->flags & IFF_UP)
 		dev_deactivate(dev);
 
+	if (new)
+		qdisc_txq_attach(new, true);
 	*old = dev_graft_qdisc(dev_queue, new);
 
 	if (dev->flags & IFF_UP)
@@ -226,6 +229,7 @@ static int mqprio_dump(struct Qdisc *sch, struct sk_buff *skb)
 
 	for (i = 0; i < dev->num_tx_queues; i++) {
 		qdisc = netdev_get_tx_queue(dev, i)->qdisc;
+		qdisc_sync_cpu_stats(qdisc);
 		spin_lock_bh(qdisc_lock(qdisc));
 		sch->q.qlen		+= qdisc->q.qlen;
 		sch->bstats.bytes	+= qdisc->bstats.bytes;
@@ -335,6 +339,7 @@ static int mqprio_dump_class_stats(struct Qdisc *sch, unsigned long cl,
 
 		for (i = tc.offset; i < tc.offset + tc.count; i++) {
 			qdisc = netdev_get_tx_queue(dev, i)->qdisc;
+			qdisc_sync_cpu_stats(qdisc);
 			spin_lock_bh(qdisc_lock(qdisc));
 			bstats.bytes      += qdisc->bstats.bytes;
 			bstats.packets    += qdisc->bstats.packets;
@@ -354,6 +359,7 @@ static int mqprio_dump_class_stats(struct Qdisc *sch, unsigned long cl,
 		struct netdev_queue *dev_queue = mqprio_queue_get(sch, cl);
 
 		sch = dev_queue->qdisc_sleeping;
+		qdisc_sync_cpu_stats(sch);
 		sch->qstats.qlen = sch->q.qlen;
 		if (gnet_stats_copy_basic(d, &sch->bstats) < 0 ||
 		    gnet_stats_copy_queue(d, &sch->qstats) < 0)
@@ -2202,6 +2202,75 @@ out:
 	return err;
 }
 
+/*
+ * Wait until @sock is readable or the absolute monotonic @end_time passes.
+ * The socket is polled like select() does it, so the deadline is kept to
+ * the hrtimer resolution instead of that of the protocol's receive timeout.
+ * SO_RCVTIMEO still applies if it expires first.  Returns 1 once the
+ * receive side is shut down: nothing more will come, even though the
+ * protocol may keep saying -EAGAIN rather than reporting end of file.
+ */
+static int sock_wait_readable(struct socket *sock, struct timespec *end_time)
+{
+	long rcvtimeo = sock->sk->sk_rcvtimeo;
+	struct timespec end = *end_time;
+	struct poll_wqueues table;
+	struct timespec now;
+	unsigned int mask;
+	ktime_t expire;
+	int err = 0;
+
+	if (!end.tv_sec && !end.tv_nsec)
+		return -EAGAIN;
+	if (sock->sk->sk_shutdown & RCV_SHUTDOWN)
+		return 1;
+	if (signal_pending(current))
+		return -EINTR;
+
+	/* readable but nothing to receive: do not loop past the deadline */
+	ktime_get_ts(&now);
+	if (timespec_compare(&now, &end) >= 0)
+		return -EAGAIN;
+
+	if (rcvtimeo != MAX_SCHEDULE_TIMEOUT) {
+		struct timespec rcv_end;
+
+		jiffies_to_timespec(rcvtimeo, &rcv_end);
+		rcv_end = timespec_add(now, rcv_end);
+		if (timespec_compare(&rcv_end, &end) < 0)
+			end = rcv_end;
+	}
+	expire = timespec_to_ktime(end);
+
+	poll_initwait(&table);
+	for (;;) {
+		mask = sock->ops->poll(sock->file, sock, &table.pt);
+		/* Registered on the wait queues once, only re-check after */
+		table.pt._qproc = NULL;
+		if (mask & (POLLHUP | POLLRDHUP)) {
+			err = 1;
+			break;
+		}
+		if (mask & (POLLIN | POLLRDNORM | POLLERR))
+			break;
+		err = table.error;
+		if (err)
+			break;
+		if (signal_pending(current)) {
+			err = -EINTR;
+			break;
+		}
+		if (!poll_schedule_timeout(&table, TASK_INTERRUPTIBLE, &expire,
+					   current->timer_slack_ns)) {
+			err = -EAGAIN;
+			break;
+		}
+	}
+	poll_freewait(&table);
+
+	return err;
+}
+
 /*
  *     Linux recvmmsg interface
  */
@@ -2215,6 +2284,7 @@ int __sys_recvmmsg(int fd, struct mmsghdr __user *mmsg, unsigned int vlen,
 	struct compat_mmsghdr __user *compat_entry;
 	struct msghdr msg_sys;
 	struct timespec end_time;
+	unsigned int rflags;
 
 	if (timeout &&
 	    poll_select_set_timeout(&end_time, timeout->tv_sec,
@@ -2234,24 +2304,48 @@ int __sys_recvmmsg(int fd, struct mmsghdr __user *mmsg, unsigned int vlen,
 	entry = mmsg;
 	compat_entry = (struct compat_mmsghdr __user *)mmsg;
 
+	if (sock->file->f_flags & O_NONBLOCK)
+		flags |= MSG_DONTWAIT;
+
 	while (datagrams < vlen) {
+		/*
+		 * With a timeout, never let the protocol block: it would
+		 * only notice the deadline once a datagram arrives.  Wait
+		 * here instead, for no longer than the time that is left.
+		 */
+		rflags = flags & ~MSG_WAITFORONE;
+		if (timeout)
+			rflags |= MSG_DONTWAIT;
+
 		/*
 		 * No need to ask LSM for more than the first datagram.
 		 */
-		if (MSG_CMSG_COMPAT & flags) {
+		if (MSG_CMSG_COMPAT & flags)
 			err = __sys_recvmsg(sock, (struct msghdr __user *)compat_entry,
-					    &msg_sys, flags & ~MSG_WAITFORONE,
-					    datagrams);
-			if (err < 0)
+					    &msg_sys, rflags, datagrams);
+		else
+			err = __sys_recvmsg(sock, (struct msghdr __user *)entry,
+					    &msg_sys, rflags, datagrams);
+
+		if (err == -EAGAIN && timeout && !(flags & MSG_DONTWAIT)) {
+			err = sock_wait_readable(sock, &end_time);
+			if (!err) {
+				cond_resched();
+				continue;
+			}
+			if (err > 0) {
+				/* end of file, return what we have */
+				err = 0;
 				break;
+			}
+		}
+		if (err < 0)
+			break;
+
+		if (MSG_CMSG_COMPAT & flags) {
 			err = __put_user(err, &compat_entry->msg_len);
 			++compat_entry;
 		} else {
-			err = __sys_recvmsg(sock, (struct msghdr __user *)entry,
-					    &msg_sys, flags & ~MSG_WAITFORONE,
-					    datagrams);
-			if (err < 0)
-				break;
 			err = put_user(err, &entry->msg_len);
 			++entry;
 		}
@@ -2264,24 +2358,18 @@ int __sys_recvmmsg(int fd, struct mmsghdr __user *mmsg, unsigned int vlen,
 		if (flags & MSG_WAITFORONE)
 			flags |= MSG_DONTWAIT;
 
-		if (timeout) {
-			ktime_get_ts(timeout);
-			*timeout = timespec_sub(end_time, *timeout);
-			if (timeout->tv_sec < 0) {
-				timeout->tv_sec = timeout->tv_nsec = 0;
-				break;
-			}
-
-			/* Timeout, return less than vlen datagrams */
-			if (timeout->tv_nsec == 0 && timeout->tv_sec == 0)
-				break;
-		}
-
 		/* Out of band data, return right away */
 		if (msg_sys.msg_flags & MSG_OOB)
 			break;
 	}
 
+	if (timeout) {
+		ktime_get_ts(timeout);
+		*timeout = timespec_sub(end_time, *timeout);
+		if (timeout->tv_sec < 0)
+			timeout->tv_sec = timeout->tv_nsec = 0;
+	}
+
 out_put:
 	fput_light(sock->file, fput_needed);
 
@@ -2291,9 +2379,10 @@ out_put:
 	if (datagrams != 0) {
 		/*
 		 * We may return less entries than requested (vlen) if the
-		 * sock is non block and there aren't enough datagrams...
+		 * sock is non block and there aren't enough datagrams, or
+		 * if the timeout expired or a signal arrived meanwhile...
 		 */
-		if (err != -EAGAIN) {
+		if (err != -EAGAIN && err != -EINTR) {
 			/*
 			 * ... or  if recvmsg returns an error after we
 			 * received some datagrams, where we record the
@@ -80,6 +80,7 @@
 #include <linux/proc_fs.h>
 #include <linux/mutex.h>
 #include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #include <net/sock.h>
 #include <net/af_unix.h>
@@ -88,10 +89,15 @@
 
 /* Internal data structures and random procedures: */
 
+/*
+ * In-flight sockets are on gc_inflight_list, or on gc_dirty_list if they
+ * went in flight again since the last pass looked at them.
+ */
 static LIST_HEAD(gc_inflight_list);
+static LIST_HEAD(gc_dirty_list);
+static LIST_HEAD(gc_scan_list);
 static LIST_HEAD(gc_candidates);
 static DEFINE_SPINLOCK(unix_gc_lock);
-static DECLARE_WAIT_QUEUE_HEAD(unix_gc_wait);
 
 unsigned int unix_tot_inflight;
 
@@ -118,42 +124,72 @@ struct sock *unix_get_socket(struct file *filp)
 }
 
 /*
- *	Keep the number of times in flight count for the file
- *	descriptor if it is for an AF_UNIX socket.
+ *	Keep the number of times in flight count for every AF_UNIX socket
+ *	among the passed files.  A whole SCM_RIGHTS list is accounted with
+ *	one hold of unix_gc_lock, taken only if the list has such a socket.
  */
 
-void unix_inflight(struct file *fp)
+void unix_inflight(struct scm_fp_list *fpl)
 {
-	struct sock *s = unix_get_socket(fp);
-	if (s) {
-		struct unix_sock *u = unix_sk(s);
-		spin_lock(&unix_gc_lock);
+	bool locked = false;
+	int i;
+
+	for (i = fpl->count - 1; i >= 0; i--) {
+		struct sock *s = unix_get_socket(fpl->fp[i]);
+		struct unix_sock *u;
+
+		if (!s)
+			continue;
+		if (!locked) {
+			spin_lock(&unix_gc_lock);
+			locked = true;
+		}
+		u = unix_sk(s);
 		if (atomic_long_inc_return(&u->inflight) == 1) {
 			BUG_ON(!list_empty(&u->link));
-			list_add_tail(&u->link, &gc_inflight_list);
+			list_add_tail(&u->link, &gc_dirty_list);
+			u->gc_dirty = 1;
 		} else {
 			BUG_ON(list_empty(&u->link));
+			if (!u->gc_dirty) {
+				list_move_tail(&u->link, &gc_dirty_list);
+				u->gc_dirty = 1;
+			}
 		}
 		unix_tot_inflight++;
-		spin_unlock(&unix_gc_lock);
 	}
+	if (locked)
+		spin_unlock(&unix_gc_lock);
 }
 
-void unix_notinflight(struct file *fp)
+void unix_notinflight(struct scm_fp_list *fpl)
 {
-	struct sock *s = unix_get_socket(fp);
-	if (s) {
-		struct unix_sock *u = unix_sk(s);
-		spin_lock(&unix_gc_lock);
+	bool locked = false;
+	int i;
+
+	for (i = fpl->count - 1; i >= 0; i--) {
+		struct sock *s = unix_get_socket(fpl->fp[i]);
+		struct unix_sock *u;
+
+		if (!s)
+			continue;
+		if (!locked) {
+			spin_lock(&unix_gc_lock);
+			locked = true;
+		}
+		u = unix_sk(s);
 		BUG_ON(list_empty(&u->link));
-		if (atomic_long_dec_and_test(&u->inflight))
+		if (atomic_long_dec_and_test(&u->inflight)) {
 			list_del_init(&u->link);
+			u->gc_dirty = 0;
+		}
 		unix_tot_inflight--;
-		spin_unlock(&unix_gc_lock);
 	}
+	if (locked)
+		spin_unlock(&unix_gc_lock);
 }
 
-static void scan_inflight(struct sock *x, void (*func)(struct unix_sock *),
+static void scan_inflight(struct sock *x, bool (*func)(struct unix_sock *),
 			  struct sk_buff_head *hitlist)
 {
 	struct sk_buff *skb;
@@ -177,19 +213,8 @@ static void scan_inflight(struct sock *x, void (*func)(struct unix_sock *),
 				 *	if it indeed does so
 				 */
 				struct sock *sk = unix_get_socket(*fp++);
-				if (sk) {
-					struct unix_sock *u = unix_sk(sk);
-
-					/*
-					 * Ignore non-candidates, they could
-					 * have been added to the queues after
-					 * starting the garbage collection
-					 */
-					if (u->gc_candidate) {
-						hit = true;
-						func(u);
-					}
-				}
+				if (sk && func(unix_sk(sk)))
+					hit = true;
 			}
 			if (hit && hitlist != NULL) {
 				__skb_unlink(skb, &x->sk_receive_queue);
@@ -200,7 +225,7 @@ static void scan_inflight(struct sock *x, void (*func)(struct unix_sock *),
 	spin_unlock(&x->sk_receive_queue.lock);
 }
 
-static void scan_children(struct sock *x, void (*func)(struct unix_sock *),
+static void scan_children(struct sock *x, bool (*func)(struct unix_sock *),
 			  struct sk_buff_head *hitlist)
 {
 	if (x->sk_state != TCP_LISTEN)
@@ -236,18 +261,31 @@ static void scan_children(struct sock *x, void (*func)(struct unix_sock *),
 	}
 }
 
-static void dec_inflight(struct unix_sock *usk)
+/*
+ * The callbacks below only touch candidates: other sockets could have
+ * been added to the queues after starting the garbage collection.
+ */
+
+static bool dec_inflight(struct unix_sock *usk)
 {
+	if (!usk->gc_candidate)
+		return false;
 	atomic_long_dec(&usk->inflight);
+	return true;
 }
 
-static void inc_inflight(struct unix_sock *usk)
+static bool inc_inflight(struct unix_sock *usk)
 {
+	if (!usk->gc_candidate)
+		return false;
 	atomic_long_inc(&usk->inflight);
+	return true;
 }
 
-static void inc_inflight_move_tail(struct unix_sock *u)
+static bool inc_inflight_move_tail(struct unix_sock *u)
 {
+	if (!u->gc_candidate)
+		return false;
 	atomic_long_inc(&u->inflight);
 	/*
 	 * If this still might be part of a cycle, move it to the end
@@ -256,43 +294,56 @@ static void inc_inflight_move_tail(struct unix_sock *u)
 	 */
 	if (u->gc_maybe_cycle)
 		list_move_tail(&u->link, &gc_candidates);
+	return true;
 }
 
-static bool gc_in_progress = false;
-#define UNIX_INFLIGHT_TRIGGER_GC 16000
-
-void wait_for_unix_gc(void)
+/*
+ * A cycle through a candidate goes through the sockets in flight in its
+ * queue, so those have to be looked at in the same pass.
+ */
+static bool gather_inflight(struct unix_sock *u)
 {
-	/*
-	 * If number of inflight sockets is insane,
-	 * force a garbage collect right now.
-	 */
-	if (unix_tot_inflight > UNIX_INFLIGHT_TRIGGER_GC && !gc_in_progress)
-		unix_gc();
-	wait_event(unix_gc_wait, gc_in_progress == false);
+	if (!u->gc_scanned && !u->gc_candidate) {
+		u->gc_scanned = 1;
+		u->gc_dirty = 0;
+		list_move_tail(&u->link, &gc_scan_list);
+	}
+	return false;
 }
 
-/* The external entry point: unix_gc() */
-void unix_gc(void)
+#define UNIX_INFLIGHT_TRIGGER_GC 16000
+/*
+ * Full passes run at most that often, and once an incremental pass
+ * ran, a full one follows that long after the previous full one.
+ */
+#define UNIX_GC_FULL_INTERVAL	HZ
+
+static void unix_gc_pass(bool full)
 {
 	struct unix_sock *u;
-	struct unix_sock *next;
 	struct sk_buff_head hitlist;
 	struct list_head cursor;
 	LIST_HEAD(not_cycle_list);
+	LIST_HEAD(examined);
 
 	spin_lock(&unix_gc_lock);
 
-	/* Avoid a recursive GC. */
-	if (gc_in_progress)
-		goto out;
-
-	gc_in_progress = true;
 	/*
 	 * First, select candidates for garbage collection.  Only
 	 * in-flight sockets are considered, and from those only ones
 	 * which don't have any external reference.
 	 *
+	 * A socket only turns into garbage along with the sockets in
+	 * flight in its queue, so a pass looks at the sockets sent
+	 * since the last one and, for those without external
+	 * references, at everything in flight below them.  Garbage
+	 * whose last external reference was closed without anything
+	 * being sent is left to the full pass, which starts from every
+	 * in-flight socket and follows every incremental one within
+	 * UNIX_GC_FULL_INTERVAL.  Looking at a subset is safe:
+	 * a socket referenced from outside it keeps its inflight count
+	 * and is not freed.
+	 *
 	 * Holding unix_gc_lock will protect these candidates from
 	 * being detached, and hence from gaining an external
 	 * reference.  Since there are no possible receivers, all
@@ -304,10 +355,24 @@ void unix_gc(void)
 	 * added to queue, so we must make sure only to touch
 	 * candidates.
 	 */
-	list_for_each_entry_safe(u, next, &gc_inflight_list, link) {
+	list_for_each_entry(u, &gc_dirty_list, link) {
+		u->gc_dirty = 0;
+		u->gc_scanned = 1;
+	}
+	list_splice_tail_init(&gc_dirty_list, &gc_scan_list);
+	if (full) {
+		list_for_each_entry(u, &gc_inflight_list, link)
+			u->gc_scanned = 1;
+		list_splice_tail_init(&gc_inflight_list, &gc_scan_list);
+	}
+
+	while (!list_empty(&gc_scan_list)) {
 		long total_refs;
 		long inflight_refs;
 
+		u = list_first_entry(&gc_scan_list, struct unix_sock, link);
+		u->gc_scanned = 0;
+
 		total_refs = file_count(u->sk.sk_socket->file);
 		inflight_refs = atomic_long_read(&u->inflight);
 
@@ -317,8 +382,12 @@ void unix_gc(void)
 			list_move_tail(&u->link, &gc_candidates);
 			u->gc_candidate = 1;
 			u->gc_maybe_cycle = 1;
+			scan_children(&u->sk, gather_inflight, NULL);
+		} else {
+			list_move_tail(&u->link, &examined);
 		}
 	}
+	list_splice_tail(&examined, &gc_inflight_list);
 
 	/*
 	 * Now remove all internal in-flight reference to children of
@@ -378,9 +447,86 @@ void unix_gc(void)
 
 	/* All candidates should have been detached by now. */
 	BUG_ON(!list_empty(&gc_candidates));
-	gc_in_progress = false;
-	wake_up(&unix_gc_wait);
 
- out:
 	spin_unlock(&unix_gc_lock);
 }
+
+static bool gc_full_pending;
+static unsigned long gc_last_full = INITIAL_JIFFIES;
+
+static void unix_gc_work(struct work_struct *work);
+static void unix_gc_full_work(struct work_struct *work);
+
+/* system_nrt_wq never runs two passes at the same time */
+static DECLARE_WORK(unix_gc_worker, unix_gc_work);
+/*
+ * Queues the pass once a full one is due.  A separate item, so that a
+ * pending full pass does not hold back the passes queued meanwhile.
+ */
+static DECLARE_DELAYED_WORK(unix_gc_full_worker, unix_gc_full_work);
+
+static void unix_gc_work(struct work_struct *work)
+{
+	long delay = -1;
+	bool full;
+
+	spin_lock(&unix_gc_lock);
+	full = gc_full_pending ||
+	       time_after_eq(jiffies, gc_last_full + UNIX_GC_FULL_INTERVAL);
+	if (full) {
+		gc_full_pending = false;
+		gc_last_full = jiffies;
+	}
+	spin_unlock(&unix_gc_lock);
+
+	unix_gc_pass(full);
+
+	/*
+	 * An incremental pass misses garbage whose last external
+	 * reference goes away without anything being sent, and nothing
+	 * else may come along to find it.  Have a full pass follow.
+	 */
+	spin_lock(&unix_gc_lock);
+	if (!full && unix_tot_inflight)
+		delay = max_t(long, 0, (long)(gc_last_full +
+				UNIX_GC_FULL_INTERVAL - jiffies));
+	spin_unlock(&unix_gc_lock);
+
+	if (delay >= 0)
+		queue_delayed_work(system_nrt_wq, &unix_gc_full_worker, delay);
+}
+
+static void unix_gc_full_work(struct work_struct *work)
+{
+	queue_work(system_nrt_wq, &unix_gc_worker);
+}
+
+void wait_for_unix_gc(void)
+{
+	/*
+	 * If number of inflight sockets is insane, have all of
+	 * them looked at soon, but not over and over while it stays
+	 * high.  Senders never wait for the collector.
+	 */
+	if (unix_tot_inflight > UNIX_INFLIGHT_TRIGGER_GC &&
+	    !ACCESS_ONCE(gc_full_pending) &&
+	    time_after(jiffies, ACCESS_ONCE(gc_last_full) + HZ / 10)) {
+		spin_lock(&unix_gc_lock);
+		gc_full_pending = true;
+		spin_unlock(&unix_gc_lock);
+		queue_work(system_nrt_wq, &unix_gc_worker);
+	}
+}
+
+/* The external entry point: unix_gc() */
+void unix_gc(void)
+{
+	queue_work(system_nrt_wq, &unix_gc_worker);
+}
+
+void unix_gc_flush(void)
+{
+	cancel_delayed_work_sync(&unix_gc_full_worker);
+	flush_work(&unix_gc_worker);
+	cancel_delayed_work_sync(&unix_gc_full_worker);
+}
@@ -0,0 +1,190 @@
+/*
+ * connect() rate with most of the ephemeral port range in use.
+ *
+ * Opens a listener on the loopback, holds a number of established
+ * connections to it, all from ephemeral ports towards the same
+ * destination, then times further connect() calls to that destination.
+ * Each timed connection is reset on close so that it leaves no
+ * TIME_WAIT behind and the occupancy stays what was set up.  Compare the
+ * rate for different numbers of held connections, against the size of
+ * net.ipv4.ip_local_port_range.
+ *
+ * Needs a large RLIMIT_NOFILE.
+ *
+ *   ./connect_bench [-n held] [-c connects] [-p port]
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static int num_held = 20000;
+static int num_connects = 10000;
+static int port = 9098;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* accept everything and close it at once, the client end stays open */
+static void *acceptor(void *arg)
+{
+	int lfd = *(int *)arg;
+	int fd;
+
+	for (;;) {
+		fd = accept(lfd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;
+		}
+		close(fd);
+	}
+	return NULL;
+}
+
+static int connect_one(const struct sockaddr_in *sin)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (fd < 0)
+		return -1;
+	if (connect(fd, (const struct sockaddr *)sin, sizeof(*sin))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n held] [-c connects] [-p port]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct linger lin = { .l_onoff = 1, .l_linger = 0 };
+	struct sockaddr_in sin;
+	struct rlimit rl;
+	pthread_t thread;
+	double start, elapsed;
+	int *held;
+	int lfd, fd, opt, i, one = 1, low = 0, high = 0;
+	FILE *f;
+
+	while ((opt = getopt(argc, argv, "n:c:p:")) != -1) {
+		switch (opt) {
+		case 'n':
+			num_held = atoi(optarg);
+			break;
+		case 'c':
+			num_connects = atoi(optarg);
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (num_held < 0 || num_connects < 1 || port < 1 || port > 65535)
+		usage(argv[0]);
+
+	if (!getrlimit(RLIMIT_NOFILE, &rl)) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	if (getrlimit(RLIMIT_NOFILE, &rl) || rl.rlim_cur < num_held + 64) {
+		fprintf(stderr, "RLIMIT_NOFILE too small for %d connections\n",
+			num_held);
+		return 1;
+	}
+
+	f = fopen("/proc/sys/net/ipv4/ip_local_port_range", "r");
+	if (f) {
+		if (fscanf(f, "%d %d", &low, &high) != 2)
+			low = high = 0;
+		fclose(f);
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (lfd < 0) {
+		perror("socket");
+		return 1;
+	}
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(lfd, (struct sockaddr *)&sin, sizeof(sin)) ||
+	    listen(lfd, 4096)) {
+		perror("bind/listen");
+		return 1;
+	}
+	if (pthread_create(&thread, NULL, acceptor, &lfd)) {
+		fprintf(stderr, "pthread_create failed\n");
+		return 1;
+	}
+
+	held = calloc(num_held ? num_held : 1, sizeof(*held));
+	if (!held) {
+		perror("calloc");
+		return 1;
+	}
+	for (i = 0; i < num_held; i++) {
+		held[i] = connect_one(&sin);
+		if (held[i] < 0) {
+			fprintf(stderr, "could only hold %d connections: %s\n",
+				i, strerror(errno));
+			num_held = i;
+			break;
+		}
+	}
+
+	start = now();
+	for (i = 0; i < num_connects; i++) {
+		fd = connect_one(&sin);
+		if (fd < 0) {
+			fprintf(stderr, "connect %d failed: %s\n", i,
+				strerror(errno));
+			break;
+		}
+		setsockopt(fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+		close(fd);
+	}
+	elapsed = now() - start;
+
+	printf("port range %d-%d, %d held: %d connects in %.3f s, %.0f connect/s, %.1f us each\n",
+	       low, high, num_held, i, elapsed, i / elapsed,
+	       i ? elapsed * 1e6 / i : 0);
+
+	for (i = 0; i < num_held; i++)
+		close(held[i]);
+	free(held);
+	close(lfd);
+	return 0;
+}
@@ -0,0 +1,103 @@
+#!/bin/bash
+#
+# FIB lookup benchmark: fill a spare routing table with a synthetic,
+# internet-like set of blackhole routes (mostly /24s, some /16 to /23 and
+# a few shorter ones), then time lookups of random destinations in it
+# with the fib_trie_bench module, once through the trie alone and once
+# with direct lookup arrays enabled for the table via
+# net.ipv4.fib_dir_tables.
+#
+# Needs root, ip, awk, CONFIG_IP_FIB_TRIE_DIR and
+# CONFIG_IP_FIB_TRIE_BENCH=m.
+#
+#   ROUTES=500000 LOOKUPS=20000000 ./fib_lookup_bench.sh
+
+ROUTES=${ROUTES:-500000}
+LOOKUPS=${LOOKUPS:-10000000}
+TABLE=${TABLE:-100}
+SYSCTL=/proc/sys/net/ipv4/fib_dir_tables
+BATCH=/tmp/fib_lookup_bench.$$
+
+prerequisite()
+{
+	msg="skip all tests:"
+
+	if [ $UID != 0 ]; then
+		echo $msg must be run as root >&2
+		exit 0
+	fi
+
+	if [ ! -f $SYSCTL ]; then
+		echo $msg $SYSCTL is not available >&2
+		exit 0
+	fi
+
+	if ! modinfo fib_trie_bench > /dev/null 2>&1; then
+		echo $msg fib_trie_bench module is not available >&2
+		exit 0
+	fi
+
+	for cmd in ip awk; do
+		if ! which $cmd > /dev/null 2>&1; then
+			echo $msg $cmd is not available >&2
+			exit 0
+		fi
+	done
+}
+
+cleanup()
+{
+	[ -n "$SAVED" ] && echo $SAVED > $SYSCTL
+	ip route flush table $TABLE > /dev/null 2>&1
+	rm -f $BATCH
+}
+
+setup()
+{
+	SAVED=$(cat $SYSCTL)
+	echo 0 0 0 0 > $SYSCTL
+
+	ip route flush table $TABLE > /dev/null 2>&1
+	awk -v n=$ROUTES -v table=$TABLE 'BEGIN {
+		srand(1);
+		for (i = 0; i < n; i++) {
+			r = rand();
+			if (r < 0.55)
+				len = 24;
+			else if (r < 0.95)
+				len = 16 + int(rand() * 8);
+			else
+				len = 8 + int(rand() * 8);
+			a = int(rand() * 4294967296);
+			a -= a % 2 ^ (32 - len);
+			printf "route replace blackhole %d.%d.%d.%d/%d table %d\n",
+			       int(a / 16777216), int(a / 65536) % 256,
+			       int(a / 256) % 256, a % 256, len, table;
+		}
+	}' > $BATCH
+	if ! ip -batch $BATCH; then
+		echo "failed to load routes into table $TABLE" >&2
+		exit 1
+	fi
+}
+
+# run_bench: time LOOKUPS lookups in TABLE and print the module's report
+run_bench()
+{
+	# the module reports and refuses to stay loaded
+	modprobe fib_trie_bench table=$TABLE lookups=$LOOKUPS > /dev/null 2>&1
+	dmesg | grep "fib_trie_bench:" | tail -n 1 | sed 's/^.*fib_trie_bench: //'
+}
+
+prerequisite
+trap cleanup EXIT
+setup
+
+echo "table $TABLE: $(ip route show table $TABLE | wc -l) routes, $LOOKUPS lookups"
+run_bench
+
+echo "$TABLE 0 0 0" > $SYSCTL || exit 1
+grep "Direct chunks" /proc/net/fib_triestat
+run_bench
+
+exit 0
@@ -0,0 +1,100 @@
+#!/bin/bash
+#
+# Local scenario for the fq packet scheduler: a TCP bulk sender behind
+# fq talks over a veth pair to a receiver in another network namespace,
+# with netem adding delay on the return path.  With pacing, the sender
+# spreads each congestion window over the RTT instead of bursting it,
+# which shows up as throttled flows in the fq statistics.
+#
+# Needs root, ip with netns support, tc with fq support and nc.
+
+NS=fq-pacing-test
+PORT=12865
+DELAY=${DELAY:-20ms}
+SIZE_MB=${SIZE_MB:-16}
+
+prerequisite()
+{
+	msg="skip all tests:"
+
+	if [ $UID != 0 ]; then
+		echo $msg must be run as root >&2
+		exit 0
+	fi
+
+	for cmd in ip tc nc dd; do
+		if ! which $cmd > /dev/null 2>&1; then
+			echo $msg $cmd is not available >&2
+			exit 0
+		fi
+	done
+}
+
+cleanup()
+{
+	ip netns del $NS > /dev/null 2>&1
+	ip link del fq-veth0 > /dev/null 2>&1
+}
+
+setup()
+{
+	ip netns add $NS || exit 1
+	ip link add fq-veth0 type veth peer name fq-veth1 || exit 1
+	ip link set fq-veth1 netns $NS
+	ip addr add 192.168.254.1/24 dev fq-veth0
+	ip link set fq-veth0 up
+	ip netns exec $NS ip addr add 192.168.254.2/24 dev fq-veth1
+	ip netns exec $NS ip link set fq-veth1 up
+	ip netns exec $NS ip link set lo up
+
+	# RTT comes from delaying the ACKs sent back by the receiver
+	if ! ip netns exec $NS tc qdisc add dev fq-veth1 root netem \
+	     delay $DELAY; then
+		echo "skip all tests: netem is not available" >&2
+		cleanup
+		exit 0
+	fi
+
+	if ! tc qdisc add dev fq-veth0 root fq; then
+		echo "skip all tests: tc does not support fq" >&2
+		cleanup
+		exit 0
+	fi
+}
+
+run()
+{
+	local start end
+
+	ip netns exec $NS nc -l $PORT > /dev/null &
+	sleep 1
+
+	start=`date +%s.%N`
+	if ! dd if=/dev/zero bs=1M count=$SIZE_MB 2> /dev/null | \
+	     nc -q 0 192.168.254.2 $PORT > /dev/null 2>&1; then
+		# nc flavours without -q
+		dd if=/dev/zero bs=1M count=$SIZE_MB 2> /dev/null | \
+			nc 192.168.254.2 $PORT > /dev/null 2>&1
+	fi
+	end=`date +%s.%N`
+	wait
+
+	echo "sent ${SIZE_MB}MB with ${DELAY} delay in" \
+	     `echo "$end - $start" | bc 2> /dev/null || echo "?"` "s"
+	tc -s qdisc show dev fq-veth0
+
+	if tc -s qdisc show dev fq-veth0 | grep -q "Sent 0 bytes"; then
+		echo "fq_pacing: no traffic went through fq"
+		return 1
+	fi
+	echo "fq_pacing: [PASS]"
+	return 0
+}
+
+prerequisite
+cleanup
+setup
+run
+ret=$?
+cleanup
+exit $ret
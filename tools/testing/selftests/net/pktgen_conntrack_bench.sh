@@ -0,0 +1,137 @@
+#!/bin/bash
+#
+# Connection tracking scalability benchmark: run pktgen on 1..N threads,
+# each sending UDP packets with random source addresses and ports into
+# one end of a veth pair.  The other end sits in its own network
+# namespace with the packets addressed to it, so every packet creates,
+# confirms and later expires a conntrack entry on the cpu that sent it.
+# Reports the aggregate packet rate and the conntrack insert rate for
+# each thread count, which shows how well the conntrack hash and its
+# locking scale with the number of cpus creating connections.
+#
+# Needs root, pktgen, veth, network namespaces and nf_conntrack_ipv4.
+#
+#   MAX_THREADS=8 COUNT=1000000 ./pktgen_conntrack_bench.sh
+
+PKT_SIZE=${PKT_SIZE:-60}
+COUNT=${COUNT:-1000000}
+MAX_THREADS=${MAX_THREADS:-$(grep -c ^processor /proc/cpuinfo)}
+NS=ct-bench
+DEV=ct-bench0
+PEER=ct-bench1
+SRC=198.18.0.1
+DST=198.18.0.2
+
+source $(dirname $0)/pktgen_functions.sh
+
+prerequisite()
+{
+	pg_prerequisite
+
+	modprobe nf_conntrack_ipv4 > /dev/null 2>&1
+	if [ ! -e /proc/sys/net/netfilter/nf_conntrack_max ]; then
+		echo "skip all tests: nf_conntrack is not available" >&2
+		exit 0
+	fi
+}
+
+cleanup()
+{
+	pg_cleanup
+	[ -n "$CREATED" ] && ip link del $DEV > /dev/null 2>&1
+	[ -n "$CREATED" ] && ip netns del $NS > /dev/null 2>&1
+	[ -n "$CT_MAX" ] && sysctl -q -w net.netfilter.nf_conntrack_max=$CT_MAX
+}
+
+setup()
+{
+	if ! ip netns add $NS > /dev/null 2>&1 ||
+	   ! ip link add $DEV type veth peer name $PEER > /dev/null 2>&1; then
+		ip netns del $NS > /dev/null 2>&1
+		echo "skip all tests: veth or netns is not available" >&2
+		exit 0
+	fi
+	CREATED=1
+
+	ip link set $PEER netns $NS
+	ip addr add $SRC/24 dev $DEV
+	ip link set $DEV up
+	ip netns exec $NS ip addr add $DST/24 dev $PEER
+	ip netns exec $NS ip link set $PEER up
+	ip netns exec $NS ip link set lo up
+	# random sources would be dropped as martians before the input hook
+	ip netns exec $NS sysctl -q -w net.ipv4.conf.all.rp_filter=0
+	ip netns exec $NS sysctl -q -w net.ipv4.conf.$PEER.rp_filter=0
+	ip netns exec $NS sysctl -q -w net.ipv4.icmp_ratelimit=1000
+	DST_MAC=$(ip netns exec $NS cat /sys/class/net/$PEER/address)
+
+	# measure the insert path, not early drop of a full table
+	CT_MAX=$(sysctl -n net.netfilter.nf_conntrack_max)
+	sysctl -q -w net.netfilter.nf_conntrack_max=$((MAX_THREADS * COUNT))
+
+	pg_limit_threads
+}
+
+# Sum of the per cpu "insert" counters of the namespace
+ct_inserts()
+{
+	local v sum=0
+
+	for v in $(ip netns exec $NS cat /proc/net/stat/nf_conntrack | awk '
+		NR == 1 { for (i = 1; i <= NF; i++) if ($i == "insert") col = i; next }
+		{ print $col }'); do
+		sum=$((sum + 16#$v))
+	done
+	echo $sum
+}
+
+# pg_thread_setup <pd> <i>: thread i sends from random ports of random
+# addresses in 10.i.0.0/16
+pg_thread_setup()
+{
+	local pd=$1
+	local i=$2
+
+	pgset $pd "dst $DST" || return 1
+	pgset $pd "dst_mac $DST_MAC" || return 1
+	pgset $pd "src_min 10.$i.0.1" || return 1
+	pgset $pd "src_max 10.$i.255.254" || return 1
+	pgset $pd "udp_src_min 1024" || return 1
+	pgset $pd "udp_src_max 65535" || return 1
+	pgset $pd "udp_dst_min 9" || return 1
+	pgset $pd "udp_dst_max 9" || return 1
+	pgset $pd "flag IPSRC_RND" || return 1
+	pgset $pd "flag UDPSRC_RND" || return 1
+}
+
+# run_threads <n>: send COUNT packets from each of n pktgen threads
+run_threads()
+{
+	local n=$1
+	local start end ins
+
+	pg_setup_threads $n $COUNT || return 1
+	start=$(date +%s%N)
+	ins=$(ct_inserts)
+
+	pg_start
+
+	end=$(date +%s%N)
+	ins=$(( $(ct_inserts) - ins ))
+
+	printf "%8d %14d %14d\n" $n $(pg_total_pps $n) \
+		$((ins * 1000000000 / (end - start + 1)))
+}
+
+prerequisite
+trap cleanup EXIT
+setup
+
+echo "pktgen into $DEV, $COUNT new udp flows of $PKT_SIZE bytes per thread"
+echo "conntrack: $(cat /sys/module/nf_conntrack/parameters/hashsize) buckets"
+printf "%8s %14s %14s\n" threads pps inserts/s
+for n in $(seq 1 $MAX_THREADS); do
+	run_threads $n || exit 1
+done
+
+exit 0
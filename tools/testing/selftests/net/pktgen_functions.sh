@@ -0,0 +1,100 @@
+#
+# Helpers shared by the pktgen_*_bench.sh scripts.  A script sets DEV,
+# PKT_SIZE and MAX_THREADS, sources this file and defines
+# pg_thread_setup <pd> <i>, which adds the per benchmark settings of
+# pktgen thread i on its device file pd.
+
+PGDIR=/proc/net/pktgen
+
+# pg_prerequisite: skip the benchmark unless run as root with pktgen
+pg_prerequisite()
+{
+	msg="skip all tests:"
+
+	if [ $UID != 0 ]; then
+		echo $msg must be run as root >&2
+		exit 0
+	fi
+
+	if [ ! -d $PGDIR ] && ! modprobe pktgen > /dev/null 2>&1; then
+		echo $msg pktgen is not available >&2
+		exit 0
+	fi
+}
+
+# pgset <file> <cmd>: write a pktgen command, fail unless it was accepted
+pgset()
+{
+	local file=$1
+	local cmd=$2
+
+	echo "$cmd" > $file
+	if ! grep -q "^Result: OK" $file; then
+		grep "^Result:" $file >&2
+		return 1
+	fi
+	return 0
+}
+
+# pg_cleanup: take all devices off all pktgen threads
+pg_cleanup()
+{
+	local t
+
+	for t in $PGDIR/kpktgend_*; do
+		echo "rem_device_all" > $t 2> /dev/null
+	done
+}
+
+# pg_limit_threads: no more than one sender per pktgen thread
+pg_limit_threads()
+{
+	local n=$(ls -d $PGDIR/kpktgend_* | wc -l)
+
+	if [ $MAX_THREADS -gt $n ]; then
+		MAX_THREADS=$n
+	fi
+}
+
+# pg_setup_threads <n> <count>: let pktgen threads 0..n-1 send count
+# packets of PKT_SIZE bytes each on DEV@i
+pg_setup_threads()
+{
+	local n=$1
+	local count=$2
+	local i pd
+
+	for i in $(seq 0 $((MAX_THREADS - 1))); do
+		echo "rem_device_all" > $PGDIR/kpktgend_$i
+	done
+
+	for i in $(seq 0 $((n - 1))); do
+		pd=$PGDIR/$DEV@$i
+
+		pgset $PGDIR/kpktgend_$i "add_device $DEV@$i" || return 1
+		pgset $pd "count $count" || return 1
+		pgset $pd "pkt_size $PKT_SIZE" || return 1
+		pgset $pd "delay 0" || return 1
+		pg_thread_setup $pd $i || return 1
+	done
+	return 0
+}
+
+# pg_start: run the threads set up, blocks until all of them are done
+pg_start()
+{
+	echo "start" > $PGDIR/pgctrl
+}
+
+# pg_total_pps <n>: aggregate packet rate of threads 0..n-1 in the last run
+pg_total_pps()
+{
+	local n=$1
+	local i pps total=0
+
+	for i in $(seq 0 $((n - 1))); do
+		pps=$(sed -n 's/^ *\([0-9]*\)pps .*/\1/p' $PGDIR/$DEV@$i)
+		total=$((total + ${pps:-0}))
+	done
+	echo $total
+}
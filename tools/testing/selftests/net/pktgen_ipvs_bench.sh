@@ -0,0 +1,156 @@
+#!/bin/bash
+#
+# IPVS packet path benchmark: run pktgen on 1..N threads, each sending a
+# fixed set of UDP flows into one end of a veth pair.  The other end sits
+# in its own network namespace which is a loopback LVS director: the
+# virtual service listens on an address of its lo and has that same
+# address as its only real server, so every packet is looked up in the
+# IPVS connection table, accounted and delivered locally.  The flows are
+# set up by a first short run, the timed runs then only hit existing
+# connections, which is the ip_vs_in() fast path.  Reports the aggregate
+# packet rate and the rate IPVS saw them at for each thread count, which
+# shows how well the connection lookup and the statistics scale with the
+# number of cpus.
+#
+# Needs root, pktgen, veth, network namespaces, ip_vs and ipvsadm.
+#
+#   MAX_THREADS=8 FLOWS=1000 COUNT=2000000 ./pktgen_ipvs_bench.sh
+
+PKT_SIZE=${PKT_SIZE:-60}
+COUNT=${COUNT:-2000000}
+FLOWS=${FLOWS:-1000}
+MAX_THREADS=${MAX_THREADS:-$(grep -c ^processor /proc/cpuinfo)}
+NS=ipvs-bench
+DEV=ipvs-bench0
+PEER=ipvs-bench1
+SRC=198.18.0.1
+DST=198.18.0.2
+VIP=198.19.0.1
+PORT=9
+
+source $(dirname $0)/pktgen_functions.sh
+
+prerequisite()
+{
+	msg="skip all tests:"
+
+	pg_prerequisite
+
+	modprobe ip_vs > /dev/null 2>&1
+	if [ ! -e /proc/net/ip_vs_stats_percpu ]; then
+		echo $msg ip_vs is not available >&2
+		exit 0
+	fi
+
+	if ! which ipvsadm > /dev/null 2>&1; then
+		echo $msg ipvsadm is not available >&2
+		exit 0
+	fi
+}
+
+cleanup()
+{
+	pg_cleanup
+	[ -n "$CREATED" ] && ip link del $DEV > /dev/null 2>&1
+	[ -n "$CREATED" ] && ip netns del $NS > /dev/null 2>&1
+}
+
+setup()
+{
+	if ! ip netns add $NS > /dev/null 2>&1 ||
+	   ! ip link add $DEV type veth peer name $PEER > /dev/null 2>&1; then
+		ip netns del $NS > /dev/null 2>&1
+		echo "skip all tests: veth or netns is not available" >&2
+		exit 0
+	fi
+	CREATED=1
+
+	ip link set $PEER netns $NS
+	ip addr add $SRC/24 dev $DEV
+	ip link set $DEV up
+	ip netns exec $NS ip addr add $DST/24 dev $PEER
+	ip netns exec $NS ip link set $PEER up
+	ip netns exec $NS ip link set lo up
+	ip netns exec $NS ip addr add $VIP/32 dev lo
+	# the flows come from addresses that are not on the link
+	ip netns exec $NS sysctl -q -w net.ipv4.conf.all.rp_filter=0
+	ip netns exec $NS sysctl -q -w net.ipv4.conf.$PEER.rp_filter=0
+	ip netns exec $NS ip route add 10.0.0.0/8 via $SRC dev $PEER
+	DST_MAC=$(ip netns exec $NS cat /sys/class/net/$PEER/address)
+
+	# loopback LVS: the director is its own real server
+	if ! ip netns exec $NS ipvsadm -A -u $VIP:$PORT -s rr ||
+	   ! ip netns exec $NS ipvsadm -a -u $VIP:$PORT -r $VIP:$PORT -g; then
+		echo "failed to set up the virtual service" >&2
+		exit 1
+	fi
+
+	pg_limit_threads
+}
+
+# Sum of the per cpu incoming packet counters of the namespace, the
+# totals in ip_vs_stats are only brought up to date by the estimator
+ipvs_inpkts()
+{
+	local v sum=0
+
+	for v in $(ip netns exec $NS awk 'NF == 6 && $1 ~ /^[0-9A-F]+$/ { print $3 }' \
+		   /proc/net/ip_vs_stats_percpu); do
+		sum=$((sum + 16#$v))
+	done
+	echo $sum
+}
+
+# pg_thread_setup <pd> <i>: thread i cycles through FLOWS source ports of
+# source address 10.i.0.1
+pg_thread_setup()
+{
+	local pd=$1
+	local i=$2
+
+	pgset $pd "dst $VIP" || return 1
+	pgset $pd "dst_mac $DST_MAC" || return 1
+	pgset $pd "src_min 10.$i.0.1" || return 1
+	pgset $pd "src_max 10.$i.0.1" || return 1
+	pgset $pd "udp_src_min 1024" || return 1
+	pgset $pd "udp_src_max $((1024 + FLOWS - 1))" || return 1
+	pgset $pd "udp_dst_min $PORT" || return 1
+	pgset $pd "udp_dst_max $PORT" || return 1
+}
+
+# run_threads <n>: send COUNT packets of established flows from n threads
+run_threads()
+{
+	local n=$1
+	local start end in
+
+	# create the connections first, they last for the udp timeout
+	pg_setup_threads $n $FLOWS || return 1
+	pg_start
+
+	pg_setup_threads $n $COUNT || return 1
+	start=$(date +%s%N)
+	in=$(ipvs_inpkts)
+
+	pg_start
+
+	end=$(date +%s%N)
+	in=$(( $(ipvs_inpkts) - in ))
+
+	printf "%8d %14d %14d\n" $n $(pg_total_pps $n) \
+		$((in * 1000000000 / (end - start + 1)))
+}
+
+prerequisite
+trap cleanup EXIT
+setup
+
+echo "pktgen into $DEV, $FLOWS udp flows and $COUNT packets of $PKT_SIZE bytes per thread"
+echo "ipvs: $(ip netns exec $NS ipvsadm -L -n | head -n 1)"
+printf "%8s %14s %14s\n" threads pps ipvs-pps
+for n in $(seq 1 $MAX_THREADS); do
+	run_threads $n || exit 1
+done
+echo "connections: $(ip netns exec $NS ipvsadm -L -n -c | tail -n +3 | wc -l)"
+
+exit 0
@@ -0,0 +1,86 @@
+#!/bin/bash
+#
+# Transmit path scalability benchmark: run pktgen on 1..N threads, all
+# sending to the same device through dev_queue_xmit() (pktgen flag
+# QUEUE_XMIT), and report the aggregate packet rate for each thread
+# count.  On a device whose tx queue has the default pfifo_fast qdisc
+# this measures how well the qdisc enqueue/dequeue path scales with the
+# number of sending cpus.
+#
+# Needs root and pktgen.
+#
+#   DEV=eth1 DST=10.0.0.2 DST_MAC=00:1b:21:3c:9d:f8 ./pktgen_qdisc_bench.sh
+#
+# Without DEV a dummy device with a 1000 packet tx queue is used, which
+# leaves the qdisc layer as the only bottleneck.
+
+DEV=${DEV:-}
+DST=${DST:-198.18.0.2}
+DST_MAC=${DST_MAC:-02:00:00:00:00:02}
+PKT_SIZE=${PKT_SIZE:-60}
+COUNT=${COUNT:-2000000}
+MAX_THREADS=${MAX_THREADS:-$(grep -c ^processor /proc/cpuinfo)}
+DUMMY=pktgen-dummy0
+
+source $(dirname $0)/pktgen_functions.sh
+
+cleanup()
+{
+	pg_cleanup
+	[ -n "$CREATED" ] && ip link del $DUMMY > /dev/null 2>&1
+}
+
+setup()
+{
+	if [ -z "$DEV" ]; then
+		if ! ip link add $DUMMY type dummy > /dev/null 2>&1; then
+			echo "skip all tests: dummy device is not available" >&2
+			exit 0
+		fi
+		CREATED=1
+		DEV=$DUMMY
+		# the qdisc is chosen when the device comes up
+		ip link set $DEV txqueuelen 1000
+		ip link set $DEV up
+	fi
+
+	pg_limit_threads
+}
+
+# pg_thread_setup <pd> <i>: all threads send through dev_queue_xmit()
+pg_thread_setup()
+{
+	local pd=$1
+
+	pgset $pd "dst $DST" || return 1
+	pgset $pd "dst_mac $DST_MAC" || return 1
+	pgset $pd "udp_src_min 9" || return 1
+	pgset $pd "udp_src_max 1009" || return 1
+	pgset $pd "flag QUEUE_XMIT" || return 1
+}
+
+# run_threads <n>: send COUNT packets from each of n pktgen threads
+run_threads()
+{
+	local n=$1
+	local total
+
+	pg_setup_threads $n $COUNT || return 1
+	pg_start
+	total=$(pg_total_pps $n)
+
+	printf "%8d %14d %14d\n" $n $total $((total / n))
+}
+
+pg_prerequisite
+trap cleanup EXIT
+setup
+
+echo "pktgen QUEUE_XMIT on $DEV, $COUNT packets of $PKT_SIZE bytes per thread"
+echo "qdisc: $(tc qdisc show dev $DEV 2> /dev/null | head -n 1)"
+printf "%8s %14s %14s\n" threads pps pps/thread
+for n in $(seq 1 $MAX_THREADS); do
+	run_threads $n || exit 1
+done
+
+exit 0
@@ -0,0 +1,172 @@
+#!/bin/bash
+#
+# iptables rule-set benchmark for the rate and connection limiting
+# matches: run pktgen on 1..N threads, each sending a fixed set of UDP
+# flows into one end of a veth pair.  The other end sits in its own
+# network namespace whose INPUT chain has one of these rule sets:
+#
+#   none       accept the packets, the baseline
+#   hashlimit  a per flow hashlimit in front of the accept
+#   connlimit  a per source address connlimit in front of the accept
+#
+# The limits are high enough that nothing is dropped.  The flows are set
+# up by a first short run, the timed runs then hit existing hashlimit
+# entries and confirmed conntracks, which is what an edge firewall sees
+# most of the time.  Reports the aggregate packet rate and the rate the
+# rules saw them at for each rule set and thread count, which shows how
+# well the matches scale with the number of cpus.
+#
+# Needs root, pktgen, veth, network namespaces, iptables and the
+# hashlimit and connlimit matches.
+#
+#   MAX_THREADS=8 FLOWS=1000 RULES="hashlimit connlimit" ./pktgen_xtables_bench.sh
+
+PKT_SIZE=${PKT_SIZE:-60}
+COUNT=${COUNT:-2000000}
+FLOWS=${FLOWS:-1000}
+RULES=${RULES:-"none hashlimit connlimit"}
+MAX_THREADS=${MAX_THREADS:-$(grep -c ^processor /proc/cpuinfo)}
+NS=xt-bench
+DEV=xt-bench0
+PEER=xt-bench1
+SRC=198.18.0.1
+DST=198.18.0.2
+PORT=9
+
+source $(dirname $0)/pktgen_functions.sh
+
+prerequisite()
+{
+	pg_prerequisite
+
+	if ! which iptables > /dev/null 2>&1; then
+		echo "skip all tests: iptables is not available" >&2
+		exit 0
+	fi
+}
+
+cleanup()
+{
+	pg_cleanup
+	[ -n "$CREATED" ] && ip link del $DEV > /dev/null 2>&1
+	[ -n "$CREATED" ] && ip netns del $NS > /dev/null 2>&1
+}
+
+setup()
+{
+	if ! ip netns add $NS > /dev/null 2>&1 ||
+	   ! ip link add $DEV type veth peer name $PEER > /dev/null 2>&1; then
+		ip netns del $NS > /dev/null 2>&1
+		echo "skip all tests: veth or netns is not available" >&2
+		exit 0
+	fi
+	CREATED=1
+
+	ip link set $PEER netns $NS
+	ip addr add $SRC/24 dev $DEV
+	ip link set $DEV up
+	ip netns exec $NS ip addr add $DST/24 dev $PEER
+	ip netns exec $NS ip link set $PEER up
+	# the flows come from addresses that are not on the link
+	ip netns exec $NS sysctl -q -w net.ipv4.conf.all.rp_filter=0
+	ip netns exec $NS sysctl -q -w net.ipv4.conf.$PEER.rp_filter=0
+	ip netns exec $NS ip route add 10.0.0.0/8 via $SRC dev $PEER
+	DST_MAC=$(ip netns exec $NS cat /sys/class/net/$PEER/address)
+
+	pg_limit_threads
+}
+
+# load_rules <set>: replace the INPUT chain of the namespace
+load_rules()
+{
+	local ipt="ip netns exec $NS iptables"
+
+	$ipt -F INPUT || return 1
+	case $1 in
+	none)
+		;;
+	hashlimit)
+		$ipt -A INPUT -p udp --dport $PORT -m hashlimit \
+			--hashlimit-above 10000/sec --hashlimit-burst 10000 \
+			--hashlimit-mode srcip,srcport --hashlimit-name xt-bench \
+			--hashlimit-htable-size 4096 -j DROP || return 1
+		;;
+	connlimit)
+		$ipt -A INPUT -p udp --dport $PORT -m connlimit \
+			--connlimit-above $((FLOWS * 2)) --connlimit-mask 32 \
+			-j DROP || return 1
+		;;
+	*)
+		echo "unknown rule set $1" >&2
+		return 1
+		;;
+	esac
+	$ipt -A INPUT -p udp --dport $PORT -j ACCEPT
+}
+
+# Packets that went through the last rule of the chain, the accept
+input_pkts()
+{
+	ip netns exec $NS iptables -n -v -x -L INPUT | awk '
+		$3 == "ACCEPT" { pkts = $1 }
+		END { print pkts + 0 }'
+}
+
+# pg_thread_setup <pd> <i>: thread i cycles through FLOWS source ports of
+# source address 10.i.0.1
+pg_thread_setup()
+{
+	local pd=$1
+	local i=$2
+
+	pgset $pd "dst $DST" || return 1
+	pgset $pd "dst_mac $DST_MAC" || return 1
+	pgset $pd "src_min 10.$i.0.1" || return 1
+	pgset $pd "src_max 10.$i.0.1" || return 1
+	pgset $pd "udp_src_min 1024" || return 1
+	pgset $pd "udp_src_max $((1024 + FLOWS - 1))" || return 1
+	pgset $pd "udp_dst_min $PORT" || return 1
+	pgset $pd "udp_dst_max $PORT" || return 1
+}
+
+# run_threads <set> <n>: send COUNT packets of established flows from n threads
+run_threads()
+{
+	local rules=$1
+	local n=$2
+	local start end in
+
+	# create the hashlimit entries and conntracks first
+	pg_setup_threads $n $FLOWS || return 1
+	pg_start
+
+	pg_setup_threads $n $COUNT || return 1
+	start=$(date +%s%N)
+	in=$(input_pkts)
+
+	pg_start
+
+	end=$(date +%s%N)
+	in=$(( $(input_pkts) - in ))
+
+	printf "%-10s %8d %14d %14d\n" $rules $n $(pg_total_pps $n) \
+		$((in * 1000000000 / (end - start + 1)))
+}
+
+prerequisite
+trap cleanup EXIT
+setup
+
+echo "pktgen into $DEV, $FLOWS udp flows and $COUNT packets of $PKT_SIZE bytes per thread"
+printf "%-10s %8s %14s %14s\n" rules threads pps accept-pps
+for rules in $RULES; do
+	if ! load_rules $rules; then
+		echo "failed to load the $rules rules" >&2
+		exit 1
+	fi
+	for n in $(seq 1 $MAX_THREADS); do
+		run_threads $rules $n || exit 1
+	done
+done
+
+exit 0
@@ -0,0 +1,263 @@
+/*
+ * Tests for the TPACKET_V3 transmit ring and PACKET_FANOUT_PERCPU.
+ *
+ * A block with several packets is queued on a TPACKET_V3 tx ring bound to
+ * the loopback device and sent with a single send(); a second packet socket
+ * has to see every packet and the block has to come back available.  Then
+ * the rules for joining a per cpu fanout group are checked.
+ *
+ * Needs root (CAP_NET_RAW).
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef PACKET_FANOUT_PERCPU
+#define PACKET_FANOUT_PERCPU	3
+#endif
+
+#define ETH_P_TEST	0x88b5		/* local experimental ethertype */
+#define BLOCK_SIZE	4096
+#define BLOCK_NR	4
+#define NUM_PKTS	3
+#define PKT_LEN		60
+#define FANOUT_ID	0x2a
+
+#define ALIGN8(x)	(((x) + 7) & ~7)
+
+static int ifindex;
+
+static int pfsocket(int ver)
+{
+	struct sockaddr_ll addr;
+	int fd;
+
+	fd = socket(PF_PACKET, SOCK_RAW, 0);
+	if (fd < 0) {
+		perror("socket");
+		exit(1);
+	}
+
+	if (ver >= 0 &&
+	    setsockopt(fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver))) {
+		perror("setsockopt PACKET_VERSION");
+		exit(1);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons(ETH_P_TEST);
+	addr.sll_ifindex = ifindex;
+	if (bind(fd, (void *)&addr, sizeof(addr))) {
+		perror("bind");
+		exit(1);
+	}
+
+	return fd;
+}
+
+static void fill_block(struct tpacket_block_desc *pbd)
+{
+	unsigned int hdrlen = TPACKET3_HDRLEN - sizeof(struct sockaddr_ll);
+	unsigned int off = ALIGN8(sizeof(*pbd));
+	struct tpacket3_hdr *ph;
+	struct ethhdr *eth;
+	int i;
+
+	pbd->hdr.bh1.offset_to_first_pkt = off;
+	pbd->hdr.bh1.num_pkts = NUM_PKTS;
+
+	for (i = 0; i < NUM_PKTS; i++) {
+		ph = (void *)pbd + off;
+		ph->tp_len = PKT_LEN;
+		ph->tp_next_offset = ALIGN8(hdrlen + PKT_LEN);
+
+		eth = (void *)ph + hdrlen;
+		memset(eth, 0, PKT_LEN);
+		eth->h_proto = htons(ETH_P_TEST);
+		((char *)eth)[sizeof(*eth)] = i;
+
+		off += ph->tp_next_offset;
+	}
+}
+
+static int test_tx_v3(void)
+{
+	struct tpacket_block_desc *pbd;
+	struct tpacket_req3 req;
+	struct sockaddr_ll from;
+	socklen_t alen;
+	struct pollfd pfd;
+	char buf[256];
+	int fd, rxfd, i, ret;
+	void *ring;
+
+	rxfd = pfsocket(-1);
+	fd = pfsocket(TPACKET_V3);
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = BLOCK_SIZE;
+	req.tp_block_nr = BLOCK_NR;
+	req.tp_frame_size = BLOCK_SIZE;
+	req.tp_frame_nr = BLOCK_NR;
+	if (setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req))) {
+		perror("setsockopt PACKET_TX_RING");
+		return 1;
+	}
+
+	ring = mmap(NULL, BLOCK_SIZE * BLOCK_NR, PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	pbd = ring;
+	if (pbd->hdr.bh1.block_status != TP_STATUS_AVAILABLE) {
+		fprintf(stderr, "tx block not available after setup\n");
+		return 1;
+	}
+
+	fill_block(pbd);
+	__sync_synchronize();
+	pbd->hdr.bh1.block_status = TP_STATUS_SEND_REQUEST;
+
+	ret = send(fd, NULL, 0, 0);
+	if (ret != NUM_PKTS * PKT_LEN) {
+		fprintf(stderr, "send returned %d, expected %d\n",
+			ret, NUM_PKTS * PKT_LEN);
+		return 1;
+	}
+
+	pfd.fd = rxfd;
+	pfd.events = POLLIN;
+	for (i = 0; i < NUM_PKTS; ) {
+		if (poll(&pfd, 1, 1000) != 1) {
+			fprintf(stderr, "received %d of %d packets\n",
+				i, NUM_PKTS);
+			return 1;
+		}
+		alen = sizeof(from);
+		ret = recvfrom(rxfd, buf, sizeof(buf), 0, (void *)&from, &alen);
+		/* loopback shows each packet leaving and arriving */
+		if (ret >= 0 && from.sll_pkttype == PACKET_OUTGOING)
+			continue;
+		if (ret != PKT_LEN || buf[sizeof(struct ethhdr)] != i) {
+			fprintf(stderr, "packet %d: bad length or order\n", i);
+			return 1;
+		}
+		i++;
+	}
+
+	/* The block is released when its last skb is freed */
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+	if (poll(&pfd, 1, 1000) != 1 ||
+	    pbd->hdr.bh1.block_status != TP_STATUS_AVAILABLE) {
+		fprintf(stderr, "tx block status %x after send\n",
+			pbd->hdr.bh1.block_status);
+		return 1;
+	}
+
+	munmap(ring, BLOCK_SIZE * BLOCK_NR);
+	close(fd);
+	close(rxfd);
+	fprintf(stderr, "tx_v3: OK\n");
+	return 0;
+}
+
+static int join_percpu(int fd)
+{
+	int arg = FANOUT_ID | (PACKET_FANOUT_PERCPU << 16);
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)))
+		return errno;
+	return 0;
+}
+
+static int test_fanout_percpu(void)
+{
+	cpu_set_t set;
+	int fd1, fd2, err;
+
+	fd1 = pfsocket(-1);
+	fd2 = pfsocket(-1);
+
+	if (sched_getaffinity(0, sizeof(set), &set)) {
+		perror("sched_getaffinity");
+		return 1;
+	}
+
+	if (CPU_COUNT(&set) > 1) {
+		err = join_percpu(fd1);
+		if (err != EINVAL) {
+			fprintf(stderr, "unpinned join: %s, expected EINVAL\n",
+				strerror(err));
+			return 1;
+		}
+	}
+
+	for (err = 0; !CPU_ISSET(err, &set); err++)
+		;
+	CPU_ZERO(&set);
+	CPU_SET(err, &set);
+	if (sched_setaffinity(0, sizeof(set), &set)) {
+		perror("sched_setaffinity");
+		return 1;
+	}
+
+	err = join_percpu(fd1);
+	if (err) {
+		fprintf(stderr, "pinned join: %s\n", strerror(err));
+		return 1;
+	}
+
+	err = join_percpu(fd2);
+	if (err != EBUSY) {
+		fprintf(stderr, "second join on cpu: %s, expected EBUSY\n",
+			strerror(err));
+		return 1;
+	}
+
+	close(fd2);
+	close(fd1);
+	fprintf(stderr, "fanout_percpu: OK\n");
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int ret = 0;
+
+	ifindex = if_nametoindex("lo");
+	if (!ifindex) {
+		perror("if_nametoindex");
+		return 1;
+	}
+
+	ret |= test_tx_v3();
+	ret |= test_fanout_percpu();
+
+	if (!ret)
+		fprintf(stderr, "OK. All tests passed\n");
+	return ret;
+}
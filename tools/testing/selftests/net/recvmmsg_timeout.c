@@ -0,0 +1,191 @@
+/*
+ * Tests for the recvmmsg() timeout.
+ *
+ * A call that got part of its vector has to return what it has once the
+ * timeout expires, one that got nothing has to fail with EAGAIN at the
+ * same point, and both have to take about as long as the timeout.  A
+ * shutdown(SHUT_RD) while the call waits for more has to end it right
+ * away with what was received, UDP keeps answering EAGAIN to the receive
+ * itself afterwards.
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define VLEN		8
+#define TIMEOUT_MS	200
+
+static int tx, rx;
+
+static double now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e3 + tv.tv_usec / 1e3;
+}
+
+/* a connected pair of UDP sockets on the loopback */
+static int setup(void)
+{
+	struct sockaddr_in a, b;
+	socklen_t len = sizeof(a);
+
+	tx = socket(AF_INET, SOCK_DGRAM, 0);
+	rx = socket(AF_INET, SOCK_DGRAM, 0);
+	if (tx < 0 || rx < 0)
+		return -1;
+
+	memset(&a, 0, sizeof(a));
+	a.sin_family = AF_INET;
+	a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	b = a;
+	if (bind(rx, (struct sockaddr *)&a, sizeof(a)) ||
+	    getsockname(rx, (struct sockaddr *)&a, &len) ||
+	    bind(tx, (struct sockaddr *)&b, sizeof(b)) ||
+	    getsockname(tx, (struct sockaddr *)&b, &len) ||
+	    connect(tx, (struct sockaddr *)&a, sizeof(a)) ||
+	    connect(rx, (struct sockaddr *)&b, sizeof(b)))
+		return -1;
+	return 0;
+}
+
+static int send_some(int n)
+{
+	char buf[32] = "recvmmsg_timeout";
+
+	while (n--)
+		if (send(tx, buf, sizeof(buf), 0) != sizeof(buf))
+			return -1;
+	return 0;
+}
+
+/* recvmmsg() on rx with a timeout of ms, returns its result and duration */
+static int recv_vector(int ms, double *elapsed)
+{
+	static char bufs[VLEN][64];
+	struct mmsghdr msgs[VLEN];
+	struct iovec iovs[VLEN];
+	struct timespec ts;
+	double start;
+	int i, ret;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < VLEN; i++) {
+		iovs[i].iov_base = bufs[i];
+		iovs[i].iov_len = sizeof(bufs[i]);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+
+	start = now_ms();
+	ret = recvmmsg(rx, msgs, VLEN, 0, &ts);
+	*elapsed = now_ms() - start;
+	return ret;
+}
+
+static void stuck(int sig)
+{
+	static const char msg[] = "recvmmsg did not return: FAIL\n";
+
+	write(2, msg, sizeof(msg) - 1);
+	_exit(1);
+}
+
+static void *shut_later(void *arg)
+{
+	usleep(100000);
+	shutdown(rx, SHUT_RD);
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t thread;
+	double elapsed;
+	int ret, err = 0;
+
+	if (setup()) {
+		perror("setup");
+		return 1;
+	}
+
+	/* a call that never returns fails the test */
+	signal(SIGALRM, stuck);
+	alarm(10);
+
+	/* partial vector: returned when the timeout expires */
+	if (send_some(3))
+		return 1;
+	ret = recv_vector(TIMEOUT_MS, &elapsed);
+	if (ret != 3 || elapsed < TIMEOUT_MS * 0.9 || elapsed > TIMEOUT_MS * 5) {
+		fprintf(stderr, "partial vector: got %d after %.0f ms: FAIL\n",
+			ret, elapsed);
+		err = 1;
+	} else {
+		printf("partial vector returned after %.0f ms: OK\n", elapsed);
+	}
+
+	/* nothing at all: EAGAIN once the timeout expires */
+	ret = recv_vector(TIMEOUT_MS, &elapsed);
+	if (ret != -1 || errno != EAGAIN ||
+	    elapsed < TIMEOUT_MS * 0.9 || elapsed > TIMEOUT_MS * 5) {
+		fprintf(stderr, "empty vector: got %d (%s) after %.0f ms: FAIL\n",
+			ret, strerror(errno), elapsed);
+		err = 1;
+	} else {
+		printf("empty vector timed out after %.0f ms: OK\n", elapsed);
+	}
+
+	/* shutdown while waiting for the rest: returned at once */
+	if (send_some(1))
+		return 1;
+	if (pthread_create(&thread, NULL, shut_later, NULL)) {
+		fprintf(stderr, "pthread_create failed\n");
+		return 1;
+	}
+	ret = recv_vector(5000, &elapsed);
+	pthread_join(thread, NULL);
+	if (ret != 1 || elapsed > 1000) {
+		fprintf(stderr, "shutdown while waiting: got %d after %.0f ms: FAIL\n",
+			ret, elapsed);
+		err = 1;
+	} else {
+		printf("shutdown while waiting returned after %.0f ms: OK\n",
+		       elapsed);
+	}
+
+	/* and with nothing received it reads as end of file */
+	ret = recv_vector(5000, &elapsed);
+	if (ret != 0 || elapsed > 1000) {
+		fprintf(stderr, "shut down socket: got %d after %.0f ms: FAIL\n",
+			ret, elapsed);
+		err = 1;
+	} else {
+		printf("shut down socket returned 0: OK\n");
+	}
+
+	close(tx);
+	close(rx);
+	return err;
+}
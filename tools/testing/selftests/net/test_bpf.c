@@ -0,0 +1,658 @@
+/*
+ * Tests for the bpf() system call and SO_ATTACH_BPF.
+ *
+ * Hash and array maps are driven through the map commands, a few programs
+ * the verifier has to reject are loaded, and a socket filter that counts
+ * packets in an array map is attached to a UDP socket on loopback.
+ *
+ * Classic filters that the JIT does not take are converted to extended
+ * BPF when attached.  A set of them, covering the ancillary loads,
+ * negative offsets, the MSH load, division by a zero X, large constants
+ * and conditional jumps taken both ways, is attached to a packet socket
+ * on the loopback of a private network namespace with the JIT turned
+ * off.  Each has to give the result sk_run_filter() gives, seen as the
+ * length of the packet received or as no packet when it returns 0.
+ *
+ * Needs root (CAP_SYS_ADMIN).
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifndef __NR_bpf
+# if defined(__x86_64__)
+#  define __NR_bpf	313
+# elif defined(__i386__)
+#  define __NR_bpf	350
+# else
+#  error __NR_bpf not defined
+# endif
+#endif
+
+#ifndef SO_ATTACH_BPF
+#define SO_ATTACH_BPF	46
+#endif
+
+#define NUM_PKTS	3
+#define PKT_LEN		100
+#define LOG_SIZE	65536
+
+/* udp packets the classic filters look at, 106 bytes on the wire */
+#define CL_PAYLOAD	64
+#define CL_FRAME	(ETH_HLEN + 20 + 8 + CL_PAYLOAD)
+#define CL_PAYLOAD_OFF	(ETH_HLEN + 20 + 8)
+#define CL_MARK		9
+
+#define INSN(CODE, DST, SRC, OFF, IMM)					\
+	((struct bpf_insn) {						\
+		.code = CODE, .dst_reg = DST, .src_reg = SRC,		\
+		.off = OFF, .imm = IMM })
+
+#define MOV64_REG(DST, SRC)	INSN(BPF_ALU64 | BPF_MOV | BPF_X, DST, SRC, 0, 0)
+#define MOV64_IMM(DST, IMM)	INSN(BPF_ALU64 | BPF_MOV | BPF_K, DST, 0, 0, IMM)
+#define ADD64_IMM(DST, IMM)	INSN(BPF_ALU64 | BPF_ADD | BPF_K, DST, 0, 0, IMM)
+#define LDX_MEM(SZ, DST, SRC, OFF) \
+	INSN(BPF_LDX | BPF_MEM | SZ, DST, SRC, OFF, 0)
+#define STX_MEM(SZ, DST, SRC, OFF) \
+	INSN(BPF_STX | BPF_MEM | SZ, DST, SRC, OFF, 0)
+#define STX_XADD(SZ, DST, SRC, OFF) \
+	INSN(BPF_STX | BPF_XADD | SZ, DST, SRC, OFF, 0)
+#define JEQ_IMM(DST, IMM, OFF)	INSN(BPF_JMP | BPF_JEQ | BPF_K, DST, 0, OFF, IMM)
+#define JA(OFF)			INSN(BPF_JMP | BPF_JA, 0, 0, OFF, 0)
+#define CALL(FUNC)		INSN(BPF_JMP | BPF_CALL, 0, 0, 0, FUNC)
+#define EXIT()			INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+/* two instructions */
+#define LD_MAP_FD(DST, FD)						\
+	INSN(BPF_LD | BPF_DW | BPF_IMM, DST, BPF_PSEUDO_MAP_FD, 0, FD),	\
+	INSN(0, 0, 0, 0, 0)
+
+static char log_buf[LOG_SIZE];
+
+static uint64_t ptr_to_u64(const void *ptr)
+{
+	return (uint64_t) (unsigned long) ptr;
+}
+
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int map_create(int type, int key_size, int value_size, int max)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = type;
+	attr.key_size = key_size;
+	attr.value_size = value_size;
+	attr.max_entries = max;
+	return sys_bpf(BPF_MAP_CREATE, &attr);
+}
+
+static int map_op(int cmd, int fd, void *key, void *value, int flags)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = fd;
+	attr.key = ptr_to_u64(key);
+	attr.value = ptr_to_u64(value);
+	attr.flags = flags;
+	return sys_bpf(cmd, &attr);
+}
+
+static int prog_load(const struct bpf_insn *insns, int cnt)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+	attr.insns = ptr_to_u64(insns);
+	attr.insn_cnt = cnt;
+	attr.license = ptr_to_u64("GPL");
+	attr.log_buf = ptr_to_u64(log_buf);
+	attr.log_size = LOG_SIZE;
+	attr.log_level = 1;
+	log_buf[0] = 0;
+	return sys_bpf(BPF_PROG_LOAD, &attr);
+}
+
+#define expect(cond, what)						\
+	do {								\
+		if (!(cond)) {						\
+			fprintf(stderr, "%s: %s (%s)\n", __func__,	\
+				what, strerror(errno));			\
+			return 1;					\
+		}							\
+	} while (0)
+
+static int test_hash_map(void)
+{
+	uint32_t key, next;
+	uint64_t value;
+	int fd, n;
+
+	fd = map_create(BPF_MAP_TYPE_HASH, sizeof(key), sizeof(value), 2);
+	expect(fd >= 0, "create");
+
+	key = 1;
+	value = 1234;
+	expect(!map_op(BPF_MAP_UPDATE_ELEM, fd, &key, &value, BPF_ANY),
+	       "insert");
+	value = 0;
+	expect(!map_op(BPF_MAP_LOOKUP_ELEM, fd, &key, &value, 0) &&
+	       value == 1234, "lookup");
+	expect(map_op(BPF_MAP_UPDATE_ELEM, fd, &key, &value, BPF_NOEXIST) &&
+	       errno == EEXIST, "update with BPF_NOEXIST");
+
+	key = 2;
+	expect(map_op(BPF_MAP_UPDATE_ELEM, fd, &key, &value, BPF_EXIST) &&
+	       errno == ENOENT, "update missing with BPF_EXIST");
+	expect(!map_op(BPF_MAP_UPDATE_ELEM, fd, &key, &value, BPF_NOEXIST),
+	       "second insert");
+	key = 3;
+	expect(map_op(BPF_MAP_UPDATE_ELEM, fd, &key, &value, BPF_ANY) &&
+	       errno == E2BIG, "insert into full map");
+
+	/* walk the map starting from a key that does not exist */
+	key = 0;
+	for (n = 0; !map_op(BPF_MAP_GET_NEXT_KEY, fd, &key, &next, 0); n++)
+		key = next;
+	expect(errno == ENOENT && n == 2, "walk");
+
+	key = 1;
+	expect(!map_op(BPF_MAP_DELETE_ELEM, fd, &key, NULL, 0), "delete");
+	expect(map_op(BPF_MAP_LOOKUP_ELEM, fd, &key, &value, 0) &&
+	       errno == ENOENT, "lookup deleted");
+
+	close(fd);
+	fprintf(stderr, "hash_map: OK\n");
+	return 0;
+}
+
+static int test_array_map(void)
+{
+	uint32_t key;
+	uint64_t value;
+	int fd;
+
+	fd = map_create(BPF_MAP_TYPE_ARRAY, sizeof(key), sizeof(value), 2);
+	expect(fd >= 0, "create");
+
+	key = 1;
+	expect(!map_op(BPF_MAP_LOOKUP_ELEM, fd, &key, &value, 0) &&
+	       value == 0, "lookup zeroed element");
+	value = 42;
+	expect(!map_op(BPF_MAP_UPDATE_ELEM, fd, &key, &value, BPF_ANY),
+	       "update");
+	expect(map_op(BPF_MAP_UPDATE_ELEM, fd, &key, &value, BPF_NOEXIST) &&
+	       errno == EEXIST, "update with BPF_NOEXIST");
+	key = 2;
+	expect(map_op(BPF_MAP_UPDATE_ELEM, fd, &key, &value, BPF_ANY) &&
+	       errno == E2BIG, "update out of range");
+	key = 0;
+	expect(map_op(BPF_MAP_DELETE_ELEM, fd, &key, NULL, 0) &&
+	       errno == EINVAL, "delete");
+
+	close(fd);
+	fprintf(stderr, "array_map: OK\n");
+	return 0;
+}
+
+static int test_verifier(void)
+{
+	const struct bpf_insn loop[] = {
+		MOV64_IMM(BPF_REG_0, 0),
+		JA(-2),
+		EXIT(),
+	};
+	const struct bpf_insn no_ret[] = {
+		EXIT(),
+	};
+	const struct bpf_insn ok[] = {
+		MOV64_IMM(BPF_REG_0, 0),
+		EXIT(),
+	};
+	int map_fd, fd;
+
+	map_fd = map_create(BPF_MAP_TYPE_HASH, sizeof(uint32_t),
+			    sizeof(uint64_t), 1);
+	expect(map_fd >= 0, "create");
+
+	{
+		/* map value used without checking the lookup for NULL */
+		const struct bpf_insn no_null_check[] = {
+			MOV64_IMM(BPF_REG_0, 0),
+			STX_MEM(BPF_W, BPF_REG_10, BPF_REG_0, -4),
+			MOV64_REG(BPF_REG_2, BPF_REG_10),
+			ADD64_IMM(BPF_REG_2, -4),
+			LD_MAP_FD(BPF_REG_1, map_fd),
+			CALL(BPF_FUNC_map_lookup_elem),
+			LDX_MEM(BPF_DW, BPF_REG_0, BPF_REG_0, 0),
+			EXIT(),
+		};
+
+		fd = prog_load(no_null_check, 8);
+		expect(fd < 0 && errno == EACCES, "missing NULL check");
+	}
+
+	fd = prog_load(loop, 3);
+	expect(fd < 0 && errno == EINVAL, "loop");
+	fd = prog_load(no_ret, 1);
+	expect(fd < 0 && errno == EACCES, "uninitialized R0");
+	fd = prog_load(ok, 2);
+	expect(fd >= 0, "valid program");
+
+	close(fd);
+	close(map_fd);
+	fprintf(stderr, "verifier: OK\n");
+	return 0;
+}
+
+static int test_socket_filter(void)
+{
+	struct sockaddr_in addr;
+	socklen_t alen = sizeof(addr);
+	char buf[PKT_LEN];
+	uint64_t count;
+	uint32_t key = 0;
+	int map_fd, prog_fd, rfd, sfd, i;
+
+	map_fd = map_create(BPF_MAP_TYPE_ARRAY, sizeof(key), sizeof(count), 1);
+	expect(map_fd >= 0, "create");
+
+	{
+		/* count packets in map[0] and accept them whole */
+		const struct bpf_insn prog[] = {
+			MOV64_REG(BPF_REG_6, BPF_REG_1),
+			LDX_MEM(BPF_W, BPF_REG_7, BPF_REG_6,
+				offsetof(struct __sk_buff, len)),
+			MOV64_IMM(BPF_REG_0, 0),
+			STX_MEM(BPF_W, BPF_REG_10, BPF_REG_0, -4),
+			MOV64_REG(BPF_REG_2, BPF_REG_10),
+			ADD64_IMM(BPF_REG_2, -4),
+			LD_MAP_FD(BPF_REG_1, map_fd),
+			CALL(BPF_FUNC_map_lookup_elem),
+			JEQ_IMM(BPF_REG_0, 0, 2),
+			MOV64_IMM(BPF_REG_1, 1),
+			STX_XADD(BPF_DW, BPF_REG_0, BPF_REG_1, 0),
+			MOV64_REG(BPF_REG_0, BPF_REG_7),
+			EXIT(),
+		};
+
+		prog_fd = prog_load(prog, sizeof(prog) / sizeof(prog[0]));
+		if (prog_fd < 0)
+			fprintf(stderr, "%s", log_buf);
+		expect(prog_fd >= 0, "load");
+	}
+
+	rfd = socket(AF_INET, SOCK_DGRAM, 0);
+	sfd = socket(AF_INET, SOCK_DGRAM, 0);
+	expect(rfd >= 0 && sfd >= 0, "socket");
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	expect(!bind(rfd, (void *)&addr, sizeof(addr)) &&
+	       !getsockname(rfd, (void *)&addr, &alen), "bind");
+
+	expect(!setsockopt(rfd, SOL_SOCKET, SO_ATTACH_BPF, &prog_fd,
+			   sizeof(prog_fd)), "SO_ATTACH_BPF");
+	/* the socket holds its own reference to the program */
+	close(prog_fd);
+
+	memset(buf, 0xaa, sizeof(buf));
+	for (i = 0; i < NUM_PKTS; i++) {
+		expect(sendto(sfd, buf, sizeof(buf), 0, (void *)&addr,
+			      sizeof(addr)) == sizeof(buf), "sendto");
+		expect(recv(rfd, buf, sizeof(buf), 0) == sizeof(buf), "recv");
+	}
+
+	expect(!map_op(BPF_MAP_LOOKUP_ELEM, map_fd, &key, &count, 0),
+	       "lookup");
+	if (count != NUM_PKTS) {
+		fprintf(stderr, "%s: counted %llu of %d packets\n", __func__,
+			(unsigned long long) count, NUM_PKTS);
+		return 1;
+	}
+
+	close(sfd);
+	close(rfd);
+	close(map_fd);
+	fprintf(stderr, "socket_filter: OK\n");
+	return 0;
+}
+
+struct classic_test {
+	const char *name;
+	struct sock_filter insns[16];
+	unsigned int expect;		/* result, 0 if the packet is dropped */
+};
+
+#define AD(x)	(SKF_AD_OFF + SKF_AD_##x)
+
+static const struct classic_test classic_tests[] = {
+	{ "ancillary protocol", {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, AD(PROTOCOL)),
+		BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 8),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, ETH_P_IP >> 8 },
+	{ "ancillary pkttype", {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, AD(PKTTYPE)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_HOST, 1, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 50),
+		BPF_STMT(BPF_RET | BPF_K, 51) }, 50 },
+	{ "ancillary ifindex", {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, AD(IFINDEX)),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, 1 },
+	{ "ancillary nlattr", {
+		BPF_STMT(BPF_LD | BPF_IMM, CL_PAYLOAD_OFF),
+		BPF_STMT(BPF_LDX | BPF_IMM, 5),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, AD(NLATTR)),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, CL_PAYLOAD_OFF },
+	{ "ancillary nlattr not found", {
+		BPF_STMT(BPF_LD | BPF_IMM, CL_PAYLOAD_OFF),
+		BPF_STMT(BPF_LDX | BPF_IMM, 7),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, AD(NLATTR)),
+		BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 3),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, 3 },
+	{ "ancillary nlattr_nest", {
+		BPF_STMT(BPF_LD | BPF_IMM, CL_PAYLOAD_OFF),
+		BPF_STMT(BPF_LDX | BPF_IMM, 6),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, AD(NLATTR_NEST)),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, CL_PAYLOAD_OFF + 4 },
+	{ "ancillary mark", {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, AD(MARK)),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, CL_MARK },
+	{ "ancillary queue", {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, AD(QUEUE)),
+		BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 1),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, 1 },
+	{ "ancillary hatype", {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, AD(HATYPE)),
+		BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, ARPHRD_LOOPBACK - 70),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, 70 },
+	{ "ancillary rxhash and cpu", {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, AD(RXHASH)),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, AD(CPU)),
+		BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0),
+		BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 4),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, 4 },
+	{ "ancillary alu_xor_x", {
+		BPF_STMT(BPF_LD | BPF_IMM, 0xf0),
+		BPF_STMT(BPF_LDX | BPF_IMM, 0xa5),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, AD(ALU_XOR_X)),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, 0xf0 ^ 0xa5 },
+	{ "ancillary len", {
+		BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, CL_FRAME },
+	{ "ldx msh", {
+		BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, ETH_HLEN),
+		BPF_STMT(BPF_MISC | BPF_TXA, 0),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, 20 },
+	{ "ldx msh, indirect load", {
+		BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, ETH_HLEN),
+		BPF_STMT(BPF_LD | BPF_B | BPF_IND, ETH_HLEN + 4 + 1),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, 8 + CL_PAYLOAD },
+	{ "div by X == 0", {
+		BPF_STMT(BPF_LDX | BPF_IMM, 0),
+		BPF_STMT(BPF_LD | BPF_IMM, 10),
+		BPF_STMT(BPF_ALU | BPF_DIV | BPF_X, 0),
+		BPF_STMT(BPF_RET | BPF_K, 60) }, 0 },
+	{ "div by X", {
+		BPF_STMT(BPF_LDX | BPF_IMM, 3),
+		BPF_STMT(BPF_LD | BPF_IMM, 100),
+		BPF_STMT(BPF_ALU | BPF_DIV | BPF_X, 0),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, 33 },
+	{ "jeq, jt and jf non-zero, true", {
+		BPF_STMT(BPF_LD | BPF_IMM, 5),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 5, 1, 2),
+		BPF_STMT(BPF_RET | BPF_K, 10),
+		BPF_STMT(BPF_RET | BPF_K, 20),
+		BPF_STMT(BPF_RET | BPF_K, 30) }, 20 },
+	{ "jeq, jt and jf non-zero, false", {
+		BPF_STMT(BPF_LD | BPF_IMM, 6),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 5, 1, 2),
+		BPF_STMT(BPF_RET | BPF_K, 10),
+		BPF_STMT(BPF_RET | BPF_K, 20),
+		BPF_STMT(BPF_RET | BPF_K, 30) }, 30 },
+	{ "jset on X, jt and jf non-zero", {
+		BPF_STMT(BPF_LDX | BPF_IMM, 0x10),
+		BPF_STMT(BPF_LD | BPF_IMM, 0x30),
+		BPF_JUMP(BPF_JMP | BPF_JSET | BPF_X, 0, 2, 1),
+		BPF_STMT(BPF_RET | BPF_K, 10),
+		BPF_STMT(BPF_RET | BPF_K, 20),
+		BPF_STMT(BPF_RET | BPF_K, 30) }, 30 },
+	{ "large K, unsigned compare", {
+		BPF_STMT(BPF_LD | BPF_IMM, 0x80000000),
+		BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 0x7fffffff, 1, 2),
+		BPF_STMT(BPF_RET | BPF_K, 10),
+		BPF_STMT(BPF_RET | BPF_K, 33),
+		BPF_STMT(BPF_RET | BPF_K, 44) }, 33 },
+	{ "large K, 32 bit wrap", {
+		BPF_STMT(BPF_LD | BPF_IMM, 0xfffffff0),
+		BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 0x20),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, 0x10 },
+	{ "large K, unsigned division", {
+		BPF_STMT(BPF_LD | BPF_IMM, 0xffffffff),
+		BPF_STMT(BPF_ALU | BPF_DIV | BPF_K, 0x10000000),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, 15 },
+	{ "large K, logical shift", {
+		BPF_STMT(BPF_LD | BPF_IMM, 0x80000000),
+		BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 28),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, 8 },
+	{ "large X, 32 bit wrap and neg", {
+		BPF_STMT(BPF_LDX | BPF_IMM, 0xffffffd0),
+		BPF_STMT(BPF_LD | BPF_IMM, 0x10),
+		BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+		BPF_STMT(BPF_ALU | BPF_NEG, 0),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, 0x20 },
+	{ "scratch memory", {
+		BPF_STMT(BPF_LD | BPF_IMM, 7),
+		BPF_STMT(BPF_ST, 15),
+		BPF_STMT(BPF_LD | BPF_IMM, 0),
+		BPF_STMT(BPF_LDX | BPF_MEM, 15),
+		BPF_STMT(BPF_MISC | BPF_TXA, 0),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, 7 },
+	{ "SKF_NET_OFF load", {
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 9),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, IPPROTO_UDP },
+	{ "SKF_NET_OFF indirect load", {
+		BPF_STMT(BPF_LDX | BPF_IMM, 2),
+		BPF_STMT(BPF_LD | BPF_H | BPF_IND, SKF_NET_OFF + 20 + 2),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, 8 + CL_PAYLOAD },
+	{ "SKF_LL_OFF load", {
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, SKF_LL_OFF + 12),
+		BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 8),
+		BPF_STMT(BPF_RET | BPF_A, 0) }, ETH_P_IP >> 8 },
+	{ "SKF_NET_OFF load past the end", {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 1000),
+		BPF_STMT(BPF_RET | BPF_K, 60) }, 0 },
+	{ "load past the end", {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, CL_FRAME - 2),
+		BPF_STMT(BPF_RET | BPF_K, 60) }, 0 },
+};
+
+static int filter_len(const struct classic_test *t)
+{
+	int n = sizeof(t->insns) / sizeof(t->insns[0]);
+
+	/* the insns after the last return are all zero */
+	while (n > 1 && !t->insns[n - 1].code && !t->insns[n - 1].k)
+		n--;
+	return n;
+}
+
+static int set_jit(int on)
+{
+	FILE *f = fopen("/proc/sys/net/core/bpf_jit_enable", "r+");
+	int old = 0;
+
+	if (!f)
+		return 0;
+	if (fscanf(f, "%d", &old) != 1)
+		old = 0;
+	rewind(f);
+	fprintf(f, "%d\n", on);
+	fclose(f);
+	return old;
+}
+
+static int lo_up(void)
+{
+	struct ifreq ifr;
+	int fd, ret;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return -1;
+	memset(&ifr, 0, sizeof(ifr));
+	strcpy(ifr.ifr_name, "lo");
+	ret = ioctl(fd, SIOCGIFFLAGS, &ifr);
+	if (!ret) {
+		ifr.ifr_flags |= IFF_UP;
+		ret = ioctl(fd, SIOCSIFFLAGS, &ifr);
+	}
+	close(fd);
+	return ret;
+}
+
+/* Result of t on one udp packet over lo, -1 on errors */
+static int run_classic(const struct classic_test *t, int sfd,
+		       const struct sockaddr_in *dst, const char *payload)
+{
+	struct sock_fprog fprog = {
+		.len = filter_len(t),
+		.filter = (struct sock_filter *)t->insns,
+	};
+	struct timeval tv = { .tv_usec = 200000 };
+	struct sockaddr_ll sll;
+	char frame[CL_FRAME + 64];
+	int pfd, n;
+
+	/* no protocol yet: nothing comes in before the filter is there */
+	pfd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (pfd < 0)
+		return -1;
+	if (setsockopt(pfd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog,
+		       sizeof(fprog)) ||
+	    setsockopt(pfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv))) {
+		close(pfd);
+		return -1;
+	}
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_IP);
+	sll.sll_ifindex = if_nametoindex("lo");
+	if (bind(pfd, (struct sockaddr *)&sll, sizeof(sll))) {
+		close(pfd);
+		return -1;
+	}
+
+	if (sendto(sfd, payload, CL_PAYLOAD, 0, (const struct sockaddr *)dst,
+		   sizeof(*dst)) != CL_PAYLOAD) {
+		close(pfd);
+		return -1;
+	}
+	n = recv(pfd, frame, sizeof(frame), 0);
+	if (n < 0 && errno == EAGAIN)
+		n = 0;
+	close(pfd);
+	return n;
+}
+
+static int test_classic(void)
+{
+	struct sockaddr_in dst;
+	socklen_t alen = sizeof(dst);
+	char payload[CL_PAYLOAD];
+	int i, n, rfd, sfd, jit, mark = CL_MARK, ret = 0;
+
+	/* a loopback of our own, nobody else's packets to filter */
+	expect(!unshare(CLONE_NEWNET) && !lo_up(), "private loopback");
+
+	/* an nlattr of type 5 with a nested one of type 6 */
+	memset(payload, 0, sizeof(payload));
+	payload[0] = 16;
+	payload[2] = 5;
+	payload[4] = 8;
+	payload[6] = 6;
+
+	/* a receiver, so that no icmp error follows the packets */
+	rfd = socket(AF_INET, SOCK_DGRAM, 0);
+	sfd = socket(AF_INET, SOCK_DGRAM, 0);
+	expect(rfd >= 0 && sfd >= 0, "socket");
+	memset(&dst, 0, sizeof(dst));
+	dst.sin_family = AF_INET;
+	dst.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	expect(!bind(rfd, (void *)&dst, sizeof(dst)) &&
+	       !getsockname(rfd, (void *)&dst, &alen), "bind");
+	expect(!setsockopt(sfd, SOL_SOCKET, SO_MARK, &mark, sizeof(mark)),
+	       "SO_MARK");
+
+	/* the classic filters are to be converted, not compiled */
+	jit = set_jit(0);
+
+	for (i = 0; i < sizeof(classic_tests) / sizeof(classic_tests[0]); i++) {
+		const struct classic_test *t = &classic_tests[i];
+
+		n = run_classic(t, sfd, &dst, payload);
+		if (n != t->expect) {
+			fprintf(stderr, "%s: %s: got %d, expected %u (%s)\n",
+				__func__, t->name, n, t->expect,
+				n < 0 ? strerror(errno) : "result");
+			ret = 1;
+		}
+	}
+
+	set_jit(jit);
+	close(sfd);
+	close(rfd);
+	if (!ret)
+		fprintf(stderr, "classic: OK\n");
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int ret = 0;
+
+	ret |= test_hash_map();
+	ret |= test_array_map();
+	ret |= test_verifier();
+	ret |= test_socket_filter();
+	/* last, it moves us to a network namespace of our own */
+	ret |= test_classic();
+
+	if (!ret)
+		fprintf(stderr, "OK. All tests passed\n");
+	return ret;
+}
@@ -0,0 +1,275 @@
+/*
+ * Tests for multiqueue tun devices.
+ *
+ * Attaches several queues to one tun device, sends UDP flows with
+ * different source ports through it and checks that they are spread
+ * over the queues with every flow read from a single queue.  A queue
+ * disabled with TUNSETQUEUE must get nothing until it is enabled again,
+ * and attaching without IFF_MULTI_QUEUE must be refused.
+ *
+ * Needs root and CONFIG_TUN, skipped otherwise.
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <linux/if_tun.h>
+
+#define NUM_QUEUES	4
+#define NUM_FLOWS	64
+#define PKTS_PER_FLOW	4
+#define DST_PORT	9099
+
+static const char *local_addr = "10.211.0.1";
+static const char *peer_addr = "10.211.0.2";
+
+static char ifname[IFNAMSIZ];
+static int fds[NUM_QUEUES];
+
+static int tun_open_queue(int flags)
+{
+	struct ifreq ifr;
+	int fd;
+
+	fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+	if (fd < 0)
+		return -1;
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TUN | IFF_NO_PI | flags;
+	strcpy(ifr.ifr_name, ifname);
+	if (ioctl(fd, TUNSETIFF, &ifr)) {
+		close(fd);
+		return -1;
+	}
+	strcpy(ifname, ifr.ifr_name);
+	return fd;
+}
+
+static int tun_set_queue(int fd, int enable)
+{
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = enable ? IFF_ATTACH_QUEUE : IFF_DETACH_QUEUE;
+	return ioctl(fd, TUNSETQUEUE, &ifr);
+}
+
+static int set_addr(int sock, unsigned long req, const char *addr)
+{
+	struct sockaddr_in *sin;
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strcpy(ifr.ifr_name, ifname);
+	sin = (struct sockaddr_in *)&ifr.ifr_addr;
+	sin->sin_family = AF_INET;
+	inet_pton(AF_INET, addr, &sin->sin_addr);
+	return ioctl(sock, req, &ifr);
+}
+
+static int bring_up(void)
+{
+	struct ifreq ifr;
+	int sock, ret = -1;
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0)
+		return -1;
+	if (set_addr(sock, SIOCSIFADDR, local_addr) ||
+	    set_addr(sock, SIOCSIFDSTADDR, peer_addr))
+		goto out;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strcpy(ifr.ifr_name, ifname);
+	if (ioctl(sock, SIOCGIFFLAGS, &ifr))
+		goto out;
+	ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+	ret = ioctl(sock, SIOCSIFFLAGS, &ifr);
+out:
+	close(sock);
+	return ret;
+}
+
+/* send PKTS_PER_FLOW datagrams on each of NUM_FLOWS sockets */
+static int send_flows(int *socks)
+{
+	char payload[32] = "tun_multiqueue";
+	int i, j;
+
+	for (i = 0; i < NUM_FLOWS; i++)
+		for (j = 0; j < PKTS_PER_FLOW; j++)
+			if (send(socks[i], payload, sizeof(payload), 0) < 0) {
+				perror("send");
+				return -1;
+			}
+	usleep(100000);
+	return 0;
+}
+
+/* read all queues, record which queue every source port came from */
+static int drain(int *queue_of_port, int *per_queue)
+{
+	unsigned char buf[2048];
+	struct iphdr *iph = (struct iphdr *)buf;
+	struct udphdr *udph;
+	int q, port, errors = 0;
+	ssize_t n;
+
+	memset(per_queue, 0, NUM_QUEUES * sizeof(*per_queue));
+	for (q = 0; q < NUM_QUEUES; q++) {
+		while ((n = read(fds[q], buf, sizeof(buf))) > 0) {
+			if (n < (ssize_t)(sizeof(*iph) + sizeof(*udph)) ||
+			    iph->version != 4 || iph->protocol != IPPROTO_UDP)
+				continue;
+			udph = (struct udphdr *)(buf + iph->ihl * 4);
+			if (ntohs(udph->dest) != DST_PORT)
+				continue;
+
+			port = ntohs(udph->source);
+			if (queue_of_port[port] < 0)
+				queue_of_port[port] = q;
+			else if (queue_of_port[port] != q) {
+				fprintf(stderr, "flow from port %d on queues %d and %d\n",
+					port, queue_of_port[port], q);
+				errors++;
+			}
+			per_queue[q]++;
+		}
+	}
+	return errors;
+}
+
+int main(void)
+{
+	int queue_of_port[65536];
+	int per_queue[NUM_QUEUES];
+	int socks[NUM_FLOWS];
+	struct sockaddr_in sin;
+	int i, fd, used, ret = 0;
+
+	if (geteuid()) {
+		fprintf(stderr, "tun_multiqueue: must be run as root, skipped\n");
+		return 0;
+	}
+
+	strcpy(ifname, "tunmq%d");
+	for (i = 0; i < NUM_QUEUES; i++) {
+		fds[i] = tun_open_queue(IFF_MULTI_QUEUE);
+		if (fds[i] < 0) {
+			if (i == 0) {
+				fprintf(stderr, "tun_multiqueue: no multiqueue tun (%s), skipped\n",
+					strerror(errno));
+				return 0;
+			}
+			perror("TUNSETIFF queue");
+			return 1;
+		}
+	}
+
+	/* a single queue attach to a multiqueue device is refused */
+	fd = tun_open_queue(0);
+	if (fd >= 0 || errno != EINVAL) {
+		fprintf(stderr, "single queue attach: FAIL\n");
+		ret = 1;
+		if (fd >= 0)
+			close(fd);
+	} else {
+		printf("single queue attach refused: OK\n");
+	}
+
+	if (bring_up()) {
+		perror("bring up");
+		return 1;
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(DST_PORT);
+	inet_pton(AF_INET, peer_addr, &sin.sin_addr);
+	for (i = 0; i < NUM_FLOWS; i++) {
+		socks[i] = socket(AF_INET, SOCK_DGRAM, 0);
+		if (socks[i] < 0 ||
+		    connect(socks[i], (struct sockaddr *)&sin, sizeof(sin))) {
+			perror("udp socket");
+			return 1;
+		}
+	}
+
+	/* all flows on one queue each, more than one queue in use */
+	memset(queue_of_port, -1, sizeof(queue_of_port));
+	if (send_flows(socks))
+		return 1;
+	used = 0;
+	if (drain(queue_of_port, per_queue))
+		ret = 1;
+	for (i = 0; i < NUM_QUEUES; i++) {
+		printf("queue %d: %d packets\n", i, per_queue[i]);
+		if (per_queue[i])
+			used++;
+	}
+	if (used < 2) {
+		fprintf(stderr, "flows spread over queues: FAIL\n");
+		ret = 1;
+	} else {
+		printf("flows spread over %d queues: OK\n", used);
+	}
+
+	/* a disabled queue gets nothing */
+	if (tun_set_queue(fds[0], 0)) {
+		perror("TUNSETQUEUE detach");
+		return 1;
+	}
+	memset(queue_of_port, -1, sizeof(queue_of_port));
+	if (send_flows(socks))
+		return 1;
+	drain(queue_of_port, per_queue);
+	if (per_queue[0]) {
+		fprintf(stderr, "disabled queue got %d packets: FAIL\n",
+			per_queue[0]);
+		ret = 1;
+	} else {
+		printf("disabled queue idle: OK\n");
+	}
+
+	/* and gets its share again once enabled */
+	if (tun_set_queue(fds[0], 1)) {
+		perror("TUNSETQUEUE attach");
+		return 1;
+	}
+	memset(queue_of_port, -1, sizeof(queue_of_port));
+	if (send_flows(socks))
+		return 1;
+	if (drain(queue_of_port, per_queue))
+		ret = 1;
+	if (!per_queue[0]) {
+		fprintf(stderr, "enabled queue got no packets: FAIL\n");
+		ret = 1;
+	} else {
+		printf("enabled queue used again: OK\n");
+	}
+
+	for (i = 0; i < NUM_FLOWS; i++)
+		close(socks[i]);
+	for (i = 0; i < NUM_QUEUES; i++)
+		close(fds[i]);
+	return ret;
+}
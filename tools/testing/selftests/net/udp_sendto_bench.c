@@ -0,0 +1,179 @@
+/*
+ * Throughput of sendto() on one unconnected UDP socket.
+ *
+ * One or more threads share a socket and send small datagrams round robin
+ * to a set of destinations in 127.0.0.0/8, as a server replying to many
+ * clients does.  The datagrams are dropped by a receiver that never reads,
+ * so the numbers are dominated by the transmit path and its route lookup.
+ * Compare the rate with few destinations (cache friendly) against many.
+ *
+ *   ./udp_sendto_bench [-d destinations] [-t threads] [-s seconds] [-l len]
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define BENCH_PORT	9099
+
+static int num_dests = 16;
+static int num_threads = 1;
+static int seconds = 5;
+static int payload_len = 32;
+
+static int fd;
+static volatile int stop;
+
+struct worker {
+	pthread_t thread;
+	int id;
+	unsigned long sent;
+	unsigned long errors;
+};
+
+static void dest_addr(struct sockaddr_in *sin, int i)
+{
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_port = htons(BENCH_PORT);
+	/* 127.1.x.y, skipping host parts 0 and 255 */
+	sin->sin_addr.s_addr = htonl(0x7f010000 | ((i / 254) << 8) |
+				     (i % 254 + 1));
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	struct sockaddr_in sin;
+	char buf[65507];
+	int i = w->id;
+
+	memset(buf, 0xa5, payload_len);
+
+	while (!stop) {
+		dest_addr(&sin, i);
+		if (sendto(fd, buf, payload_len, 0,
+			   (struct sockaddr *)&sin, sizeof(sin)) < 0)
+			w->errors++;
+		else
+			w->sent++;
+		if (++i >= num_dests)
+			i = 0;
+	}
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-d destinations] [-t threads] "
+		"[-s seconds] [-l len]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_in sin;
+	struct timeval start, end;
+	unsigned long sent = 0, errors = 0;
+	struct worker *workers;
+	double elapsed;
+	int rfd, opt, i;
+
+	while ((opt = getopt(argc, argv, "d:t:s:l:")) != -1) {
+		switch (opt) {
+		case 'd':
+			num_dests = atoi(optarg);
+			break;
+		case 't':
+			num_threads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'l':
+			payload_len = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (num_dests < 1 || num_dests > 254 * 255 || num_threads < 1 ||
+	    seconds < 1 || payload_len < 0 || payload_len > 65507)
+		usage(argv[0]);
+
+	/* sink that never reads, so datagrams stop at its receive buffer */
+	rfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (rfd < 0) {
+		perror("socket");
+		return 1;
+	}
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(BENCH_PORT);
+	sin.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(rfd, (struct sockaddr *)&sin, sizeof(sin))) {
+		perror("bind");
+		return 1;
+	}
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return 1;
+	}
+
+	workers = calloc(num_threads, sizeof(*workers));
+	if (!workers) {
+		perror("calloc");
+		return 1;
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num_threads; i++) {
+		workers[i].id = i % num_dests;
+		if (pthread_create(&workers[i].thread, NULL, worker_fn,
+				   &workers[i])) {
+			fprintf(stderr, "pthread_create failed\n");
+			return 1;
+		}
+	}
+
+	sleep(seconds);
+	stop = 1;
+
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		sent += workers[i].sent;
+		errors += workers[i].errors;
+	}
+	gettimeofday(&end, NULL);
+
+	elapsed = (end.tv_sec - start.tv_sec) +
+		  (end.tv_usec - start.tv_usec) / 1e6;
+
+	printf("destinations %d threads %d len %d: %.0f sendto/s",
+	       num_dests, num_threads, payload_len, sent / elapsed);
+	if (errors)
+		printf(" (%lu errors)", errors);
+	printf("\n");
+
+	close(fd);
+	close(rfd);
+	free(workers);
+	return 0;
+}
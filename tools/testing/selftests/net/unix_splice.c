@@ -0,0 +1,208 @@
+/*
+ * Tests for splice() on AF_UNIX stream sockets.
+ *
+ * Data spliced from a pipe into one end of a socketpair is queued as page
+ * references and has to come out of recv() intact, also when it is read
+ * in pieces smaller than a page and peeked at first.  Data written with
+ * send() has to come out of splice() from the other end into a pipe.
+ * The payload is large enough to need several skbs and several rounds
+ * through the pipe in both directions.
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define PAYLOAD		(1 << 20)
+#define READ_SIZE	1000
+
+static unsigned char pattern(size_t i)
+{
+	return (i * 7 + (i >> 12)) & 0xff;
+}
+
+static int check(const unsigned char *buf, size_t off, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (buf[i] != pattern(off + i)) {
+			fprintf(stderr, "mismatch at byte %zu\n", off + i);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* write PAYLOAD bytes of the pattern to fd, in a child */
+static pid_t writer(int fd, int use_send)
+{
+	unsigned char buf[4096];
+	size_t off = 0, i;
+	pid_t pid;
+
+	pid = fork();
+	if (pid)
+		return pid;
+
+	while (off < PAYLOAD) {
+		ssize_t n;
+
+		for (i = 0; i < sizeof(buf); i++)
+			buf[i] = pattern(off + i);
+		if (use_send)
+			n = send(fd, buf, sizeof(buf), 0);
+		else
+			n = write(fd, buf, sizeof(buf));
+		if (n <= 0) {
+			perror("write");
+			_exit(1);
+		}
+		off += n;
+	}
+	_exit(0);
+}
+
+static int wait_writer(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status))
+		return -1;
+	return 0;
+}
+
+/* pipe -> splice -> socket (sendpage) -> recv() */
+static int test_splice_in(int sv[2])
+{
+	unsigned char buf[READ_SIZE];
+	int pfd[2];
+	size_t off = 0, spliced = 0;
+	pid_t pid;
+	ssize_t n;
+
+	if (pipe(pfd)) {
+		perror("pipe");
+		return -1;
+	}
+
+	pid = writer(pfd[1], 0);
+	close(pfd[1]);
+
+	/* a full socket must not block the single thread draining it */
+	fcntl(sv[0], F_SETFL, O_NONBLOCK);
+
+	while (off < PAYLOAD) {
+		if (spliced < PAYLOAD) {
+			n = splice(pfd[0], NULL, sv[0], NULL, PAYLOAD - spliced,
+				   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n < 0 && errno != EAGAIN) {
+				perror("splice to socket");
+				return -1;
+			}
+			if (n > 0)
+				spliced += n;
+		}
+
+		/* peek first, it must not consume anything */
+		n = recv(sv[1], buf, sizeof(buf), MSG_PEEK | MSG_DONTWAIT);
+		if (n < 0 && errno == EAGAIN)
+			continue;
+		if (n <= 0 || check(buf, off, n)) {
+			fprintf(stderr, "recv(MSG_PEEK) failed at %zu\n", off);
+			return -1;
+		}
+
+		n = recv(sv[1], buf, sizeof(buf), 0);
+		if (n <= 0 || check(buf, off, n)) {
+			fprintf(stderr, "recv failed at %zu\n", off);
+			return -1;
+		}
+		off += n;
+	}
+
+	close(pfd[0]);
+	fcntl(sv[0], F_SETFL, 0);
+	return wait_writer(pid);
+}
+
+/* send() -> socket -> splice -> pipe -> read() */
+static int test_splice_out(int sv[2])
+{
+	unsigned char buf[4096];
+	int pfd[2];
+	size_t off = 0;
+	pid_t pid;
+	ssize_t n, m;
+
+	if (pipe(pfd)) {
+		perror("pipe");
+		return -1;
+	}
+
+	pid = writer(sv[0], 1);
+
+	while (off < PAYLOAD) {
+		n = splice(sv[1], NULL, pfd[1], NULL, sizeof(buf), 0);
+		if (n <= 0) {
+			perror("splice from socket");
+			return -1;
+		}
+		while (n) {
+			m = read(pfd[0], buf, n);
+			if (m <= 0 || check(buf, off, m)) {
+				fprintf(stderr, "read failed at %zu\n", off);
+				return -1;
+			}
+			off += m;
+			n -= m;
+		}
+	}
+
+	close(pfd[0]);
+	close(pfd[1]);
+	return wait_writer(pid);
+}
+
+int main(void)
+{
+	int sv[2];
+	int ret = 0;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+		perror("socketpair");
+		return 1;
+	}
+
+	if (test_splice_in(sv)) {
+		fprintf(stderr, "splice into unix socket: FAIL\n");
+		ret = 1;
+	} else {
+		printf("splice into unix socket: OK\n");
+	}
+
+	if (test_splice_out(sv)) {
+		fprintf(stderr, "splice out of unix socket: FAIL\n");
+		ret = 1;
+	} else {
+		printf("splice out of unix socket: OK\n");
+	}
+
+	close(sv[0]);
+	close(sv[1]);
+	return ret;
+}
@@ -2,7 +2,10 @@
 #include <getopt.h>
 #include <string.h>
 #include <poll.h>
+#include <pthread.h>
 #include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
@@ -92,7 +95,8 @@ static void vq_info_add(struct vdev_info *dev, int num)
 	assert(r >= 0);
 	memset(info->ring, 0, vring_size(num, 4096));
 	vring_init(&info->vring, num, info->ring, 4096);
-	info->vq = vring_new_virtqueue(info->vring.num, 4096, &dev->vdev,
+	info->vq = vring_new_virtqueue(info->idx,
+				       info->vring.num, 4096, &dev->vdev,
 				       true, info->ring,
 				       vq_notify, vq_callback, "test");
 	assert(info->vq);
@@ -198,6 +202,92 @@ static void run_test(struct vdev_info *dev, struct vq_info *vq,
 	fprintf(stderr, "spurious wakeus: 0x%llx\n", spurious);
 }
 
+/* One queue: a device of its own, so a vhost worker of its own */
+struct queue_info {
+	struct vdev_info dev;
+	pthread_t thread;
+	bool delayed;
+	int bufs;
+};
+
+/* Busy time of all cpus in seconds, from /proc/stat */
+static double host_busy(void)
+{
+	unsigned long long user, nice, sys, idle, iowait, irq, softirq;
+	FILE *f = fopen("/proc/stat", "r");
+	int r;
+
+	if (!f)
+		return 0;
+	r = fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu", &user, &nice,
+		   &sys, &idle, &iowait, &irq, &softirq);
+	fclose(f);
+	if (r != 7)
+		return 0;
+	return (double)(user + nice + sys + irq + softirq) /
+		sysconf(_SC_CLK_TCK);
+}
+
+/* Cpu time used by this process in seconds */
+static double self_busy(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+		ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static void *run_queue(void *arg)
+{
+	struct queue_info *q = arg;
+
+	run_test(&q->dev, &q->dev.vqs[0], q->delayed, q->bufs);
+	return NULL;
+}
+
+/* Run @nqueues queues in parallel, each from a thread of its own, the
+ * way a guest drives one virtio-net queue pair per vcpu. */
+static void run_queues(unsigned long long features, int nqueues,
+		       bool delayed, int bufs)
+{
+	struct queue_info *q;
+	struct timeval start, end;
+	double secs, host, self;
+	int i, r;
+
+	q = calloc(nqueues, sizeof *q);
+	assert(q);
+	for (i = 0; i < nqueues; ++i) {
+		vdev_info_init(&q[i].dev, features);
+		vq_info_add(&q[i].dev, 256);
+		q[i].delayed = delayed;
+		q[i].bufs = bufs;
+	}
+
+	host = host_busy();
+	self = self_busy();
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nqueues; ++i) {
+		r = pthread_create(&q[i].thread, NULL, run_queue, &q[i]);
+		assert(!r);
+	}
+	for (i = 0; i < nqueues; ++i)
+		pthread_join(q[i].thread, NULL);
+	gettimeofday(&end, NULL);
+	host = host_busy() - host;
+	self = self_busy() - self;
+
+	/* What the test threads did not use went mostly to vhost workers */
+	secs = end.tv_sec - start.tv_sec +
+		(end.tv_usec - start.tv_usec) / 1e6;
+	fprintf(stderr, "%d queue(s): %d bufs each in %.3f s, %.0f bufs/s\n",
+		nqueues, bufs, secs, nqueues * (double)bufs / secs);
+	fprintf(stderr, "cpus busy: %.2f host, %.2f test threads, %.2f other\n",
+		host / secs, self / secs, (host - self) / secs);
+	free(q);
+}
+
 const char optstring[] = "h";
 const struct option longopts[] = {
 	{
@@ -228,6 +318,16 @@ const struct option longopts[] = {
 		.name = "no-delayed-interrupt",
 		.val = 'd',
 	},
+	{
+		.name = "queues",
+		.has_arg = required_argument,
+		.val = 'q',
+	},
+	{
+		.name = "bufs",
+		.has_arg = required_argument,
+		.val = 'b',
+	},
 	{
 	}
 };
@@ -238,6 +338,8 @@ static void help()
 		" [--no-indirect]"
 		" [--no-event-idx]"
 		" [--delayed-interrupt]"
+		" [--queues=N]"
+		" [--bufs=N]"
 		"\n");
 }
 
@@ -246,7 +348,7 @@ int main(int argc, char **argv)
 	struct vdev_info dev;
 	unsigned long long features = (1ULL << VIRTIO_RING_F_INDIRECT_DESC) |
 		(1ULL << VIRTIO_RING_F_EVENT_IDX);
-	int o;
+	int o, nqueues = 0, bufs = 0x100000;
 	bool delayed = false;
 
 	for (;;) {
@@ -269,6 +371,20 @@ int main(int argc, char **argv)
 		case 'D':
 			delayed = true;
 			break;
+		case 'q':
+			nqueues = atoi(optarg);
+			if (nqueues < 1) {
+				help();
+				exit(2);
+			}
+			break;
+		case 'b':
+			bufs = atoi(optarg);
+			if (bufs < 1) {
+				help();
+				exit(2);
+			}
+			break;
 		default:
 			assert(0);
 			break;
@@ -276,8 +392,13 @@ int main(int argc, char **argv)
 	}
 
 done:
+	if (nqueues) {
+		run_queues(features, nqueues, delayed, bufs);
+		return 0;
+	}
+
 	vdev_info_init(&dev, features);
 	vq_info_add(&dev, 256);
-	run_test(&dev, &dev.vqs[0], delayed, 0x100000);
+	run_test(&dev, &dev.vqs[0], delayed, bufs);
 	return 0;
 }